@@ -0,0 +1,470 @@
+// Micro-benchmarks of the preference hot paths, run against the emulated
+// Arduino `Preferences`.
+//
+// For every value type, measures:
+// * get_cold: `get()` of a freshly constructed preference (sync from store),
+// * get_warm: `get()` of a cached preference,
+// * set_same: `set()` with the value already cached,
+// * set_changed: `set()` with a different value,
+// * clear: `clear()` of a set preference,
+// and, for lazy-write preferences, a burst of changing `set()` calls followed
+// by the flush.
+//
+// Reports ns/op, store calls/op and bytes written/op. Also reports the
+// footprint (`sizeof`) of `Pref<T>` and `LazyWritePref<T>` per value type,
+// not counting heap-allocated string contents or pending values of large
+// types. Results are printed as a table, and as JSON lines (one object per
+// benchmark) to the file named by the BENCHMARK_OUTPUT environment variable,
+// or to stdout if not set. Set BENCHMARK_MIN_TIME_MS to change the minimum
+// measurement time per benchmark (default: 200).
+//
+// Run with: bazel run -c opt //:prefs_benchmark
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+#include "roo_prefs/lazy_write_pref.h"
+#include "roo_testing/system/timer.h"
+
+namespace roo_prefs {
+namespace {
+
+/// Counts calls reaching the store, and the payload bytes written.
+class CountingStore : public ForwardingStore {
+ public:
+  explicit CountingStore(Store& delegate)
+      : ForwardingStore(delegate), calls_(0), bytes_written_(0) {}
+
+  uint64_t calls() const { return calls_; }
+  uint64_t bytes_written() const { return bytes_written_; }
+
+  bool isKey(const char* key) override {
+    ++calls_;
+    return ForwardingStore::isKey(key);
+  }
+
+  ClearResult clear(const char* key) override {
+    ++calls_;
+    return ForwardingStore::clear(key);
+  }
+
+  WriteResult writeBool(const char* key, bool val) override {
+    return countWrite(ForwardingStore::writeBool(key, val), sizeof(val));
+  }
+
+  WriteResult writeU8(const char* key, uint8_t val) override {
+    return countWrite(ForwardingStore::writeU8(key, val), sizeof(val));
+  }
+
+  WriteResult writeI8(const char* key, int8_t val) override {
+    return countWrite(ForwardingStore::writeI8(key, val), sizeof(val));
+  }
+
+  WriteResult writeU16(const char* key, uint16_t val) override {
+    return countWrite(ForwardingStore::writeU16(key, val), sizeof(val));
+  }
+
+  WriteResult writeI16(const char* key, int16_t val) override {
+    return countWrite(ForwardingStore::writeI16(key, val), sizeof(val));
+  }
+
+  WriteResult writeU32(const char* key, uint32_t val) override {
+    return countWrite(ForwardingStore::writeU32(key, val), sizeof(val));
+  }
+
+  WriteResult writeI32(const char* key, int32_t val) override {
+    return countWrite(ForwardingStore::writeI32(key, val), sizeof(val));
+  }
+
+  WriteResult writeU64(const char* key, uint64_t val) override {
+    return countWrite(ForwardingStore::writeU64(key, val), sizeof(val));
+  }
+
+  WriteResult writeI64(const char* key, int64_t val) override {
+    return countWrite(ForwardingStore::writeI64(key, val), sizeof(val));
+  }
+
+  WriteResult writeFloat(const char* key, float val) override {
+    return countWrite(ForwardingStore::writeFloat(key, val), sizeof(val));
+  }
+
+  WriteResult writeDouble(const char* key, double val) override {
+    return countWrite(ForwardingStore::writeDouble(key, val), sizeof(val));
+  }
+
+  WriteResult writeString(const char* key, roo::string_view val) override {
+    return countWrite(ForwardingStore::writeString(key, val), val.size());
+  }
+
+  WriteResult writeBytes(const char* key, const void* val,
+                         size_t len) override {
+    return countWrite(ForwardingStore::writeBytes(key, val, len), len);
+  }
+
+  ReadResult readBool(const char* key, bool& val) override {
+    ++calls_;
+    return ForwardingStore::readBool(key, val);
+  }
+
+  ReadResult readU8(const char* key, uint8_t& val) override {
+    ++calls_;
+    return ForwardingStore::readU8(key, val);
+  }
+
+  ReadResult readI8(const char* key, int8_t& val) override {
+    ++calls_;
+    return ForwardingStore::readI8(key, val);
+  }
+
+  ReadResult readU16(const char* key, uint16_t& val) override {
+    ++calls_;
+    return ForwardingStore::readU16(key, val);
+  }
+
+  ReadResult readI16(const char* key, int16_t& val) override {
+    ++calls_;
+    return ForwardingStore::readI16(key, val);
+  }
+
+  ReadResult readU32(const char* key, uint32_t& val) override {
+    ++calls_;
+    return ForwardingStore::readU32(key, val);
+  }
+
+  ReadResult readI32(const char* key, int32_t& val) override {
+    ++calls_;
+    return ForwardingStore::readI32(key, val);
+  }
+
+  ReadResult readU64(const char* key, uint64_t& val) override {
+    ++calls_;
+    return ForwardingStore::readU64(key, val);
+  }
+
+  ReadResult readI64(const char* key, int64_t& val) override {
+    ++calls_;
+    return ForwardingStore::readI64(key, val);
+  }
+
+  ReadResult readFloat(const char* key, float& val) override {
+    ++calls_;
+    return ForwardingStore::readFloat(key, val);
+  }
+
+  ReadResult readDouble(const char* key, double& val) override {
+    ++calls_;
+    return ForwardingStore::readDouble(key, val);
+  }
+
+  ReadResult readString(const char* key, std::string& val) override {
+    ++calls_;
+    return ForwardingStore::readString(key, val);
+  }
+
+  ReadResult readBytes(const char* key, void* val, size_t max_len,
+                       size_t* out_len) override {
+    ++calls_;
+    return ForwardingStore::readBytes(key, val, max_len, out_len);
+  }
+
+  ReadResult readBytesLength(const char* key, size_t* out_len) override {
+    ++calls_;
+    return ForwardingStore::readBytesLength(key, out_len);
+  }
+
+ protected:
+  bool begin(const char* collection_name, bool read_only) override {
+    ++calls_;
+    return ForwardingStore::begin(collection_name, read_only);
+  }
+
+  void end() override {
+    ++calls_;
+    ForwardingStore::end();
+  }
+
+  WriteResult writeObjectInternal(const char* key, const void* val,
+                                  size_t size) override {
+    return countWrite(ForwardingStore::writeObjectInternal(key, val, size),
+                      size);
+  }
+
+  ReadResult readObjectInternal(const char* key, void* val,
+                                size_t size) override {
+    ++calls_;
+    return ForwardingStore::readObjectInternal(key, val, size);
+  }
+
+ private:
+  WriteResult countWrite(WriteResult result, size_t bytes) {
+    ++calls_;
+    if (result == WriteResult::kOk) bytes_written_ += bytes;
+    return result;
+  }
+
+  uint64_t calls_;
+  uint64_t bytes_written_;
+};
+
+struct Blob16 {
+  uint8_t data[16];
+  bool operator==(const Blob16& other) const {
+    return memcmp(data, other.data, sizeof(data)) == 0;
+  }
+};
+
+struct Blob64 {
+  uint8_t data[64];
+  bool operator==(const Blob64& other) const {
+    return memcmp(data, other.data, sizeof(data)) == 0;
+  }
+};
+
+// Two distinct values of each benchmarked type.
+template <typename T>
+struct Values {
+  static T a() { return T(1); }
+  static T b() { return T(2); }
+};
+
+template <>
+struct Values<bool> {
+  static bool a() { return false; }
+  static bool b() { return true; }
+};
+
+template <>
+struct Values<std::string> {
+  static std::string a() { return "first-value-of-the-string-preference"; }
+  static std::string b() { return "second-value-of-the-string-preference"; }
+};
+
+template <>
+struct Values<Blob16> {
+  static Blob16 a() { return Blob16{{1}}; }
+  static Blob16 b() { return Blob16{{2}}; }
+};
+
+template <>
+struct Values<Blob64> {
+  static Blob64 a() { return Blob64{{1}}; }
+  static Blob64 b() { return Blob64{{2}}; }
+};
+
+class Reporter {
+ public:
+  Reporter() : out_(stdout), owned_(false) {
+    const char* path = getenv("BENCHMARK_OUTPUT");
+    if (path != nullptr && *path != '\0') {
+      FILE* f = fopen(path, "w");
+      if (f != nullptr) {
+        out_ = f;
+        owned_ = true;
+      }
+    }
+    printf("%-28s %12s %12s %14s %14s\n", "benchmark", "iterations",
+           "ns/op", "store_calls/op", "bytes_written/op");
+  }
+
+  ~Reporter() {
+    if (owned_) fclose(out_);
+  }
+
+  void report(const std::string& name, uint64_t iterations, double ns,
+              uint64_t calls, uint64_t bytes) {
+    double n = (double)iterations;
+    printf("%-28s %12llu %12.1f %14.2f %14.2f\n", name.c_str(),
+           (unsigned long long)iterations, ns / n, calls / n, bytes / n);
+    fprintf(out_,
+            "{\"benchmark\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,"
+            "\"store_calls_per_op\":%.3f,\"bytes_written_per_op\":%.3f}\n",
+            name.c_str(), (unsigned long long)iterations, ns / n, calls / n,
+            bytes / n);
+    fflush(out_);
+  }
+
+  void reportFootprint(const std::string& name, size_t pref_bytes,
+                       size_t lazy_bytes) {
+    printf("%-28s %12s %12zu %14s %14zu\n", name.c_str(), "sizeof",
+           pref_bytes, "lazy sizeof", lazy_bytes);
+    fprintf(out_,
+            "{\"benchmark\":\"%s\",\"pref_bytes\":%zu,\"lazy_bytes\":%zu}\n",
+            name.c_str(), pref_bytes, lazy_bytes);
+    fflush(out_);
+  }
+
+ private:
+  FILE* out_;
+  bool owned_;
+};
+
+Reporter& GetReporter() {
+  static Reporter reporter;
+  return reporter;
+}
+
+double MinTimeNs() {
+  const char* min_time = getenv("BENCHMARK_MIN_TIME_MS");
+  long ms = (min_time != nullptr) ? atol(min_time) : 200;
+  if (ms <= 0) ms = 1;
+  return ms * 1e6;
+}
+
+using Clock = std::chrono::steady_clock;
+
+double ElapsedNs(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+      .count();
+}
+
+// Runs `op` (after an untimed `setup`) until the minimum measurement time is
+// reached, timing each call individually when a setup is present, and in
+// bulk otherwise.
+void Run(const std::string& name, CountingStore& store,
+         const std::function<void()>& setup, const std::function<void()>& op) {
+  double min_time_ns = MinTimeNs();
+  uint64_t iterations = 0;
+  uint64_t calls = 0;
+  uint64_t bytes = 0;
+  double total_ns = 0;
+  uint64_t batch = 1;
+  while (total_ns < min_time_ns && iterations < 10000000) {
+    if (setup) {
+      for (uint64_t i = 0; i < batch; ++i) {
+        setup();
+        uint64_t calls_before = store.calls();
+        uint64_t bytes_before = store.bytes_written();
+        Clock::time_point start = Clock::now();
+        op();
+        total_ns += ElapsedNs(start);
+        calls += store.calls() - calls_before;
+        bytes += store.bytes_written() - bytes_before;
+      }
+    } else {
+      uint64_t calls_before = store.calls();
+      uint64_t bytes_before = store.bytes_written();
+      Clock::time_point start = Clock::now();
+      for (uint64_t i = 0; i < batch; ++i) op();
+      total_ns += ElapsedNs(start);
+      calls += store.calls() - calls_before;
+      bytes += store.bytes_written() - bytes_before;
+    }
+    iterations += batch;
+    batch *= 2;
+  }
+  GetReporter().report(name, iterations, total_ns, calls, bytes);
+}
+
+template <typename T>
+void BenchmarkPref(const char* type_name) {
+  PreferencesStore prefs_store;
+  CountingStore store(prefs_store);
+  Collection col("bench", store);
+  std::string prefix = std::string(type_name) + "/";
+  const T a = Values<T>::a();
+  const T b = Values<T>::b();
+  {
+    Pref<T> pref(col, "key");
+    ASSERT_TRUE(pref.set(a));
+  }
+
+  Run(prefix + "get_cold", store, nullptr, [&]() {
+    Pref<T> pref(col, "key");
+    pref.get();
+  });
+
+  Pref<T> pref(col, "key");
+  pref.get();
+  Run(prefix + "get_warm", store, nullptr, [&]() {
+    volatile bool eq = (pref.get() == a);
+    (void)eq;
+  });
+
+  Run(prefix + "set_same", store, nullptr, [&]() { pref.set(a); });
+
+  bool flip = false;
+  Run(prefix + "set_changed", store, nullptr, [&]() {
+    flip = !flip;
+    pref.set(flip ? b : a);
+  });
+
+  Run(prefix + "clear", store, [&]() { pref.set(a); },
+      [&]() { pref.clear(); });
+}
+
+template <typename T>
+void BenchmarkLazyBurst(const char* type_name) {
+  constexpr int kBurstSize = 10;
+  system_time_set_auto_sync(false);
+  PreferencesStore prefs_store;
+  CountingStore store(prefs_store);
+  Collection col("bench_lazy", store);
+  roo_scheduler::Scheduler scheduler;
+  LazyWritePref<T> pref(col, scheduler, "lazy");
+  const T a = Values<T>::a();
+  const T b = Values<T>::b();
+  bool flip = false;
+  Run(std::string(type_name) + "/lazy_burst10", store, nullptr, [&]() {
+    // Each burst ends on a value different from the previously flushed one.
+    flip = !flip;
+    for (int i = 0; i < kBurstSize; ++i) {
+      pref.set(((i % 2 == 0) == flip) ? a : b);
+      scheduler.executeEligibleTasks();
+    }
+    roo_time::Delay(roo_time::Millis(2100));
+    scheduler.executeEligibleTasks();
+  });
+}
+
+template <typename T>
+void BenchmarkAll(const char* type_name) {
+  BenchmarkPref<T>(type_name);
+  BenchmarkLazyBurst<T>(type_name);
+}
+
+template <typename T>
+void ReportFootprint(const char* type_name) {
+  GetReporter().reportFootprint(std::string(type_name) + "/footprint",
+                                sizeof(Pref<T>), sizeof(LazyWritePref<T>));
+}
+
+TEST(PrefsBenchmark, Footprint) {
+  ReportFootprint<bool>("Bool");
+  ReportFootprint<uint8_t>("Uint8");
+  ReportFootprint<uint16_t>("Uint16");
+  ReportFootprint<uint32_t>("Uint32");
+  ReportFootprint<uint64_t>("Uint64");
+  ReportFootprint<float>("Float");
+  ReportFootprint<double>("Double");
+  ReportFootprint<std::string>("StdString");
+  ReportFootprint<FixedString<32>>("FixedString32");
+  ReportFootprint<Blob16>("Blob16");
+  ReportFootprint<Blob64>("Blob64");
+}
+
+TEST(PrefsBenchmark, AllTypes) {
+  BenchmarkAll<bool>("Bool");
+  BenchmarkAll<uint8_t>("Uint8");
+  BenchmarkAll<int8_t>("Int8");
+  BenchmarkAll<uint16_t>("Uint16");
+  BenchmarkAll<int16_t>("Int16");
+  BenchmarkAll<uint32_t>("Uint32");
+  BenchmarkAll<int32_t>("Int32");
+  BenchmarkAll<uint64_t>("Uint64");
+  BenchmarkAll<int64_t>("Int64");
+  BenchmarkAll<float>("Float");
+  BenchmarkAll<double>("Double");
+  BenchmarkAll<std::string>("StdString");
+  BenchmarkAll<Blob16>("Blob16");
+  BenchmarkAll<Blob64>("Blob64");
+}
+
+}  // namespace
+}  // namespace roo_prefs
@@ -4,10 +4,24 @@
 ///
 /// Provides preference collections, transactions, and typed accessors.
 
+#include "roo_prefs/blob_stream.h"
 #include "roo_prefs/collection.h"
+#include "roo_prefs/counter_pref.h"
+#include "roo_prefs/fixed_string.h"
+#include "roo_prefs/latency_stats.h"
+#include "roo_prefs/packed_group.h"
 #include "roo_prefs/pref.h"
+#include "roo_prefs/record.h"
+#include "roo_prefs/ring_log_pref.h"
+#include "roo_prefs/segmented_pref.h"
 #include "roo_prefs/status.h"
+#include "roo_prefs/store/accounting_store.h"
+#include "roo_prefs/store/compressing_store.h"
+#include "roo_prefs/store/file_store.h"
+#include "roo_prefs/store/forwarding_store.h"
+#include "roo_prefs/store/memory_store.h"
 #include "roo_prefs/store/preferences_store.h"
+#include "roo_prefs/store/store.h"
 #include "roo_prefs/transaction.h"
 
 /// Basic usage:
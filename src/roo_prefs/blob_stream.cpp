@@ -0,0 +1,303 @@
+#include "roo_prefs/blob_stream.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "roo_logging.h"
+#include "roo_prefs/impl/key_suffix.h"
+#include "roo_prefs/transaction.h"
+
+namespace roo_prefs {
+
+namespace {
+
+constexpr uint8_t kManifestVersion = 1;
+constexpr uint16_t kMaxChunks = 1000;
+constexpr size_t kChunkKeySize = 32;
+// Chunk keys add up to 5 characters (".a999").
+constexpr size_t kChunkSuffixLength =
+    1 + internal::IndexSuffixLength(kMaxChunks - 1);
+
+// Describes the committed payload. Stored in a single U64 entry, so that it
+// gets replaced atomically: the version (8 bits), the sequence number of the
+// payload (8 bits), the number of chunks (16 bits), and the size (32 bits).
+// The lowest bit of the sequence number is the generation of the chunks.
+struct Manifest {
+  uint8_t version;
+  uint8_t sequence;
+  uint16_t chunks;
+  uint32_t size;
+};
+
+uint64_t Encode(const Manifest& manifest) {
+  return ((uint64_t)kManifestVersion << 56) |
+         ((uint64_t)manifest.sequence << 48) |
+         ((uint64_t)manifest.chunks << 32) | manifest.size;
+}
+
+ReadResult ReadManifest(Store& store, const char* key, Manifest& manifest) {
+  uint64_t encoded;
+  ReadResult result = store.readU64(key, encoded);
+  if (result != ReadResult::kOk) return result;
+  manifest.version = encoded >> 56;
+  manifest.sequence = (encoded >> 48) & 0xFF;
+  manifest.chunks = (encoded >> 32) & 0xFFFF;
+  manifest.size = encoded & 0xFFFFFFFF;
+  if (manifest.version != kManifestVersion || manifest.chunks > kMaxChunks) {
+    return ReadResult::kWrongType;
+  }
+  return ReadResult::kOk;
+}
+
+void ChunkKey(const char* key, uint8_t generation, uint16_t index,
+              char* chunk_key) {
+  snprintf(chunk_key, kChunkKeySize, "%s.%c%u", key, 'a' + generation,
+           (unsigned)index);
+}
+
+// Removes the chunks of the specified generation, starting from the last
+// one, so that an interrupted removal leaves a prefix of them, which gets
+// found, and removed, by the next one.
+bool RemoveChunks(Store& store, const char* key, uint8_t generation) {
+  char chunk_key[kChunkKeySize];
+  uint16_t count = 0;
+  while (count < kMaxChunks) {
+    ChunkKey(key, generation, count, chunk_key);
+    if (!store.isKey(chunk_key)) break;
+    ++count;
+  }
+  bool ok = true;
+  while (count > 0) {
+    ChunkKey(key, generation, --count, chunk_key);
+    if (store.clear(chunk_key) != ClearResult::kOk) ok = false;
+  }
+  return ok;
+}
+
+}  // namespace
+
+BlobWriter::BlobWriter(Collection& collection, const char* key,
+                       size_t chunk_size)
+    : collection_(collection),
+      key_(key),
+      sequence_(0),
+      generation_(0),
+      ok_(true),
+      committed_(false),
+      chunks_(0),
+      size_(0),
+      buffer_(),
+      chunk_size_(chunk_size == 0 ? kDefaultChunkSize : chunk_size) {
+  if (strlen(key) + kChunkSuffixLength > kMaxKeyLength) {
+    LOG(ERROR) << "Blob key " << key << " is too long";
+    ok_ = false;
+    return;
+  }
+  Transaction t(collection_);
+  if (!t.active()) {
+    ok_ = false;
+    return;
+  }
+  Manifest manifest;
+  switch (ReadManifest(t.store(), key_, manifest)) {
+    case ReadResult::kOk: {
+      // Leaves the chunks of the committed payload intact.
+      sequence_ = manifest.sequence + 1;
+      generation_ = sequence_ & 1;
+      break;
+    }
+    case ReadResult::kError: {
+      ok_ = false;
+      return;
+    }
+    default: {
+      break;
+    }
+  }
+  // Removes the chunks left behind by a writer interrupted by a reset.
+  if (!RemoveChunks(t.store(), key_, generation_)) ok_ = false;
+}
+
+BlobWriter::~BlobWriter() {
+  if (committed_ || chunks_ == 0) return;
+  Transaction t(collection_);
+  if (t.active()) RemoveChunks(t.store(), key_, generation_);
+}
+
+bool BlobWriter::write(const void* data, size_t len) {
+  if (!ok_ || committed_) return false;
+  const uint8_t* pos = static_cast<const uint8_t*>(data);
+  while (len > 0) {
+    // Leaves room for the sequence number.
+    if (buffer_.capacity() < chunk_size_ + 1) buffer_.reserve(chunk_size_ + 1);
+    size_t n = std::min(len, chunk_size_ - buffer_.size());
+    buffer_.insert(buffer_.end(), pos, pos + n);
+    pos += n;
+    len -= n;
+    if (buffer_.size() == chunk_size_ && !writeChunk()) return false;
+  }
+  return true;
+}
+
+bool BlobWriter::commit() {
+  if (!ok_ || committed_) return false;
+  Transaction t(collection_);
+  if (!buffer_.empty() && !writeChunk()) return false;
+  buffer_.shrink_to_fit();
+  Manifest manifest{kManifestVersion, sequence_, chunks_, size_};
+  if (!t.active() ||
+      t.store().writeU64(key_, Encode(manifest)) != WriteResult::kOk) {
+    ok_ = false;
+    return false;
+  }
+  committed_ = true;
+  if (!RemoveChunks(t.store(), key_, 1 - generation_)) {
+    LOG(WARNING) << "Failed to remove the previous chunks of " << key_;
+  }
+  return true;
+}
+
+bool BlobWriter::writeChunk() {
+  size_t len = buffer_.size();
+  if (chunks_ >= kMaxChunks || size_ + len > UINT32_MAX) {
+    LOG(ERROR) << "Blob " << key_ << " is too large";
+    ok_ = false;
+    return false;
+  }
+  char chunk_key[kChunkKeySize];
+  ChunkKey(key_, generation_, chunks_, chunk_key);
+  buffer_.push_back(sequence_);
+  Transaction t(collection_);
+  if (!t.active() ||
+      t.store().writeBytes(chunk_key, buffer_.data(), buffer_.size()) !=
+          WriteResult::kOk) {
+    ok_ = false;
+    return false;
+  }
+  buffer_.clear();
+  ++chunks_;
+  size_ += len;
+  return true;
+}
+
+BlobReader::BlobReader(Collection& collection, const char* key)
+    : collection_(collection),
+      key_(key),
+      status_(ReadResult::kNotFound),
+      sequence_(0),
+      generation_(0),
+      chunks_(0),
+      next_chunk_(0),
+      chunk_len_(0),
+      size_(0),
+      position_(0),
+      buffer_(),
+      buffer_pos_(0) {
+  Transaction t(collection_, Transaction::Mode::kReadOnly);
+  if (!t.active()) return;
+  Manifest manifest;
+  status_ = ReadManifest(t.store(), key_, manifest);
+  if (status_ != ReadResult::kOk) return;
+  sequence_ = manifest.sequence;
+  generation_ = manifest.sequence & 1;
+  chunks_ = manifest.chunks;
+  size_ = manifest.size;
+}
+
+size_t BlobReader::read(void* buf, size_t len) {
+  uint8_t* out = static_cast<uint8_t*>(buf);
+  size_t total = 0;
+  while (total < len && position_ < size_ && status_ == ReadResult::kOk) {
+    if (buffer_pos_ < buffer_.size()) {
+      size_t n = std::min(len - total, buffer_.size() - buffer_pos_);
+      memcpy(out + total, &buffer_[buffer_pos_], n);
+      buffer_pos_ += n;
+      total += n;
+      position_ += n;
+      continue;
+    }
+    size_t n = readChunk(out + total, len - total);
+    total += n;
+    position_ += n;
+  }
+  if (position_ == size_) {
+    // Releases the buffer.
+    std::vector<uint8_t>().swap(buffer_);
+  }
+  return total;
+}
+
+size_t BlobReader::readChunk(void* dest, size_t capacity) {
+  if (next_chunk_ >= chunks_) {
+    status_ = ReadResult::kError;
+    return 0;
+  }
+  char chunk_key[kChunkKeySize];
+  ChunkKey(key_, generation_, next_chunk_, chunk_key);
+  Transaction t(collection_, Transaction::Mode::kReadOnly);
+  if (!t.active()) {
+    status_ = ReadResult::kError;
+    return 0;
+  }
+  // Reads into `dest`, unless the chunk, including the tag, is known not to
+  // fit, without asking for its length first (which, for compressed chunks,
+  // means reading them).
+  uint8_t* data = static_cast<uint8_t*>(dest);
+  size_t max_len = capacity;
+  if (chunk_len_ > capacity) {
+    buffer_.resize(chunk_len_);
+    data = buffer_.data();
+    max_len = chunk_len_;
+  }
+  size_t len = 0;
+  ReadResult result = t.store().readBytes(chunk_key, data, max_len, &len);
+  if (result == ReadResult::kError && len > max_len) {
+    // Stores report the actual length of values that do not fit.
+    if (len - 1 > size_ - position_) {
+      result = ReadResult::kError;
+    } else {
+      buffer_.resize(len);
+      data = buffer_.data();
+      max_len = len;
+      result = t.store().readBytes(chunk_key, data, max_len, &len);
+    }
+  }
+  // Missing chunks, or chunks of a different payload, mean that the payload
+  // has been replaced.
+  if (result == ReadResult::kOk &&
+      (len < 1 || len - 1 > size_ - position_ ||
+       data[len - 1] != sequence_)) {
+    result = ReadResult::kError;
+  }
+  if (result != ReadResult::kOk) {
+    status_ = (result == ReadResult::kWrongType) ? result : ReadResult::kError;
+    buffer_.clear();
+    return 0;
+  }
+  ++next_chunk_;
+  chunk_len_ = len;
+  // Drops the sequence number.
+  --len;
+  if (data == dest) return len;
+  buffer_.resize(len);
+  buffer_pos_ = 0;
+  return 0;
+}
+
+bool ClearBlob(Collection& collection, const char* key) {
+  Transaction t(collection);
+  if (!t.active()) return false;
+  // Removes the manifest first, so that the chunks are never visible when
+  // incomplete.
+  if (t.store().isKey(key) && t.store().clear(key) != ClearResult::kOk) {
+    return false;
+  }
+  bool ok = true;
+  if (!RemoveChunks(t.store(), key, 0)) ok = false;
+  if (!RemoveChunks(t.store(), key, 1)) ok = false;
+  return ok;
+}
+
+}  // namespace roo_prefs
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "roo_prefs/collection.h"
+#include "roo_prefs/status.h"
+
+namespace roo_prefs {
+
+/// Writes a large payload (e.g. a certificate, a lookup table, or model
+/// parameters) to the collection incrementally, as a sequence of chunks,
+/// using a buffer of a single chunk. The chunks are stored under keys derived
+/// from `key`: "<key>.a0", "<key>.a1", etc. A manifest, stored under `key`
+/// itself, is written by `commit()`, after all the chunks. Until then,
+/// readers see the previous payload (if any). Chunks of the previous payload
+/// are removed after the commit. Each chunk ends with a byte of the payload's
+/// sequence number, which is also stored in the manifest, and is incremented
+/// by each commit, so that readers can tell chunks of different payloads
+/// apart.
+///
+/// @code
+/// roo_prefs::BlobWriter writer(col, "cert");
+/// while (...) {
+///   if (!writer.write(buf, len)) return false;
+/// }
+/// return writer.commit();
+/// @endcode
+///
+/// Each chunk is written in its own transaction; keep one open around the
+/// writer (or use `Collection::setKeepOpen()`) to avoid reopening the
+/// namespace for each chunk. Only one writer of a key may be active at a
+/// time. The derived keys must fit in 15 characters (`kMaxKeyLength`), as
+/// required by the ESP32 NVS, so `key` can have up to 10; a writer with a
+/// longer key fails. A payload can have up to 1000 chunks.
+class BlobWriter {
+ public:
+  static constexpr size_t kDefaultChunkSize = 1024;
+
+  BlobWriter(Collection& collection, const char* key,
+             size_t chunk_size = kDefaultChunkSize);
+
+  BlobWriter(const BlobWriter&) = delete;
+  BlobWriter& operator=(const BlobWriter&) = delete;
+
+  /// If not committed, removes the chunks written so far.
+  ~BlobWriter();
+
+  /// Appends the data, writing out the chunks that fill up. Returns false if
+  /// writing has failed (now or before).
+  bool write(const void* data, size_t len);
+
+  /// Writes the last chunk, and the manifest, making the payload visible to
+  /// readers. Returns false if writing has failed. The writer can't be used
+  /// after the commit.
+  bool commit();
+
+  /// Returns the number of bytes written so far.
+  size_t size() const { return size_; }
+
+  bool ok() const { return ok_; }
+
+ private:
+  // Writes the buffered data as the next chunk.
+  bool writeChunk();
+
+  Collection& collection_;
+  const char* key_;
+  // Sequence number of the payload being written.
+  uint8_t sequence_;
+  // Generation (0 or 1) of the chunks being written.
+  uint8_t generation_;
+  bool ok_;
+  bool committed_;
+  uint16_t chunks_;
+  uint32_t size_;
+  std::vector<uint8_t> buffer_;
+  size_t chunk_size_;
+};
+
+/// Reads a payload written by `BlobWriter` incrementally, one chunk at a
+/// time, into caller-provided buffers.
+///
+/// @code
+/// roo_prefs::BlobReader reader(col, "cert");
+/// if (reader.status() != roo_prefs::ReadResult::kOk) return false;
+/// uint8_t buf[256];
+/// while (size_t len = reader.read(buf, sizeof(buf))) {
+///   Consume(buf, len);
+/// }
+/// return reader.status() == roo_prefs::ReadResult::kOk;
+/// @endcode
+///
+/// Each chunk is read in its own transaction. If the payload gets replaced
+/// while being read, the reader fails with `ReadResult::kError`.
+class BlobReader {
+ public:
+  /// Reads the manifest.
+  BlobReader(Collection& collection, const char* key);
+
+  BlobReader(const BlobReader&) = delete;
+  BlobReader& operator=(const BlobReader&) = delete;
+
+  /// Returns `ReadResult::kNotFound` if there is no payload, and
+  /// `ReadResult::kError` (or `ReadResult::kWrongType`) if a read has
+  /// failed.
+  ReadResult status() const { return status_; }
+
+  /// Returns the total size of the payload.
+  size_t size() const { return size_; }
+
+  /// Returns the number of bytes not read yet.
+  size_t remaining() const { return size_ - position_; }
+
+  /// Reads up to `len` next bytes into `buf`. Returns the number of bytes
+  /// read, which is less than `len` only at the end of the payload, or on
+  /// error.
+  size_t read(void* buf, size_t len);
+
+ private:
+  // Reads the next chunk, into `dest` if it fits, or into the buffer.
+  // Returns the number of bytes read into `dest`.
+  size_t readChunk(void* dest, size_t capacity);
+
+  Collection& collection_;
+  const char* key_;
+  ReadResult status_;
+  uint8_t sequence_;
+  uint8_t generation_;
+  uint16_t chunks_;
+  uint16_t next_chunk_;
+  // Stored length of the last chunk read. All chunks but the last one have
+  // the same length.
+  size_t chunk_len_;
+  uint32_t size_;
+  uint32_t position_;
+  std::vector<uint8_t> buffer_;
+  // Position of the unread data in `buffer_`.
+  size_t buffer_pos_;
+};
+
+/// Removes the payload written by `BlobWriter`, along with its chunks.
+bool ClearBlob(Collection& collection, const char* key);
+
+}  // namespace roo_prefs
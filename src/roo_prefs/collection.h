@@ -1,57 +1,522 @@
 #pragma once
 
+#include <inttypes.h>
+#include <string.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+
 #include "roo_logging.h"
+#include "roo_prefs/impl/read_backoff.h"
+#include "roo_prefs/impl/sync.h"
+#include "roo_prefs/impl/write_batch.h"
+#include "roo_prefs/latency_stats.h"
 #include "roo_prefs/store/preferences_store.h"
+#include "roo_prefs/store/store.h"
 
 namespace roo_prefs {
 
+class Collection;
+
 class Transaction;
 
-using Store = PreferencesStore;
+template <typename T>
+class Pref;
+
+template <typename T>
+class LazyWritePref;
+
+class LazyWriteCoordinator;
+
+class KeepAlive;
+
+class PackedGroup;
+
+template <typename T>
+class Record;
+
+template <typename T>
+class CounterPref;
+
+template <typename T, size_t N>
+class RingLogPref;
+
+template <typename T, size_t S>
+class SegmentedPref;
+
+namespace internal {
+
+/// Notified when the last transaction of a collection, whose store is kept
+/// open, ends.
+class IdleListener {
+ public:
+  virtual ~IdleListener() = default;
+  virtual void onIdle() = 0;
+};
+
+/// Intrusive list node, through which a preference registers itself with its
+/// collection, so that `Collection::preloadAll()` can find it.
+///
+/// Costs two pointers per preference (the list link, and the vtable pointer;
+/// the vtable itself is shared by all preferences of a type), i.e. 8 bytes on
+/// ESP32. That is small next to the key, the cached value and the state that
+/// every preference keeps anyway, and cheaper than an opt-in registry, which
+/// would need a separate, allocated list.
+///
+/// Registration happens in the constructor of the preference, which must
+/// therefore run after the constructor of its collection. For preferences
+/// with static storage duration, define the collection in the same
+/// translation unit, before its preferences (or return it from a function,
+/// as a function-local static); the initialization order of globals across
+/// translation units is unspecified.
+class PrefNode {
+ public:
+  explicit PrefNode(const char* key) : key_(key), next_(nullptr) {}
+
+  PrefNode(const PrefNode&) = delete;
+  PrefNode& operator=(const PrefNode&) = delete;
+
+ protected:
+  virtual ~PrefNode() = default;
+
+  /// Reads the value from the store, unless it is already cached. The
+  /// `store` is null if the namespace could not be opened. Returns false if
+  /// the read failed.
+  virtual bool preload(Store* store) = 0;
+
+  /// Forgets the cached value, which may no longer match the store, so that
+  /// it gets read again on next access.
+  virtual void invalidate() = 0;
+
+  const char* key_;
+
+ private:
+  friend class roo_prefs::Collection;
+
+  PrefNode* next_;
+};
+
+}  // namespace internal
+
+/// Outcome of `Collection::preloadAll()`.
+struct PreloadResult {
+  /// Number of preferences registered with the collection.
+  size_t count;
+
+  /// Number of preferences whose values could not be read.
+  size_t failed;
+
+  /// Total time taken, in microseconds.
+  uint32_t elapsed_us;
+};
+
+/// Determines what preferences do after failing to read their value from the
+/// store, e.g. because the key holds a value of an incompatible type, or
+/// because of a storage error.
+struct ErrorPolicy {
+  /// After a failed read, the number of subsequent accesses (`get()`,
+  /// `isSet()`, etc.) of the preference that return the cached value without
+  /// retrying the read. Doubles after each failed retry, up to `max_backoff`.
+  /// Zero means retrying on every access. A successful `set()` or `clear()`
+  /// ends the backoff; they do not count as accesses. Applies to all kinds
+  /// of preferences.
+  uint16_t initial_backoff;
+
+  uint16_t max_backoff;
+
+  /// If true, a preference that failed to read returns its default value.
+  /// Otherwise, the cached value is left as-is, which may be a previous
+  /// value, or the result of a partial read.
+  bool fallback_to_default;
+
+  /// Retries on every access, and keeps the cached value.
+  static ErrorPolicy RetryAlways() { return ErrorPolicy{0, 0, false}; }
+
+  /// Backs off exponentially from 1 to 1024 accesses, and falls back to the
+  /// default value.
+  static ErrorPolicy Backoff() { return ErrorPolicy{1, 1024, true}; }
+};
 
 /// Collection corresponds to a preferences namespace. Use it to group related
 /// preferences.
+///
+/// If the library is built with `ROO_PREFS_THREAD_SAFE` set to 1, the
+/// collection and its preferences can be used from multiple threads (or
+/// FreeRTOS tasks). Each transaction then holds the collection lock for its
+/// whole lifetime, so transactions from different threads are serialized,
+/// and store access never overlaps. Reads of already cached values do not
+/// take the lock; see `Pref::load()`.
 class Collection {
  public:
+  /// Creates a collection backed by Arduino `Preferences`.
   Collection(const char* name)
-      : store_(), name_(name), refcount_(0), read_only_(true) {}
+      : mutex_(),
+        default_store_(),
+        store_(default_store_),
+        name_(name),
+        refcount_(0),
+        open_(false),
+        read_only_(true),
+        keep_open_(false),
+        batching_(false),
+        atomic_(false),
+        journal_checked_(false),
+        batch_(),
+        idle_listener_(nullptr),
+        error_policy_(ErrorPolicy::RetryAlways()),
+        suppressed_retries_(0),
+        prefs_(nullptr) {}
+
+  /// Creates a collection backed by the specified store (e.g. `MemoryStore`
+  /// or `FileStore`). The store must outlive the collection, and must not be
+  /// shared with other collections.
+  Collection(const char* name, Store& store)
+      : mutex_(),
+        default_store_(),
+        store_(store),
+        name_(name),
+        refcount_(0),
+        open_(false),
+        read_only_(true),
+        keep_open_(false),
+        batching_(false),
+        atomic_(false),
+        journal_checked_(false),
+        batch_(),
+        idle_listener_(nullptr),
+        error_policy_(ErrorPolicy::RetryAlways()),
+        suppressed_retries_(0),
+        prefs_(nullptr) {}
+
+  Collection(const Collection&) = delete;
+  Collection& operator=(const Collection&) = delete;
+
+  ~Collection() {
+    if (open_) store_.end();
+  }
+
+  bool inTransaction() const {
+    return refcount_.load(std::memory_order_relaxed) > 0;
+  }
+
+  /// Enables the key metadata index of the default `Preferences`-backed store.
+  /// See `PreferencesStore::setKeyIndexEnabled()`. Has no effect on
+  /// collections constructed with a custom store.
+  void setKeyIndexEnabled(bool enabled) {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    if (&store_ == &default_store_) default_store_.setKeyIndexEnabled(enabled);
+  }
 
-  bool inTransaction() const { return refcount_ > 0; }
+  /// Reads the values of all preferences of this collection that have not
+  /// been read yet, within a single transaction, in the order of their keys.
+  /// Use it at boot, to avoid opening the namespace separately for each
+  /// preference on its first access. Failures are logged, and reported in
+  /// the result.
+  PreloadResult preloadAll() {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    PreloadResult result{0, 0, 0};
+    bool active = inc(true);
+    Store* store = active ? &store_ : nullptr;
+    for (internal::PrefNode* node = prefs_; node != nullptr;
+         node = node->next_) {
+      ++result.count;
+      if (!node->preload(store)) {
+        LOG(WARNING) << "Failed to preload " << name_ << "/" << node->key_;
+        ++result.failed;
+      }
+    }
+    if (active) dec();
+    result.elapsed_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+    return result;
+  }
+
+  /// Sets the policy for preferences of this collection that failed to read
+  /// their values. Defaults to `ErrorPolicy::RetryAlways()`.
+  void setErrorPolicy(const ErrorPolicy& policy) {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    error_policy_ = policy;
+  }
+
+  /// Returns the number of reads of preferences in the error state that were
+  /// skipped because of the error policy backoff.
+  uint32_t suppressedRetries() const {
+    return suppressed_retries_.load(std::memory_order_relaxed);
+  }
+
+  /// If true, the store is not closed when the last transaction ends, so
+  /// that subsequent reads and writes do not need to reopen it. The store
+  /// stays open until `close()` is called, or keep-open is turned off. See
+  /// also `KeepAlive`, which closes the store after an idle period.
+  void setKeepOpen(bool keep_open) {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    keep_open_ = keep_open;
+    if (!keep_open && open_ && !inTransaction()) closeStore();
+  }
+
+  /// Returns true if the underlying store is currently open.
+  bool isOpen() const {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    return open_;
+  }
+
+  /// Closes the store kept open after the last transaction. Returns false
+  /// (leaving the store open) if a transaction is in progress.
+  bool close() {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    if (inTransaction()) return false;
+    if (open_) closeStore();
+    return true;
+  }
 
  private:
   friend class Transaction;
 
+  template <typename T>
+  friend class Pref;
+
+  template <typename T>
+  friend class LazyWritePref;
+
+  friend class LazyWriteCoordinator;
+
+  friend class KeepAlive;
+
+  friend class PackedGroup;
+
+  template <typename T>
+  friend class Record;
+
+  template <typename T>
+  friend class CounterPref;
+
+  template <typename T, size_t N>
+  friend class RingLogPref;
+
+  template <typename T, size_t S>
+  friend class SegmentedPref;
+
+  // True if writes through `Pref` objects should be queued rather than
+  // applied immediately. Set by a batched transaction, and stays set until
+  // the outermost transaction ends.
+  bool batching() const { return batching_; }
+
+  // Starts queueing writes. If `atomic` is true, the batch is applied
+  // atomically, even if it has been started by a non-atomic transaction.
+  void startBatch(bool atomic) {
+    batching_ = true;
+    if (atomic) atomic_ = true;
+  }
+
+  void enqueue(std::unique_ptr<internal::BatchedOp> op) {
+    batch_.put(std::move(op));
+  }
+
+  void cancelPending(const char* key) { batch_.cancel(key); }
+
+  // Applies pending batched operations. Returns true if all succeeded.
+  bool applyBatch() { return applyWrites(batch_, atomic_); }
+
+  // Applies the operations of the specified batch, which need not be the
+  // collection's own. Must be called within a transaction. Returns true if
+  // all succeeded.
+  bool applyWrites(internal::WriteBatch& batch, bool atomic) {
+    if (batch.empty()) return true;
+    if (!batch.apply(store_, atomic)) {
+      LOG(ERROR) << "Failed to apply some of the batched writes to "
+                 << name_;
+      // The journal, if written, completes the batch on the next access.
+      if (atomic) journal_checked_ = false;
+      return false;
+    }
+    return true;
+  }
+
   bool inc(bool read_only) {
-    if (refcount_ == 0) {
-      if (!store_.begin(name_, read_only)) {
-        if (read_only) {
-          LOG(WARNING) << "Failed to initialize preferences " << name_
-                       << " for reading";
-        } else {
-          LOG(ERROR) << "Failed to initialize preferences " << name_
-                     << " for writing";
-        }
-        return false;
+    if (!open_) {
+      if (!openStore(read_only)) return false;
+    } else if (read_only_ && !read_only) {
+      if (!promote()) return false;
+    }
+    if (!journal_checked_ && !recover()) return false;
+    refcount_.store(refcount_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    return true;
+  }
+
+  void dec() {
+    int refcount = refcount_.load(std::memory_order_relaxed);
+    if (refcount == 1) {
+      // Note: applied while the store is still open.
+      applyBatch();
+      batching_ = false;
+      atomic_ = false;
+    }
+    refcount_.store(refcount - 1, std::memory_order_relaxed);
+    if (refcount > 1) return;
+    if (!keep_open_) {
+      closeStore();
+      return;
+    }
+    store_.flush();
+    if (idle_listener_ != nullptr) idle_listener_->onIdle();
+  }
+
+  bool openStore(bool read_only) {
+    ROO_PREFS_MEASURE_LATENCY(LatencyOp::kOpen);
+    if (!store_.begin(name_, read_only)) {
+      if (read_only) {
+        LOG(WARNING) << "Failed to initialize preferences " << name_
+                     << " for reading";
+      } else {
+        LOG(ERROR) << "Failed to initialize preferences " << name_
+                   << " for writing";
       }
-      read_only_ = read_only;
-      ++refcount_;
+      return false;
+    }
+    open_ = true;
+    read_only_ = read_only;
+    return true;
+  }
+
+  // Completes the atomic batch interrupted by a reset (or failed), if any,
+  // before anything else reads or writes the store. The journal is looked up
+  // once, when the store is first opened, and again after failures. Returns
+  // false if the store is no longer open.
+  bool recover() {
+    if (!store_.isKey(internal::kJournalKey)) {
+      journal_checked_ = true;
       return true;
     }
-    if (read_only_ && !read_only) return false;
-    ++refcount_;
+    if (read_only_ && !promote()) {
+      LOG(WARNING) << "Failed to open preferences " << name_
+                   << " for recovery of interrupted writes";
+      return open_ || openStore(true);
+    }
+    switch (internal::ReplayJournal(store_, internal::kJournalKey,
+                                    &WriteObject)) {
+      case internal::ReplayResult::kOk: {
+        journal_checked_ = true;
+        break;
+      }
+      case internal::ReplayResult::kIncomplete: {
+        LOG(ERROR) << "Failed to recover some interrupted writes to "
+                   << name_;
+        // The journal is gone, so that it does not overwrite newer values
+        // when replayed again. The preferences re-read what got stored.
+        journal_checked_ = true;
+        for (internal::PrefNode* node = prefs_; node != nullptr;
+             node = node->next_) {
+          node->invalidate();
+        }
+        break;
+      }
+      default: {
+        LOG(ERROR) << "Failed to recover interrupted writes to " << name_;
+        break;
+      }
+    }
     return true;
   }
 
-  void dec() {
-    if (--refcount_ == 0) {
-      store_.end();
+  // Lets `ReplayJournal()` write journaled objects.
+  static WriteResult WriteObject(Store& store, const char* key,
+                                 const void* val, size_t size) {
+    return store.writeObjectInternal(key, val, size);
+  }
+
+  // Reopens the store, currently open read-only, for writing.
+  bool promote() {
+    closeStore();
+    if (openStore(false)) return true;
+    // Restore the read-only access for transactions in progress.
+    if (inTransaction()) openStore(true);
+    return false;
+  }
+
+  void closeStore() {
+    ROO_PREFS_MEASURE_LATENCY(LatencyOp::kClose);
+    store_.end();
+    open_ = false;
+  }
+
+  const ErrorPolicy& errorPolicy() const { return error_policy_; }
+
+  // Returns true, and counts the suppressed retry, if the read of a
+  // preference in the error state is to be skipped because of the backoff.
+  bool skipRead(internal::ReadBackoff& backoff) {
+    if (!backoff.skip()) return false;
+    suppressed_retries_.store(
+        suppressed_retries_.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    return true;
+  }
+
+  // Starts, or extends, the backoff of a preference after a failed read.
+  void onReadError(internal::ReadBackoff& backoff) {
+    backoff.fail(error_policy_.initial_backoff, error_policy_.max_backoff);
+  }
+
+  // Adds the preference to the list, keeping it sorted by key.
+  void registerPref(internal::PrefNode& node) {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    internal::PrefNode** pos = &prefs_;
+    while (*pos != nullptr && strcmp((*pos)->key_, node.key_) < 0) {
+      pos = &(*pos)->next_;
     }
+    node.next_ = *pos;
+    *pos = &node;
+  }
+
+  void unregisterPref(internal::PrefNode& node) {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    for (internal::PrefNode** pos = &prefs_; *pos != nullptr;
+         pos = &(*pos)->next_) {
+      if (*pos == &node) {
+        *pos = node.next_;
+        node.next_ = nullptr;
+        return;
+      }
+    }
+  }
+
+  void setIdleListener(internal::IdleListener* listener) {
+    std::lock_guard<internal::Mutex> lock(mutex_);
+    idle_listener_ = listener;
   }
 
-  Store store_;
+  // Held by transactions, and by preferences while they access the cache
+  // under modification. All other fields below are guarded by it.
+  mutable internal::Mutex mutex_;
+  // Used by collections backed by Arduino `Preferences`. Unused otherwise,
+  // but small: the `Preferences` handle, and a pointer to the key index,
+  // which is only allocated if enabled.
+  PreferencesStore default_store_;
+  Store& store_;
   const char* name_;
-  int refcount_;
+  // Atomic, so that `inTransaction()` can be called from any thread.
+  internal::Atomic<int> refcount_;
+  // True if the store is open; either within a transaction, or kept open
+  // after the last one ended.
+  bool open_;
   bool read_only_;
+  bool keep_open_;
+  bool batching_;
+  // True if the pending batch is to be applied atomically.
+  bool atomic_;
+  // False until the store has been checked for an interrupted atomic batch.
+  bool journal_checked_;
+  internal::WriteBatch batch_;
+  internal::IdleListener* idle_listener_;
+  ErrorPolicy error_policy_;
+  internal::Atomic<uint32_t> suppressed_retries_;
+  // Registered preferences, sorted by key.
+  internal::PrefNode* prefs_;
 };
 
 }  // namespace roo_prefs
\ No newline at end of file
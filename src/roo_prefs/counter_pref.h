@@ -0,0 +1,117 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <mutex>
+#include <type_traits>
+
+#include "roo_prefs/collection.h"
+#include "roo_prefs/pref.h"
+
+namespace roo_prefs {
+
+/// Persistent counter (e.g. of uptime, cycles, or energy), for events too
+/// frequent to write each of them to flash. Increments are accumulated in
+/// memory, and folded into the stored value (compacted) with a single write
+/// once `flush_every` of them have been counted, or when `flush()` is called.
+/// This cuts the flash writes, and thus erase cycles, per counted event by a
+/// factor of `flush_every`, at the cost of losing at most `flush_every - 1`
+/// most recent events on an unexpected reset.
+///
+/// @code
+/// roo_prefs::Collection col("stats");
+/// roo_prefs::Counter64 cycles(col, "cycles", 64);
+///
+/// void OnCycle() { cycles.add(1); }
+///
+/// void BeforeSleep() { cycles.flush(); }
+/// @endcode
+///
+/// Pending increments are not written when the counter is destroyed; call
+/// `flush()` before a planned restart or deep sleep. Inside a
+/// `Transaction::Mode::kBatched` transaction, compaction is deferred until the
+/// next `add()` or `flush()` after the batch.
+template <typename T>
+class CounterPref {
+ public:
+  static_assert(std::is_integral<T>::value && std::is_unsigned<T>::value,
+                "Counters must be unsigned integers");
+
+  CounterPref(Collection& collection, const char* key,
+              uint16_t flush_every = 16, T initial_value = 0)
+      : collection_(collection),
+        pref_(collection, key, initial_value),
+        flush_every_(flush_every == 0 ? 1 : flush_every),
+        pending_events_(0),
+        pending_(0) {}
+
+  CounterPref(const CounterPref&) = delete;
+  CounterPref& operator=(const CounterPref&) = delete;
+
+  /// Returns true if the counter has been stored, or has pending increments.
+  bool isSet() const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    return pending_events_ > 0 || pref_.isSet();
+  }
+
+  /// Returns the current value, including pending increments.
+  T get() const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    return pref_.get() + pending_;
+  }
+
+  /// Returns the number of increments not yet written to the store.
+  uint16_t pendingEvents() const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    return pending_events_;
+  }
+
+  /// Counts an event. Writes the counter once `flush_every` events are
+  /// pending. Returns false if that write failed, in which case the
+  /// increments stay pending, and the write is retried by the next `add()`.
+  bool add(T delta = 1) {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    pending_ += delta;
+    if (pending_events_ < UINT16_MAX) ++pending_events_;
+    if (pending_events_ < flush_every_) return true;
+    return compact();
+  }
+
+  /// Writes the pending increments, if any. Returns false on failure.
+  bool flush() {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    return compact();
+  }
+
+  /// Drops the pending increments, and removes the counter from the store,
+  /// resetting it to its initial value.
+  bool clear() {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    pending_ = 0;
+    pending_events_ = 0;
+    return pref_.clear();
+  }
+
+ private:
+  bool compact() {
+    if (pending_events_ == 0) return true;
+    // A queued write would not update the cached value until the batch is
+    // applied, so subsequent compactions would overwrite it.
+    if (collection_.batching()) return true;
+    if (!pref_.set(static_cast<T>(pref_.get() + pending_))) return false;
+    pending_ = 0;
+    pending_events_ = 0;
+    return true;
+  }
+
+  Collection& collection_;
+  Pref<T> pref_;
+  uint16_t flush_every_;
+  uint16_t pending_events_;
+  T pending_;
+};
+
+using Counter32 = CounterPref<uint32_t>;
+using Counter64 = CounterPref<uint64_t>;
+
+}  // namespace roo_prefs
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include "roo_backport.h"
+#include "roo_backport/string_view.h"
+#include "roo_prefs/status.h"
+
+namespace roo_prefs {
+
+class Store;
+
+template <size_t N>
+class FixedString;
+
+template <size_t N>
+ReadResult StoreRead(Store& store, const char* key, FixedString<N>& val);
+
+/// String of up to `N` characters, stored inline (without heap allocation).
+/// Use it with `Pref` (see `FixedStringPref`) for short settings, such as
+/// hostnames or SSIDs, to keep the memory use deterministic.
+///
+/// Values longer than `N` characters are truncated.
+template <size_t N>
+class FixedString {
+ public:
+  static_assert(N > 0 && N < 65536, "Capacity must be in [1, 65535]");
+
+  FixedString() : size_(0) { data_[0] = '\0'; }
+
+  FixedString(const char* value) : FixedString() {
+    if (value != nullptr) assign(value);
+  }
+
+  FixedString(roo::string_view value) : FixedString() { assign(value); }
+
+  /// Replaces the contents. Returns false if the value had to be truncated.
+  bool assign(roo::string_view value) {
+    roo::string_view truncated = Truncate(value);
+    memcpy(data_, truncated.data(), truncated.size());
+    size_ = truncated.size();
+    data_[size_] = '\0';
+    return truncated.size() == value.size();
+  }
+
+  void clear() {
+    size_ = 0;
+    data_[0] = '\0';
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+  size_t size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  const char* c_str() const { return data_; }
+
+  const char* data() const { return data_; }
+
+  roo::string_view view() const { return roo::string_view(data_, size_); }
+
+  /// Returns the prefix of `value` that fits in the capacity.
+  static roo::string_view Truncate(roo::string_view value) {
+    return value.size() <= N ? value : roo::string_view(value.data(), N);
+  }
+
+  friend bool operator==(const FixedString& a, const FixedString& b) {
+    return a.size_ == b.size_ && memcmp(a.data_, b.data_, a.size_) == 0;
+  }
+
+  friend bool operator!=(const FixedString& a, const FixedString& b) {
+    return !(a == b);
+  }
+
+ private:
+  template <size_t M>
+  friend ReadResult StoreRead(Store& store, const char* key,
+                              FixedString<M>& val);
+
+  typename std::conditional<(N < 256), uint8_t, uint16_t>::type size_;
+  char data_[N + 1];
+};
+
+}  // namespace roo_prefs
@@ -0,0 +1,305 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "roo_prefs/fixed_string.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+namespace roo_prefs {
+
+namespace internal {
+
+template <typename T, bool inline_value>
+class DefaultValue;
+
+template <typename T>
+struct IsCompact;
+
+}  // namespace internal
+
+/// Default value of a preference, referring to an object with static storage
+/// duration (e.g. a constant), rather than to a copy of it. See
+/// `StaticDefault`.
+template <typename T>
+class DefaultRef {
+ private:
+  explicit DefaultRef(const T* value) : value_(value) {}
+
+  template <typename V>
+  friend DefaultRef<V> StaticDefault(const V& value);
+
+  friend class internal::DefaultValue<T,
+                                      internal::IsCompact<T>::value>;
+
+  const T* value_;
+};
+
+/// Default value of a string preference, referring to a character string with
+/// static storage duration (e.g. a string literal), rather than to a copy of
+/// it. See `StaticDefault`.
+class DefaultLiteral {
+ private:
+  explicit DefaultLiteral(const char* value) : value_(value) {}
+
+  template <size_t N>
+  friend DefaultLiteral StaticDefault(const char (&value)[N]);
+
+  template <typename T, bool inline_value>
+  friend class internal::DefaultValue;
+
+  const char* value_;
+};
+
+/// Default value of a preference, computed on demand. See `GeneratedDefault`.
+template <typename T>
+class DefaultGenerator {
+ private:
+  explicit DefaultGenerator(T (*generator)()) : generator_(generator) {}
+
+  template <typename V>
+  friend DefaultGenerator<V> GeneratedDefault(V (*generator)());
+
+  friend class internal::DefaultValue<T,
+                                      internal::IsCompact<T>::value>;
+
+  T (*generator_)();
+};
+
+/// Makes a preference use the specified object as its default value, without
+/// copying it. The object must outlive the preference.
+///
+/// @code
+/// static const Config kDefaultConfig = {...};
+/// roo_prefs::Pref<Config> config(col, "config",
+///                                roo_prefs::StaticDefault(kDefaultConfig));
+/// @endcode
+template <typename T>
+DefaultRef<T> StaticDefault(const T& value) {
+  return DefaultRef<T>(&value);
+}
+
+/// Makes a string preference use the specified character string as its
+/// default value, without copying it. Meant for string literals; the string
+/// must outlive the preference.
+///
+/// @code
+/// roo_prefs::String label(col, "label", roo_prefs::StaticDefault("Room"));
+/// @endcode
+template <size_t N>
+DefaultLiteral StaticDefault(const char (&value)[N]) {
+  return DefaultLiteral(value);
+}
+
+/// Makes a preference call the specified function whenever it needs its
+/// default value.
+template <typename T>
+DefaultGenerator<T> GeneratedDefault(T (*generator)()) {
+  return DefaultGenerator<T>(generator);
+}
+
+namespace internal {
+
+// Types whose default can be given as a character string.
+template <typename T>
+struct IsStringLike : std::false_type {};
+
+template <>
+struct IsStringLike<std::string> : std::true_type {};
+
+template <size_t N>
+struct IsStringLike<FixedString<N>> : std::true_type {};
+
+#ifdef ARDUINO
+template <>
+struct IsStringLike<::String> : std::true_type {};
+#endif
+
+// Small trivially copyable types (e.g. scalars), which are kept inline where
+// other types are kept behind a pointer, as the pointer would not be any
+// smaller.
+template <typename T>
+struct IsCompact
+    : std::integral_constant<bool, std::is_trivially_copyable<T>::value &&
+                                       sizeof(T) <= 2 * sizeof(void*) &&
+                                       !IsStringLike<T>::value> {};
+
+// Holds the default value of `Pref<T>`, in as little memory as possible. Small
+// trivially copyable values are stored inline, in the specialization below.
+// Otherwise, defaults passed by value (including character strings, for
+// string types) are stored inline too, while static objects
+// (`StaticDefault`), generator functions (`GeneratedDefault`) and static
+// character strings are referred to by pointers, which share the storage of
+// the inline value. The value-initialized default, `T()`, is constructed on
+// demand.
+template <typename T, bool inline_value = IsCompact<T>::value>
+class DefaultValue {
+ public:
+  DefaultValue() : kind_(Kind::kValueInitialized) { data_.ptr = nullptr; }
+
+  DefaultValue(const T& value) : kind_(Kind::kInline) {
+    new (&data_.value) T(value);
+  }
+
+  DefaultValue(T&& value) : kind_(Kind::kInline) {
+    new (&data_.value) T(std::move(value));
+  }
+
+  DefaultValue(DefaultRef<T> ref) : kind_(Kind::kStatic) {
+    data_.ptr = ref.value_;
+  }
+
+  DefaultValue(DefaultGenerator<T> generator) : kind_(Kind::kGenerator) {
+    data_.generator = generator.generator_;
+  }
+
+  // String types only: copies the character string.
+  template <typename S = T, typename = typename std::enable_if<
+                                IsStringLike<S>::value>::type>
+  DefaultValue(const char* value)
+      : kind_(value == nullptr ? Kind::kValueInitialized : Kind::kInline) {
+    if (value == nullptr) {
+      data_.ptr = nullptr;
+    } else {
+      new (&data_.value) T(value);
+    }
+  }
+
+  // String types only: refers to the character string, which must outlive
+  // the preference, instead of copying it.
+  template <typename S = T, typename = typename std::enable_if<
+                                IsStringLike<S>::value>::type>
+  DefaultValue(DefaultLiteral literal) : kind_(Kind::kCString) {
+    data_.str = literal.value_;
+  }
+
+  DefaultValue(DefaultValue&& other) : kind_(other.kind_) {
+    switch (kind_) {
+      case Kind::kInline: {
+        new (&data_.value) T(std::move(other.data_.value));
+        break;
+      }
+      case Kind::kGenerator: {
+        data_.generator = other.data_.generator;
+        break;
+      }
+      case Kind::kCString: {
+        data_.str = other.data_.str;
+        break;
+      }
+      default: {
+        data_.ptr = other.data_.ptr;
+        break;
+      }
+    }
+  }
+
+  DefaultValue(const DefaultValue&) = delete;
+  DefaultValue& operator=(const DefaultValue&) = delete;
+
+  ~DefaultValue() {
+    if (kind_ == Kind::kInline) data_.value.~T();
+  }
+
+  T value() const {
+    switch (kind_) {
+      case Kind::kValueInitialized:
+        return T();
+      case Kind::kInline:
+        return data_.value;
+      case Kind::kGenerator:
+        return data_.generator();
+      case Kind::kCString:
+        return FromCString(data_.str, IsStringLike<T>());
+      default:
+        return *data_.ptr;
+    }
+  }
+
+  // Sets the holder to the default value, avoiding temporary copies.
+  template <typename Holder>
+  void assignTo(Holder& holder) const {
+    switch (kind_) {
+      case Kind::kInline: {
+        holder.set(data_.value);
+        return;
+      }
+      case Kind::kStatic: {
+        holder.set(*data_.ptr);
+        return;
+      }
+      case Kind::kCString: {
+        holder.set(FromCString(data_.str, IsStringLike<T>()));
+        return;
+      }
+      default: {
+        holder.set(value());
+        return;
+      }
+    }
+  }
+
+ private:
+  enum class Kind : uint8_t {
+    kValueInitialized,
+    kInline,
+    kStatic,
+    kGenerator,
+    kCString
+  };
+
+  // Lets string holders assign straight from the character string.
+  static const char* FromCString(const char* value, std::true_type) {
+    return value;
+  }
+
+  static T FromCString(const char*, std::false_type) { return T(); }
+
+  // The active member is determined by `kind_`.
+  union Data {
+    Data() {}
+    ~Data() {}
+
+    T value;
+    const T* ptr;
+    T (*generator)();
+    const char* str;
+  };
+
+  Kind kind_;
+  Data data_;
+};
+
+template <typename T>
+class DefaultValue<T, true> {
+ public:
+  DefaultValue() : value_() {}
+
+  DefaultValue(const T& value) : value_(value) {}
+
+  DefaultValue(DefaultRef<T> ref) : value_(*ref.value_) {}
+
+  DefaultValue(DefaultGenerator<T> generator)
+      : value_(generator.generator_()) {}
+
+  const T& value() const { return value_; }
+
+  template <typename Holder>
+  void assignTo(Holder& holder) const {
+    holder.set(value_);
+  }
+
+ private:
+  T value_;
+};
+
+}  // namespace internal
+
+}  // namespace roo_prefs
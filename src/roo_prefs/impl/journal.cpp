@@ -0,0 +1,333 @@
+#include "roo_prefs/impl/journal.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "roo_logging.h"
+
+namespace roo_prefs {
+namespace internal {
+
+namespace {
+
+// Journal layout: the format version (1 byte), and the number of operations
+// (2 bytes), followed by the operations. Each operation consists of its type
+// (1 byte), the length of the key (1 byte), the key, the length of the value
+// (4 bytes), and the value. Numbers are stored in native byte order, as the
+// journal is replayed by the same device.
+constexpr uint8_t kVersion = 1;
+constexpr size_t kHeaderSize = 3;
+
+enum OpType : uint8_t {
+  kClear,
+  kBool,
+  kU8,
+  kI8,
+  kU16,
+  kI16,
+  kU32,
+  kI32,
+  kU64,
+  kI64,
+  kFloat,
+  kDouble,
+  kString,
+  kBytes,
+  // Written with `writeObject()`, which stores may encode differently from
+  // blobs (see `CompressingStore`).
+  kObject
+};
+
+template <typename T>
+bool Take(const uint8_t*& pos, const uint8_t* end, T& val) {
+  if ((size_t)(end - pos) < sizeof(T)) return false;
+  memcpy(&val, pos, sizeof(T));
+  pos += sizeof(T);
+  return true;
+}
+
+template <typename T>
+WriteResult Write(WriteResult (Store::*write)(const char*, T), Store& store,
+                  const char* key, const uint8_t* data, uint32_t len) {
+  T val;
+  if (len != sizeof(val)) return WriteResult::kError;
+  memcpy(&val, data, sizeof(val));
+  return (store.*write)(key, val);
+}
+
+WriteResult Apply(Store& store, uint8_t type, const char* key,
+                  const uint8_t* data, uint32_t len) {
+  switch (type) {
+    case kClear: {
+      // The key may have been cleared already, before an interruption.
+      if (!store.isKey(key)) return WriteResult::kOk;
+      return store.clear(key) == ClearResult::kOk ? WriteResult::kOk
+                                                  : WriteResult::kError;
+    }
+    case kBool: {
+      return Write<bool>(&Store::writeBool, store, key, data, len);
+    }
+    case kU8: {
+      return Write<uint8_t>(&Store::writeU8, store, key, data, len);
+    }
+    case kI8: {
+      return Write<int8_t>(&Store::writeI8, store, key, data, len);
+    }
+    case kU16: {
+      return Write<uint16_t>(&Store::writeU16, store, key, data, len);
+    }
+    case kI16: {
+      return Write<int16_t>(&Store::writeI16, store, key, data, len);
+    }
+    case kU32: {
+      return Write<uint32_t>(&Store::writeU32, store, key, data, len);
+    }
+    case kI32: {
+      return Write<int32_t>(&Store::writeI32, store, key, data, len);
+    }
+    case kU64: {
+      return Write<uint64_t>(&Store::writeU64, store, key, data, len);
+    }
+    case kI64: {
+      return Write<int64_t>(&Store::writeI64, store, key, data, len);
+    }
+    case kFloat: {
+      return Write<float>(&Store::writeFloat, store, key, data, len);
+    }
+    case kDouble: {
+      return Write<double>(&Store::writeDouble, store, key, data, len);
+    }
+    case kString: {
+      return store.writeString(
+          key, roo::string_view(reinterpret_cast<const char*>(data), len));
+    }
+    case kBytes: {
+      return store.writeBytes(key, data, len);
+    }
+    default: {
+      return WriteResult::kError;
+    }
+  }
+}
+
+// Checks that the journal is complete. Returns the number of operations, or
+// -1 if the journal is malformed.
+int Validate(const uint8_t* pos, const uint8_t* end) {
+  uint8_t version;
+  uint16_t count;
+  if (!Take(pos, end, version) || version != kVersion) return -1;
+  if (!Take(pos, end, count)) return -1;
+  for (uint16_t i = 0; i < count; ++i) {
+    uint8_t type;
+    uint8_t key_len;
+    uint32_t len;
+    if (!Take(pos, end, type) || type > kObject) return -1;
+    if (!Take(pos, end, key_len) || (size_t)(end - pos) < key_len) return -1;
+    pos += key_len;
+    if (!Take(pos, end, len) || (size_t)(end - pos) < len) return -1;
+    pos += len;
+  }
+  return pos == end ? count : -1;
+}
+
+}  // namespace
+
+JournalRecorder::JournalRecorder() : data_(kHeaderSize, '\0'), count_(0) {
+  data_[0] = (char)kVersion;
+}
+
+WriteResult JournalRecorder::save(Store& store, const char* key) const {
+  return store.writeBytes(key, data_.data(), data_.size());
+}
+
+WriteResult JournalRecorder::put(const char* key, uint8_t type,
+                                 const void* data, size_t len) {
+  size_t key_len = strlen(key);
+  if (key_len > kMaxKeyLength || len > UINT32_MAX || count_ == UINT16_MAX) {
+    return WriteResult::kError;
+  }
+  uint32_t len32 = (uint32_t)len;
+  data_.push_back((char)type);
+  data_.push_back((char)key_len);
+  data_.append(key, key_len);
+  data_.append(reinterpret_cast<const char*>(&len32), sizeof(len32));
+  data_.append(static_cast<const char*>(data), len);
+  ++count_;
+  memcpy(&data_[1], &count_, sizeof(count_));
+  return WriteResult::kOk;
+}
+
+ClearResult JournalRecorder::clear(const char* key) {
+  return put(key, kClear, nullptr, 0) == WriteResult::kOk
+             ? ClearResult::kOk
+             : ClearResult::kError;
+}
+
+WriteResult JournalRecorder::writeBool(const char* key, bool val) {
+  return put(key, kBool, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeU8(const char* key, uint8_t val) {
+  return put(key, kU8, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeI8(const char* key, int8_t val) {
+  return put(key, kI8, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeU16(const char* key, uint16_t val) {
+  return put(key, kU16, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeI16(const char* key, int16_t val) {
+  return put(key, kI16, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeU32(const char* key, uint32_t val) {
+  return put(key, kU32, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeI32(const char* key, int32_t val) {
+  return put(key, kI32, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeU64(const char* key, uint64_t val) {
+  return put(key, kU64, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeI64(const char* key, int64_t val) {
+  return put(key, kI64, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeFloat(const char* key, float val) {
+  return put(key, kFloat, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeDouble(const char* key, double val) {
+  return put(key, kDouble, &val, sizeof(val));
+}
+
+WriteResult JournalRecorder::writeString(const char* key,
+                                         roo::string_view val) {
+  return put(key, kString, val.data(), val.size());
+}
+
+WriteResult JournalRecorder::writeBytes(const char* key, const void* val,
+                                        size_t len) {
+  // Empty blobs are unsupported by stores, so they fail up front.
+  if (len == 0) return WriteResult::kError;
+  return put(key, kBytes, val, len);
+}
+
+WriteResult JournalRecorder::writeObjectInternal(const char* key,
+                                                 const void* val,
+                                                 size_t size) {
+  return put(key, kObject, val, size);
+}
+
+ReadResult JournalRecorder::readBool(const char*, bool&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readU8(const char*, uint8_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readI8(const char*, int8_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readU16(const char*, uint16_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readI16(const char*, int16_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readU32(const char*, uint32_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readI32(const char*, int32_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readU64(const char*, uint64_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readI64(const char*, int64_t&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readFloat(const char*, float&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readDouble(const char*, double&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readString(const char*, std::string&) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readBytes(const char*, void*, size_t, size_t*) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readBytesLength(const char*, size_t*) {
+  return ReadResult::kError;
+}
+
+ReadResult JournalRecorder::readObjectInternal(const char*, void*, size_t) {
+  return ReadResult::kError;
+}
+
+ReplayResult ReplayJournal(Store& store, const char* key,
+                           ObjectWriter write_object) {
+  size_t size;
+  ReadResult result = store.readBytesLength(key, &size);
+  if (result == ReadResult::kNotFound) return ReplayResult::kOk;
+  std::vector<uint8_t> journal;
+  if (result == ReadResult::kOk && size > 0) {
+    journal.resize(size);
+    result = store.readBytes(key, &journal[0], size, &size);
+  }
+  if (result == ReadResult::kError) return ReplayResult::kUnreadable;
+  const uint8_t* pos = journal.data();
+  const uint8_t* end = pos + journal.size();
+  if (result != ReadResult::kOk || Validate(pos, end) < 0) {
+    LOG(WARNING) << "Discarding incomplete journal " << key;
+    return store.clear(key) == ClearResult::kOk ? ReplayResult::kOk
+                                                : ReplayResult::kUnreadable;
+  }
+  pos += kHeaderSize;
+  bool ok = true;
+  while (pos != end) {
+    uint8_t type = *pos++;
+    uint8_t key_len = *pos++;
+    std::string op_key(reinterpret_cast<const char*>(pos), key_len);
+    pos += key_len;
+    uint32_t len;
+    Take(pos, end, len);
+    WriteResult written =
+        type == kObject ? write_object(store, op_key.c_str(), pos, len)
+                        : Apply(store, type, op_key.c_str(), pos, len);
+    if (written != WriteResult::kOk) {
+      LOG(ERROR) << "Failed to replay the journaled write of " << op_key;
+      ok = false;
+    }
+    pos += len;
+  }
+  if (store.clear(key) != ClearResult::kOk) {
+    LOG(ERROR) << "Failed to remove the replayed journal " << key;
+    ok = false;
+  }
+  return ok ? ReplayResult::kOk : ReplayResult::kIncomplete;
+}
+
+}  // namespace internal
+}  // namespace roo_prefs
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <string>
+
+#include "roo_prefs/store/store.h"
+
+namespace roo_prefs {
+namespace internal {
+
+/// Key, in the namespace of the collection, under which atomic batches are
+/// journaled while being applied.
+constexpr char kJournalKey[] = "~roo_journal";
+
+/// Store that records writes and clears, rather than applying them, so that
+/// they can be saved as a journal, and replayed later by `ReplayJournal()`.
+/// Reads are not supported. Operations on keys longer than `kMaxKeyLength`
+/// fail, so that a batch containing them fails before anything is written,
+/// rather than on every replay.
+class JournalRecorder : public Store {
+ public:
+  JournalRecorder();
+
+  /// Returns the number of recorded operations.
+  uint16_t count() const { return count_; }
+
+  /// Stores the journal as a blob under the specified key.
+  WriteResult save(Store& store, const char* key) const;
+
+  bool isKey(const char*) override { return false; }
+
+  ClearResult clear(const char* key) override;
+
+  WriteResult writeBool(const char* key, bool val) override;
+
+  WriteResult writeU8(const char* key, uint8_t val) override;
+
+  WriteResult writeI8(const char* key, int8_t val) override;
+
+  WriteResult writeU16(const char* key, uint16_t val) override;
+
+  WriteResult writeI16(const char* key, int16_t val) override;
+
+  WriteResult writeU32(const char* key, uint32_t val) override;
+
+  WriteResult writeI32(const char* key, int32_t val) override;
+
+  WriteResult writeU64(const char* key, uint64_t val) override;
+
+  WriteResult writeI64(const char* key, int64_t val) override;
+
+  WriteResult writeFloat(const char* key, float val) override;
+
+  WriteResult writeDouble(const char* key, double val) override;
+
+  WriteResult writeString(const char* key, roo::string_view val) override;
+
+  WriteResult writeBytes(const char* key, const void* val,
+                         size_t len) override;
+
+  ReadResult readBool(const char* key, bool& val) override;
+
+  ReadResult readU8(const char* key, uint8_t& val) override;
+
+  ReadResult readI8(const char* key, int8_t& val) override;
+
+  ReadResult readU16(const char* key, uint16_t& val) override;
+
+  ReadResult readI16(const char* key, int16_t& val) override;
+
+  ReadResult readU32(const char* key, uint32_t& val) override;
+
+  ReadResult readI32(const char* key, int32_t& val) override;
+
+  ReadResult readU64(const char* key, uint64_t& val) override;
+
+  ReadResult readI64(const char* key, int64_t& val) override;
+
+  ReadResult readFloat(const char* key, float& val) override;
+
+  ReadResult readDouble(const char* key, double& val) override;
+
+  ReadResult readString(const char* key, std::string& val) override;
+
+  ReadResult readBytes(const char* key, void* val, size_t max_len,
+                       size_t* out_len) override;
+
+  ReadResult readBytesLength(const char* key, size_t* out_len) override;
+
+ protected:
+  bool begin(const char*, bool) override { return true; }
+
+  void end() override {}
+
+  WriteResult writeObjectInternal(const char* key, const void* val,
+                                  size_t size) override;
+
+  ReadResult readObjectInternal(const char* key, void* val,
+                                size_t size) override;
+
+ private:
+  WriteResult put(const char* key, uint8_t type, const void* data,
+                  size_t len);
+
+  std::string data_;
+  uint16_t count_;
+};
+
+/// Outcome of `ReplayJournal()`.
+enum class ReplayResult {
+  /// The journal, if any, has been replayed (or discarded, if malformed) and
+  /// removed.
+  kOk,
+
+  /// The journal could not be read, or removed before replaying it. Nothing
+  /// has been written; the replay should be retried later.
+  kUnreadable,
+
+  /// Some of the operations failed, or the journal could not be removed
+  /// afterwards. The values of the affected keys are unknown.
+  kIncomplete
+};
+
+/// Writes the bytes of an object, as `Store::writeObject()` does. Lets the
+/// collection, which may call the protected `Store::writeObjectInternal()`,
+/// replay journaled objects.
+using ObjectWriter = WriteResult (*)(Store& store, const char* key,
+                                     const void* val, size_t size);
+
+/// Applies the operations recorded in the journal stored under the specified
+/// key (if any), and removes the journal. Operations already applied are
+/// applied again, which leaves them unchanged. The journal is removed even
+/// if some of them fail, as replaying it again, after newer writes, would
+/// overwrite them. Malformed journals (whose write has itself been
+/// interrupted) are discarded, as none of their operations have been applied.
+ReplayResult ReplayJournal(Store& store, const char* key,
+                           ObjectWriter write_object);
+
+}  // namespace internal
+}  // namespace roo_prefs
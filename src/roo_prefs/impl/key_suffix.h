@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace roo_prefs {
+
+namespace internal {
+
+// Returns the length of the key suffix ".<index>", for indexes up to
+// `max_index`. Used to check derived keys (of segments, slots and chunks)
+// against `kMaxKeyLength`.
+constexpr size_t IndexSuffixLength(size_t max_index) {
+  return max_index < 10 ? 2 : 1 + IndexSuffixLength(max_index / 10);
+}
+
+}  // namespace internal
+
+}  // namespace roo_prefs
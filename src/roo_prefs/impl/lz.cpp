@@ -0,0 +1,167 @@
+#include "roo_prefs/impl/lz.h"
+
+#include <string.h>
+
+namespace roo_prefs {
+namespace internal {
+
+namespace {
+
+constexpr int kHashBits = 9;
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+
+// End-of-block rules of the LZ4 block format: the last 5 bytes are always
+// literals, and the last match starts at least 12 bytes before the end.
+constexpr size_t kLastLiterals = 5;
+constexpr size_t kMatchStartLimit = 12;
+
+uint32_t Read32(const uint8_t* p) {
+  uint32_t val;
+  memcpy(&val, p, sizeof(val));
+  return val;
+}
+
+uint32_t Hash(uint32_t val) {
+  return (val * 2654435761u) >> (32 - kHashBits);
+}
+
+// Appends bytes to the output, tracking overflow.
+class Output {
+ public:
+  Output(uint8_t* out, size_t capacity)
+      : out_(out), size_(0), capacity_(capacity), ok_(true) {}
+
+  void put(uint8_t byte) {
+    if (size_ >= capacity_) {
+      ok_ = false;
+      return;
+    }
+    out_[size_++] = byte;
+  }
+
+  void put(const uint8_t* data, size_t len) {
+    if (len > capacity_ - size_) {
+      ok_ = false;
+      return;
+    }
+    memcpy(out_ + size_, data, len);
+    size_ += len;
+  }
+
+  // Appends the excess of a length over the 4-bit token field.
+  void putLength(size_t len) {
+    while (len >= 255) {
+      put(255);
+      len -= 255;
+    }
+    put((uint8_t)len);
+  }
+
+  bool ok() const { return ok_; }
+  size_t size() const { return size_; }
+
+ private:
+  uint8_t* out_;
+  size_t size_;
+  size_t capacity_;
+  bool ok_;
+};
+
+// Writes a sequence: literals, followed by a match (unless `match_len` is 0,
+// which ends the block).
+void PutSequence(Output& out, const uint8_t* literals, size_t literal_len,
+                 size_t offset, size_t match_len) {
+  size_t match_code = match_len == 0 ? 0 : match_len - kMinMatch;
+  uint8_t token = (uint8_t)(((literal_len < 15 ? literal_len : 15) << 4) |
+                            (match_code < 15 ? match_code : 15));
+  out.put(token);
+  if (literal_len >= 15) out.putLength(literal_len - 15);
+  out.put(literals, literal_len);
+  if (match_len == 0) return;
+  out.put((uint8_t)(offset & 0xFF));
+  out.put((uint8_t)(offset >> 8));
+  if (match_code >= 15) out.putLength(match_code - 15);
+}
+
+// Reads the excess of a length over the 4-bit token field.
+bool TakeLength(const uint8_t*& pos, const uint8_t* end, size_t& len) {
+  uint8_t byte;
+  do {
+    if (pos == end) return false;
+    byte = *pos++;
+    len += byte;
+  } while (byte == 255);
+  return true;
+}
+
+}  // namespace
+
+size_t LzCompress(const uint8_t* in, size_t len, uint8_t* out,
+                  size_t capacity) {
+  if (len > kLzMaxInput) return 0;
+  // Positions of the last occurrences of 4-byte sequences, by hash.
+  uint16_t table[1 << kHashBits];
+  memset(table, 0, sizeof(table));
+  Output output(out, capacity);
+  size_t anchor = 0;
+  size_t pos = 0;
+  while (pos + kMatchStartLimit <= len && output.ok()) {
+    uint32_t seq = Read32(in + pos);
+    uint32_t hash = Hash(seq);
+    size_t ref = table[hash];
+    table[hash] = (uint16_t)pos;
+    // Stale or colliding entries are filtered out by comparing the bytes.
+    if (ref >= pos || pos - ref > kMaxOffset || Read32(in + ref) != seq) {
+      ++pos;
+      continue;
+    }
+    size_t match_len = kMinMatch;
+    while (pos + match_len < len - kLastLiterals &&
+           in[ref + match_len] == in[pos + match_len]) {
+      ++match_len;
+    }
+    PutSequence(output, in + anchor, pos - anchor, pos - ref, match_len);
+    pos += match_len;
+    anchor = pos;
+  }
+  PutSequence(output, in + anchor, len - anchor, 0, 0);
+  return output.ok() ? output.size() : 0;
+}
+
+bool LzDecompress(const uint8_t* in, size_t len, uint8_t* out,
+                  size_t out_len) {
+  const uint8_t* pos = in;
+  const uint8_t* end = in + len;
+  size_t written = 0;
+  while (pos < end) {
+    uint8_t token = *pos++;
+    size_t literal_len = token >> 4;
+    if (literal_len == 15 && !TakeLength(pos, end, literal_len)) return false;
+    if (literal_len > (size_t)(end - pos) || literal_len > out_len - written) {
+      return false;
+    }
+    memcpy(out + written, pos, literal_len);
+    pos += literal_len;
+    written += literal_len;
+    // The last sequence has no match.
+    if (pos == end) break;
+    if (end - pos < 2) return false;
+    size_t offset = pos[0] | (pos[1] << 8);
+    pos += 2;
+    if (offset == 0 || offset > written) return false;
+    size_t match_len = token & 0x0F;
+    if (match_len == 15 && !TakeLength(pos, end, match_len)) return false;
+    match_len += kMinMatch;
+    if (match_len > out_len - written) return false;
+    // Byte by byte, as the match may overlap the bytes being written.
+    for (size_t i = 0; i < match_len; ++i) {
+      out[written + i] = out[written - offset + i];
+    }
+    written += match_len;
+  }
+  return written == out_len;
+}
+
+}  // namespace internal
+}  // namespace roo_prefs
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace roo_prefs {
+namespace internal {
+
+/// Largest input accepted by `LzCompress()`.
+constexpr size_t kLzMaxInput = 65535;
+
+/// Compresses `len` bytes of `in` into `out`, as an LZ4 block (following its
+/// end-of-block rules, so that standard LZ4 decoders accept it), using 1 KB
+/// of working memory on the stack. Returns the compressed size, or 0 if the
+/// input is too large, or if the output would not fit in `capacity` bytes.
+size_t LzCompress(const uint8_t* in, size_t len, uint8_t* out,
+                  size_t capacity);
+
+/// Decompresses `len` bytes of `in`, produced by `LzCompress()`, into exactly
+/// `out_len` bytes of `out`. Returns false if the input is malformed, or
+/// does not decompress to `out_len` bytes.
+bool LzDecompress(const uint8_t* in, size_t len, uint8_t* out,
+                  size_t out_len);
+
+}  // namespace internal
+}  // namespace roo_prefs
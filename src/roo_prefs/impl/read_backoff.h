@@ -0,0 +1,53 @@
+#pragma once
+
+#include <inttypes.h>
+
+namespace roo_prefs {
+
+namespace internal {
+
+/// Read backoff of a preference in the error state (see `ErrorPolicy`).
+/// Counts the accesses left until the next retry of the failed read.
+class ReadBackoff {
+ public:
+  ReadBackoff() : exp_(0), countdown_(0) {}
+
+  /// Returns true if reads are being skipped.
+  bool active() const { return countdown_ > 0; }
+
+  /// Returns true, and counts the access, if the read is to be skipped.
+  bool skip() {
+    if (countdown_ == 0) return false;
+    --countdown_;
+    return true;
+  }
+
+  /// Starts, or extends, the backoff after a failed read. The backoff
+  /// doubles after each failure, starting at `initial`, up to `max`. Zero
+  /// `initial` means no backoff.
+  void fail(uint16_t initial, uint16_t max) {
+    if (initial == 0) return;
+    uint32_t backoff = (uint32_t)initial << exp_;
+    if (backoff >= max) {
+      backoff = max;
+    } else {
+      ++exp_;
+    }
+    countdown_ = backoff;
+  }
+
+  /// Ends the backoff, after a successful read or write.
+  void reset() {
+    exp_ = 0;
+    countdown_ = 0;
+  }
+
+ private:
+  // The number of doublings of the initial backoff so far.
+  uint8_t exp_;
+  uint16_t countdown_;
+};
+
+}  // namespace internal
+
+}  // namespace roo_prefs
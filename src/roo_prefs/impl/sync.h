@@ -0,0 +1,110 @@
+#pragma once
+
+/// Synchronization primitives used by collections and preferences.
+///
+/// Thread safety is opt-in: define `ROO_PREFS_THREAD_SAFE` to 1 (e.g. with
+/// `-DROO_PREFS_THREAD_SAFE=1`) to make `Collection`, `Transaction` and
+/// `Pref` safe to use from multiple threads. Otherwise, the primitives below
+/// compile to plain fields and no-ops.
+///
+/// The define changes the layout of `Collection` and `Pref`, so it must be
+/// the same in every translation unit, including those of the library
+/// itself: set it build-wide (e.g. in `build_flags`, or by depending on the
+/// `:roo_prefs_thread_safe` Bazel target), never for a single file.
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <mutex>
+
+#ifndef ROO_PREFS_THREAD_SAFE
+#define ROO_PREFS_THREAD_SAFE 0
+#endif
+
+namespace roo_prefs {
+namespace internal {
+
+#if ROO_PREFS_THREAD_SAFE
+
+/// Guards the store of a collection. Recursive, because transactions nest.
+using Mutex = std::recursive_mutex;
+
+template <typename T>
+using Atomic = std::atomic<T>;
+
+/// Sequence counter, protecting a value that is written under a mutex, but
+/// read without it. Readers retry if the value changed while they were
+/// copying it.
+class SeqCount {
+ public:
+  SeqCount() : seq_(0) {}
+
+  /// Must be called by the (single) writer before modifying the value.
+  void beginWrite() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  /// Must be called by the writer after modifying the value.
+  void endWrite() {
+    seq_.store(seq_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+
+  /// Returns the token to pass to `retryRead()`, once no write is in
+  /// progress.
+  uint32_t beginRead() const {
+    while (true) {
+      uint32_t seq = seq_.load(std::memory_order_acquire);
+      if ((seq & 1) == 0) return seq;
+    }
+  }
+
+  /// Returns true if the value might have changed since `beginRead()`.
+  bool retryRead(uint32_t token) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return seq_.load(std::memory_order_relaxed) != token;
+  }
+
+ private:
+  std::atomic<uint32_t> seq_;
+};
+
+#else
+
+class Mutex {
+ public:
+  void lock() {}
+  void unlock() {}
+};
+
+template <typename T>
+class Atomic {
+ public:
+  Atomic(T value) : value_(value) {}
+
+  T load(std::memory_order = std::memory_order_seq_cst) const {
+    return value_;
+  }
+
+  void store(T value, std::memory_order = std::memory_order_seq_cst) {
+    value_ = value;
+  }
+
+ private:
+  T value_;
+};
+
+class SeqCount {
+ public:
+  void beginWrite() {}
+  void endWrite() {}
+  uint32_t beginRead() const { return 0; }
+  bool retryRead(uint32_t) const { return false; }
+};
+
+#endif
+
+}  // namespace internal
+}  // namespace roo_prefs
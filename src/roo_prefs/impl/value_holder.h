@@ -1,9 +1,13 @@
 #pragma once
 
+#include <string.h>
+
 #include <string>
+#include <utility>
 
 #include "roo_backport.h"
 #include "roo_backport/string_view.h"
+#include "roo_prefs/fixed_string.h"
 
 #ifdef ARDUINO
 #include <Arduino.h>
@@ -32,6 +36,11 @@ inline roo::string_view ToStringView(const char (&value)[N]) {
   return roo::string_view(value, size);
 }
 
+template <size_t N>
+inline roo::string_view ToStringView(const FixedString<N>& value) {
+  return value.view();
+}
+
 #ifdef ARDUINO
 inline roo::string_view ToStringView(const ::String& value) {
   return roo::string_view(value.c_str(), value.length());
@@ -48,6 +57,7 @@ class ValueHolder {
   V& get() { return value_; }
 
   void set(const V& value) { value_ = value; }
+  void set(V&& value) { value_ = std::move(value); }
 
   bool equals(const V& other) const { return value_ == other; }
 
@@ -126,7 +136,9 @@ class ValueHolder<::String> {
   ValueHolder(const ::String& other = ::String()) : value_(other) {}
 
   template <typename V>
-  ValueHolder(const V& other) : value_(ToStringView(other)) {}
+  ValueHolder(const V& other) : value_() {
+    set(other);
+  }
 
   const ::String& get() const { return value_; }
   ::String& get() { return value_; }
@@ -172,6 +184,38 @@ class ValueHolder<::String> {
 };
 #endif
 
+template <size_t N>
+class ValueHolder<FixedString<N>> {
+ public:
+  ValueHolder() : value_() {}
+
+  template <typename V>
+  ValueHolder(const V& other) : value_(ToStringView(other)) {}
+
+  const FixedString<N>& get() const { return value_; }
+  FixedString<N>& get() { return value_; }
+
+  template <typename V>
+  void set(const V& value) {
+    value_.assign(ToStringView(value));
+  }
+
+  template <typename V>
+  bool equals(const V& other) const {
+    roo::string_view view = FixedString<N>::Truncate(ToStringView(other));
+    return value_.size() == view.size() &&
+           memcmp(value_.data(), view.data(), view.size()) == 0;
+  }
+
+  template <typename V>
+  static roo::string_view Assignable(const V& value) {
+    return FixedString<N>::Truncate(ToStringView(value));
+  }
+
+ private:
+  FixedString<N> value_;
+};
+
 }  // namespace internal
 
 }  // namespace roo_prefs
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string.h>
+
+#include <memory>
+#include <vector>
+
+#include "roo_prefs/impl/journal.h"
+#include "roo_prefs/store/store.h"
+
+namespace roo_prefs {
+namespace internal {
+
+/// A deferred write or clear of a single key, queued by a `Pref` in a batched
+/// transaction.
+class BatchedOp {
+ public:
+  explicit BatchedOp(const char* key) : key_(key) {}
+  virtual ~BatchedOp() = default;
+
+  const char* key() const { return key_; }
+
+  /// Applies the operation to the store, and updates the cache of the
+  /// preference that queued it. Returns true on success.
+  bool apply(Store& store) {
+    bool ok = write(store);
+    finish(ok);
+    return ok;
+  }
+
+  /// Writes (or clears) the value in the store, without updating the cache.
+  /// Returns true on success.
+  virtual bool write(Store& store) = 0;
+
+  /// Updates the cache of the preference, after the write has succeeded, or
+  /// marks it as failed otherwise.
+  virtual void finish(bool ok) = 0;
+
+ private:
+  const char* key_;
+};
+
+/// Ordered set of pending operations, with at most one operation per key.
+class WriteBatch {
+ public:
+  bool empty() const { return ops_.empty(); }
+
+  /// Queues the operation, replacing any pending operation on the same key.
+  void put(std::unique_ptr<BatchedOp> op) {
+    for (auto& existing : ops_) {
+      if (strcmp(existing->key(), op->key()) == 0) {
+        existing = std::move(op);
+        return;
+      }
+    }
+    ops_.push_back(std::move(op));
+  }
+
+  /// Drops the pending operation on the specified key, if any.
+  void cancel(const char* key) {
+    for (auto itr = ops_.begin(); itr != ops_.end(); ++itr) {
+      if (strcmp((*itr)->key(), key) == 0) {
+        ops_.erase(itr);
+        return;
+      }
+    }
+  }
+
+  /// Applies all pending operations, in the order in which they were first
+  /// queued, and empties the batch. Returns true if all of them succeeded.
+  ///
+  /// If `atomic` is true, and there is more than one operation, they are
+  /// first recorded in a journal, stored under `kJournalKey`, and the journal
+  /// is removed once all of them succeed. If the batch is interrupted (e.g.
+  /// by a reset) or fails, `ReplayJournal()` completes it. Operations that
+  /// can't be journaled (e.g. because their keys are too long) fail the
+  /// batch as a whole, before anything is written.
+  bool apply(Store& store, bool atomic) {
+    // Operations can't be queued while applying, but the vector is swapped
+    // out first so that the batch is left empty even if they could.
+    std::vector<std::unique_ptr<BatchedOp>> ops;
+    ops.swap(ops_);
+    bool journaled = atomic && ops.size() > 1;
+    if (journaled) {
+      JournalRecorder journal;
+      bool recorded = true;
+      for (auto& op : ops) {
+        if (!op->write(journal)) recorded = false;
+      }
+      if (!recorded || journal.save(store, kJournalKey) != WriteResult::kOk) {
+        // Nothing has been written, so the batch fails as a whole.
+        for (auto& op : ops) op->finish(false);
+        return false;
+      }
+    }
+    bool ok = true;
+    for (auto& op : ops) {
+      if (!op->apply(store)) ok = false;
+    }
+    if (journaled && ok) {
+      ok = (store.clear(kJournalKey) == ClearResult::kOk);
+    }
+    return ok;
+  }
+
+ private:
+  std::vector<std::unique_ptr<BatchedOp>> ops_;
+};
+
+}  // namespace internal
+}  // namespace roo_prefs
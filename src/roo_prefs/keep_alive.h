@@ -0,0 +1,65 @@
+#pragma once
+
+/// Keeps the store of a collection open between transactions, and closes it
+/// after a period of inactivity.
+///
+/// Depends on the "dejwk/roo_scheduler" library.
+
+#include "roo_prefs/collection.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+
+namespace roo_prefs {
+
+/// While the keep-alive exists, the store of the collection stays open after
+/// the last transaction ends, and gets closed once no transaction has been
+/// started for `idle_timeout`. It saves the cost of reopening the namespace
+/// on every standalone `get()` and `set()`, when they come in bursts.
+///
+/// @code
+/// roo_prefs::Collection prefs("ui");
+/// roo_prefs::KeepAlive keep_alive(prefs, scheduler, roo_time::Seconds(5));
+/// @endcode
+///
+/// Only one keep-alive can be attached to a collection at a time. On
+/// destruction, the keep-alive closes the store (unless a transaction is in
+/// progress, in which case the store is closed when it ends).
+class KeepAlive : private internal::IdleListener {
+ public:
+  KeepAlive(Collection& collection, roo_scheduler::Scheduler& scheduler,
+            roo_time::Duration idle_timeout = roo_time::Seconds(5))
+      : collection_(collection),
+        idle_timeout_(idle_timeout),
+        task_(scheduler, [this]() { collection_.close(); }) {
+    collection_.setIdleListener(this);
+    collection_.setKeepOpen(true);
+  }
+
+  KeepAlive(const KeepAlive&) = delete;
+  KeepAlive& operator=(const KeepAlive&) = delete;
+
+  ~KeepAlive() override {
+    collection_.setIdleListener(nullptr);
+    collection_.setKeepOpen(false);
+  }
+
+  /// Closes the store immediately, if no transaction is in progress. Returns
+  /// true on success. The store is reopened by the next transaction.
+  bool close() {
+    task_.cancel();
+    return collection_.close();
+  }
+
+ private:
+  // Called with the collection lock held.
+  void onIdle() override {
+    task_.cancel();
+    task_.scheduleAfter(idle_timeout_, roo_scheduler::PRIORITY_BACKGROUND);
+  }
+
+  Collection& collection_;
+  roo_time::Duration idle_timeout_;
+  roo_scheduler::SingletonTask task_;
+};
+
+}  // namespace roo_prefs
@@ -0,0 +1,107 @@
+#include "roo_prefs/latency_stats.h"
+
+#include "roo_logging.h"
+
+namespace roo_prefs {
+
+namespace {
+
+LatencyHistogram* Histograms() {
+  static LatencyHistogram histograms[kLatencyOpCount];
+  return histograms;
+}
+
+}  // namespace
+
+const char* LatencyOpName(LatencyOp op) {
+  switch (op) {
+    case LatencyOp::kOpen:
+      return "open";
+    case LatencyOp::kClose:
+      return "close";
+    case LatencyOp::kRead:
+      return "read";
+    case LatencyOp::kWrite:
+      return "write";
+    case LatencyOp::kClear:
+      return "clear";
+    case LatencyOp::kLazyFlush:
+      return "lazy_flush";
+  }
+  return "unknown";
+}
+
+constexpr int LatencyHistogram::kBucketCount;
+
+LatencyHistogram::LatencyHistogram() : count_(0), max_us_(0) {
+  for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(uint32_t us) {
+  buckets_[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  uint32_t max = max_us_.load(std::memory_order_relaxed);
+  while (us > max && !max_us_.compare_exchange_weak(
+                         max, us, std::memory_order_relaxed)) {
+  }
+}
+
+void LatencyHistogram::reset() {
+  for (auto& b : buckets_) b.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  max_us_.store(0, std::memory_order_relaxed);
+}
+
+uint32_t LatencyHistogram::percentile(float p) const {
+  uint32_t total = 0;
+  uint32_t counts[kBucketCount];
+  for (int i = 0; i < kBucketCount; ++i) {
+    counts[i] = bucket(i);
+    total += counts[i];
+  }
+  if (total == 0) return 0;
+  if (p < 0) p = 0;
+  if (p > 100) p = 100;
+  // The rank (1-based) of the requested sample.
+  uint32_t rank = (uint32_t)(p / 100.0f * total + 0.5f);
+  if (rank < 1) rank = 1;
+  uint32_t max = max_us();
+  uint32_t seen = 0;
+  for (int i = 0; i < kBucketCount - 1; ++i) {
+    seen += counts[i];
+    if (seen >= rank) {
+      uint32_t upper = BucketLowerBound(i + 1) - 1;
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+const LatencyHistogram& GetLatencyHistogram(LatencyOp op) {
+  return Histograms()[(int)op];
+}
+
+void ResetLatencyStats() {
+  for (int i = 0; i < kLatencyOpCount; ++i) Histograms()[i].reset();
+}
+
+void LogLatencyStats() {
+  for (int i = 0; i < kLatencyOpCount; ++i) {
+    const LatencyHistogram& h = Histograms()[i];
+    LOG(INFO) << "Latency of " << LatencyOpName((LatencyOp)i) << ": "
+              << h.count() << " ops, p50 <= " << h.percentile(50)
+              << " us, p90 <= " << h.percentile(90)
+              << " us, p99 <= " << h.percentile(99)
+              << " us, max = " << h.max_us() << " us";
+  }
+}
+
+namespace internal {
+
+LatencyHistogram& MutableLatencyHistogram(LatencyOp op) {
+  return Histograms()[(int)op];
+}
+
+}  // namespace internal
+
+}  // namespace roo_prefs
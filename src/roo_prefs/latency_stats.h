@@ -0,0 +1,145 @@
+#pragma once
+
+/// Latency histograms of storage operations.
+///
+/// The instrumentation is compiled in only if the library is built with
+/// `ROO_PREFS_LATENCY_STATS` defined to 1 (e.g. with
+/// `-DROO_PREFS_LATENCY_STATS=1`). Otherwise, the histograms stay empty, and
+/// the instrumented code has no overhead. Define it for the whole build, as
+/// most of the instrumented operations are in the library sources.
+///
+/// @code
+/// const roo_prefs::LatencyHistogram& writes =
+///     roo_prefs::GetLatencyHistogram(roo_prefs::LatencyOp::kWrite);
+/// LOG(INFO) << "p99 write latency: " << writes.percentile(99) << " us";
+/// @endcode
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <chrono>
+
+#ifndef ROO_PREFS_LATENCY_STATS
+#define ROO_PREFS_LATENCY_STATS 0
+#endif
+
+namespace roo_prefs {
+
+/// Instrumented operations.
+enum class LatencyOp : uint8_t {
+  /// Opening the namespace by the outermost transaction.
+  kOpen = 0,
+
+  /// Closing the namespace.
+  kClose = 1,
+
+  /// A single read (or probe) in `PreferencesStore`.
+  kRead = 2,
+
+  /// A single write in `PreferencesStore`.
+  kWrite = 3,
+
+  /// A single clear in `PreferencesStore`.
+  kClear = 4,
+
+  /// Flushing the pending value of a `LazyWritePref`.
+  kLazyFlush = 5,
+};
+
+constexpr int kLatencyOpCount = 6;
+
+const char* LatencyOpName(LatencyOp op);
+
+/// Histogram of durations, in microseconds, with logarithmic buckets and
+/// fixed memory. Bucket 0 counts zero durations, and bucket i > 0 counts
+/// durations in [2^(i-1), 2^i). The last bucket is open-ended. Safe to
+/// update from multiple threads.
+class LatencyHistogram {
+ public:
+  static constexpr int kBucketCount = 24;
+
+  LatencyHistogram();
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void record(uint32_t us);
+
+  void reset();
+
+  uint32_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  uint32_t max_us() const { return max_us_.load(std::memory_order_relaxed); }
+
+  uint32_t bucket(int index) const {
+    return buckets_[index].load(std::memory_order_relaxed);
+  }
+
+  /// Returns an upper bound of the specified percentile (0-100), i.e. the
+  /// upper bound of the bucket that contains it, capped at `max_us()`.
+  /// Returns 0 if the histogram is empty.
+  uint32_t percentile(float p) const;
+
+  /// Returns the smallest duration that falls into the specified bucket.
+  static uint32_t BucketLowerBound(int index) {
+    return index == 0 ? 0 : (uint32_t)1 << (index - 1);
+  }
+
+  static int BucketIndex(uint32_t us) {
+    int index = 0;
+    while (us != 0 && index < kBucketCount - 1) {
+      us >>= 1;
+      ++index;
+    }
+    return index;
+  }
+
+ private:
+  std::atomic<uint32_t> buckets_[kBucketCount];
+  std::atomic<uint32_t> count_;
+  std::atomic<uint32_t> max_us_;
+};
+
+/// Returns the histogram of the specified operation, aggregated over all
+/// collections.
+const LatencyHistogram& GetLatencyHistogram(LatencyOp op);
+
+/// Clears all histograms.
+void ResetLatencyStats();
+
+/// Logs the count, median, 90th and 99th percentiles, and the maximum of
+/// each operation.
+void LogLatencyStats();
+
+namespace internal {
+
+LatencyHistogram& MutableLatencyHistogram(LatencyOp op);
+
+/// Records the time from construction to destruction.
+class LatencyTimer {
+ public:
+  explicit LatencyTimer(LatencyOp op)
+      : op_(op), start_(std::chrono::steady_clock::now()) {}
+
+  ~LatencyTimer() {
+    MutableLatencyHistogram(op_).record(
+        (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_)
+            .count());
+  }
+
+ private:
+  LatencyOp op_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace internal
+
+}  // namespace roo_prefs
+
+#if ROO_PREFS_LATENCY_STATS
+#define ROO_PREFS_MEASURE_LATENCY(op) \
+  ::roo_prefs::internal::LatencyTimer roo_prefs_latency_timer(op)
+#else
+#define ROO_PREFS_MEASURE_LATENCY(op)
+#endif
@@ -0,0 +1,251 @@
+#pragma once
+
+/// Shared flush scheduling for `LazyWritePref` objects of a collection.
+///
+/// Depends on the "dejwk/roo_scheduler" library.
+
+#include <inttypes.h>
+
+#include <mutex>
+
+#include "roo_prefs/collection.h"
+#include "roo_prefs/transaction.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+
+namespace roo_prefs {
+
+class LazyWriteCoordinator;
+
+namespace internal {
+
+/// Intrusive list node of a lazy-write preference with a pending write.
+class LazyWriteNode {
+ public:
+  LazyWriteNode() : deadline_ms_(0), next_(nullptr), prev_(nullptr) {}
+
+  LazyWriteNode(const LazyWriteNode&) = delete;
+  LazyWriteNode& operator=(const LazyWriteNode&) = delete;
+
+ protected:
+  virtual ~LazyWriteNode() = default;
+
+  /// Writes the pending value to the store. Returns true on success. On
+  /// failure, should set `deadline_ms_` to the time of the next attempt.
+  virtual bool flush() = 0;
+
+  bool is_linked() const { return prev_ != nullptr; }
+
+  // Time (in uptime millis) at which the pending write should be flushed.
+  uint32_t deadline_ms_;
+
+ private:
+  friend class roo_prefs::LazyWriteCoordinator;
+
+  LazyWriteNode* next_;
+  // Points to the list head sentinel for the first node; nullptr if the node
+  // is not linked.
+  LazyWriteNode* prev_;
+};
+
+}  // namespace internal
+
+/// Flushes pending writes of lazy-write preferences, using a single scheduler
+/// task for all preferences of a collection. When the task fires, all
+/// preferences whose writes are due are flushed within one transaction.
+///
+/// @code
+/// roo_prefs::Collection prefs("ui");
+/// roo_prefs::LazyWriteCoordinator lazy_writer(prefs, scheduler);
+/// roo_prefs::LazyUint8 brightness(lazy_writer, "bright", 128);
+/// roo_prefs::LazyUint8 volume(lazy_writer, "volume", 50);
+/// @endcode
+///
+/// The coordinator must outlive the preferences that use it. Preferences
+/// constructed with a collection and a scheduler, rather than with a
+/// coordinator, share one coordinator per such pair, created with the first
+/// of them, and deleted with the last.
+class LazyWriteCoordinator {
+ public:
+  LazyWriteCoordinator(Collection& collection,
+                       roo_scheduler::Scheduler& scheduler)
+      : collection_(collection),
+        task_(scheduler, [this]() { flushDue(); }),
+        head_(),
+        scheduled_ms_(0) {}
+
+  LazyWriteCoordinator(const LazyWriteCoordinator&) = delete;
+  LazyWriteCoordinator& operator=(const LazyWriteCoordinator&) = delete;
+
+  Collection& collection() const { return collection_; }
+
+  /// Returns true if any of the preferences has a pending write.
+  bool hasPendingWrites() const { return head_.next_ != nullptr; }
+
+  /// Immediately writes all pending values, regardless of their deadlines.
+  /// Returns true if all writes succeeded.
+  bool flushAll() { return flush(true); }
+
+ private:
+  template <typename T>
+  friend class LazyWritePref;
+
+  // Sentinel list head.
+  class Head : public internal::LazyWriteNode {
+   private:
+    bool flush() override { return true; }
+  };
+
+  // A coordinator shared by the preferences of a collection and a scheduler.
+  struct Shared;
+
+  static Shared*& SharedList();
+  static internal::Mutex& SharedMutex();
+
+  // Returns the coordinator shared by the collection and the scheduler,
+  // creating it if needed.
+  static LazyWriteCoordinator& AcquireShared(
+      Collection& collection, roo_scheduler::Scheduler& scheduler);
+
+  // Deletes the shared coordinator when its last user releases it.
+  static void ReleaseShared(LazyWriteCoordinator& coordinator);
+
+  static bool IsDue(uint32_t deadline_ms, uint32_t now_ms) {
+    return (int32_t)(deadline_ms - now_ms) <= 0;
+  }
+
+  static uint32_t NowMs() { return roo_time::Uptime::Now().inMillis(); }
+
+  /// Registers a pending write of the node, or updates its deadline.
+  void schedule(internal::LazyWriteNode& node) {
+    if (!node.is_linked()) {
+      node.next_ = head_.next_;
+      node.prev_ = &head_;
+      if (head_.next_ != nullptr) head_.next_->prev_ = &node;
+      head_.next_ = &node;
+    }
+    if (!task_.is_scheduled() || IsDue(node.deadline_ms_, scheduled_ms_)) {
+      scheduleAt(node.deadline_ms_);
+    }
+  }
+
+  /// Removes the pending write of the node, if any.
+  void cancel(internal::LazyWriteNode& node) {
+    if (!node.is_linked()) return;
+    node.prev_->next_ = node.next_;
+    if (node.next_ != nullptr) node.next_->prev_ = node.prev_;
+    node.next_ = nullptr;
+    node.prev_ = nullptr;
+    if (!hasPendingWrites()) task_.cancel();
+  }
+
+  void scheduleAt(uint32_t deadline_ms) {
+    task_.cancel();
+    scheduled_ms_ = deadline_ms;
+    uint32_t now = NowMs();
+    int32_t delay_ms = (int32_t)(deadline_ms - now);
+    task_.scheduleAfter(roo_time::Millis(delay_ms > 0 ? delay_ms : 0),
+                        roo_scheduler::PRIORITY_BACKGROUND);
+  }
+
+  void flushDue() {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    flush(false);
+    internal::LazyWriteNode* node = head_.next_;
+    if (node == nullptr) return;
+    uint32_t earliest = node->deadline_ms_;
+    for (node = node->next_; node != nullptr; node = node->next_) {
+      if (IsDue(node->deadline_ms_, earliest)) earliest = node->deadline_ms_;
+    }
+    scheduleAt(earliest);
+  }
+
+  bool flush(bool all) {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    uint32_t now = NowMs();
+    internal::LazyWriteNode* node = head_.next_;
+    while (node != nullptr && !all && !IsDue(node->deadline_ms_, now)) {
+      node = node->next_;
+    }
+    if (node == nullptr) return true;
+    bool ok = true;
+    Transaction t(collection_);
+    while (node != nullptr) {
+      internal::LazyWriteNode* next = node->next_;
+      if (all || IsDue(node->deadline_ms_, now)) {
+        if (node->flush()) {
+          cancel(*node);
+        } else {
+          ok = false;
+        }
+      }
+      node = next;
+    }
+    return ok;
+  }
+
+  Collection& collection_;
+  roo_scheduler::SingletonTask task_;
+  Head head_;
+  uint32_t scheduled_ms_;
+};
+
+/// Implementation details follow.
+
+struct LazyWriteCoordinator::Shared {
+  Shared(Collection& collection, roo_scheduler::Scheduler& scheduler)
+      : coordinator(collection, scheduler),
+        scheduler(&scheduler),
+        refcount(0),
+        next(nullptr) {}
+
+  LazyWriteCoordinator coordinator;
+  roo_scheduler::Scheduler* scheduler;
+  int refcount;
+  Shared* next;
+};
+
+inline LazyWriteCoordinator::Shared*& LazyWriteCoordinator::SharedList() {
+  static Shared* list = nullptr;
+  return list;
+}
+
+inline internal::Mutex& LazyWriteCoordinator::SharedMutex() {
+  static internal::Mutex mutex;
+  return mutex;
+}
+
+inline LazyWriteCoordinator& LazyWriteCoordinator::AcquireShared(
+    Collection& collection, roo_scheduler::Scheduler& scheduler) {
+  std::lock_guard<internal::Mutex> lock(SharedMutex());
+  Shared* shared = SharedList();
+  for (; shared != nullptr; shared = shared->next) {
+    if (&shared->coordinator.collection_ == &collection &&
+        shared->scheduler == &scheduler) {
+      break;
+    }
+  }
+  if (shared == nullptr) {
+    shared = new Shared(collection, scheduler);
+    shared->next = SharedList();
+    SharedList() = shared;
+  }
+  ++shared->refcount;
+  return shared->coordinator;
+}
+
+inline void LazyWriteCoordinator::ReleaseShared(
+    LazyWriteCoordinator& coordinator) {
+  std::lock_guard<internal::Mutex> lock(SharedMutex());
+  for (Shared** pos = &SharedList(); *pos != nullptr; pos = &(*pos)->next) {
+    Shared* shared = *pos;
+    if (&shared->coordinator != &coordinator) continue;
+    if (--shared->refcount == 0) {
+      *pos = shared->next;
+      delete shared;
+    }
+    return;
+  }
+}
+
+}  // namespace roo_prefs
@@ -6,6 +6,11 @@
 ///
 /// Depends on the "dejwk/roo_scheduler" library.
 
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "roo_prefs/lazy_write_coordinator.h"
 #include "roo_prefs/pref.h"
 #include "roo_scheduler.h"
 #include "roo_time.h"
@@ -16,35 +21,148 @@
 
 namespace roo_prefs {
 
+namespace internal {
+
+// Value of a pending write. Compact values are kept inline; others are
+// allocated only while a write is pending.
+template <typename T, bool inline_value = IsCompact<T>::value>
+class PendingValue {
+ public:
+  PendingValue() : value_() {}
+
+  const T& get() const { return *value_; }
+  T& get() { return *value_; }
+
+  template <typename V>
+  void set(V&& value) {
+    if (value_ == nullptr) {
+      value_.reset(new T(std::forward<V>(value)));
+    } else {
+      *value_ = std::forward<V>(value);
+    }
+  }
+
+  void reset() { value_.reset(); }
+
+ private:
+  std::unique_ptr<T> value_;
+};
+
 template <typename T>
-class LazyWritePref {
+class PendingValue<T, true> {
+ public:
+  PendingValue() : value_() {}
+
+  const T& get() const { return value_; }
+  T& get() { return value_; }
+
+  template <typename V>
+  void set(V&& value) {
+    value_ = std::forward<V>(value);
+  }
+
+  void reset() {}
+
+ private:
+  T value_;
+};
+
+}  // namespace internal
+
+template <typename T>
+class LazyWritePref : private internal::LazyWriteNode {
  public:
   /// Creates a lazy-write preference. The data is flushed to persistent storage
-  /// using `scheduler`, after it has been stable for at least
+  /// by the `coordinator`, after it has been stable for at least
   /// `stable_write_latency` seconds, but no later than
-  /// `unstable_write_latency_s` after the last write.
+  /// `unstable_write_latency_s` after the last write. Preferences sharing a
+  /// coordinator share a single scheduler task, and get flushed together.
+  LazyWritePref(LazyWriteCoordinator& coordinator, const char* key,
+                typename Pref<T>::DefaultType default_value =
+                    typename Pref<T>::DefaultType(),
+                uint8_t stable_write_latency_s = 2,
+                uint8_t unstable_write_latency_s = 10);
+
+  /// Takes the default as a `T`, so that it can be brace-initialized. See
+  /// `Pref::Pref()`.
+  template <typename S = T, typename = typename std::enable_if<
+                                !internal::IsStringLike<S>::value>::type>
+  LazyWritePref(LazyWriteCoordinator& coordinator, const char* key,
+                const T& default_value, uint8_t stable_write_latency_s = 2,
+                uint8_t unstable_write_latency_s = 10)
+      : LazyWritePref(coordinator, key,
+                      typename Pref<T>::DefaultType(default_value),
+                      stable_write_latency_s, unstable_write_latency_s) {}
+
+  /// Creates a lazy-write preference, flushed by a coordinator shared by all
+  /// lazy-write preferences of the collection constructed with the same
+  /// scheduler. The shared coordinator is allocated with the first of them.
   LazyWritePref(Collection& collection, roo_scheduler::Scheduler& scheduler,
-                const char* key, T default_value = T(),
+                const char* key,
+                typename Pref<T>::DefaultType default_value =
+                    typename Pref<T>::DefaultType(),
                 uint8_t stable_write_latency_s = 2,
                 uint8_t unstable_write_latency_s = 10);
 
+  template <typename S = T, typename = typename std::enable_if<
+                                !internal::IsStringLike<S>::value>::type>
+  LazyWritePref(Collection& collection, roo_scheduler::Scheduler& scheduler,
+                const char* key, const T& default_value,
+                uint8_t stable_write_latency_s = 2,
+                uint8_t unstable_write_latency_s = 10)
+      : LazyWritePref(collection, scheduler, key,
+                      typename Pref<T>::DefaultType(default_value),
+                      stable_write_latency_s, unstable_write_latency_s) {}
+
+  ~LazyWritePref() override;
+
+  /// Note: even in thread-safe builds, `isSet()` and `get()` check for the
+  /// pending write without taking the collection lock. Only call them from
+  /// the thread that calls `set()` and runs the scheduler.
   bool isSet() const;
 
+  /// Returns the pending value, if any, or the value of the underlying
+  /// preference. The reference is invalidated by subsequent `set()`,
+  /// `clear()`, and by the flush.
   const T& get() const;
 
   bool set(const T& value);
 
+  /// Like `set()`, but moves the value, rather than copying it. The flush
+  /// moves it again, into the underlying preference.
+  bool set(T&& value);
+
+  /// Returns an editor, holding a copy of the value, to be modified in place
+  /// and set (if changed) when the editor goes out of scope. See
+  /// `Pref::edit()`.
+  PrefEditor<LazyWritePref<T>, T> edit() {
+    return PrefEditor<LazyWritePref<T>, T>(*this, get());
+  }
+
+  /// Calls `fn(T&)` on a copy of the value, and sets it (if changed).
+  template <typename Fn>
+  bool edit(Fn&& fn) {
+    PrefEditor<LazyWritePref<T>, T> editor = edit();
+    fn(*editor);
+    return editor.commit();
+  }
+
   bool clear();
 
  private:
-  bool has_pending_write() const { return flusher_.is_scheduled(); }
-  void maybeFlush();
+  template <typename V>
+  bool write(V&& value);
+
+  bool has_pending_write() const { return is_linked(); }
+  bool flush() override;
 
+  LazyWriteCoordinator& coordinator_;
+  // True if `coordinator_` is shared by collection and scheduler.
+  bool shared_coordinator_;
   Pref<T> pref_;
   uint8_t stable_write_latency_s_;
   uint8_t unstable_write_latency_s_;
-  T pending_write_;
-  roo_scheduler::SingletonTask flusher_;
+  internal::PendingValue<T> pending_write_;
   uint32_t last_write_ms_;
   uint32_t last_change_ms_;
 };
@@ -66,17 +184,38 @@ using LazyString = LazyWritePref<std::string>;
 using LazyArduinoString = LazyWritePref<::String>;
 #endif
 
+template <typename T>
+LazyWritePref<T>::LazyWritePref(LazyWriteCoordinator& coordinator,
+                                const char* key,
+                                typename Pref<T>::DefaultType default_value,
+                                uint8_t stable_write_latency_s,
+                                uint8_t unstable_write_latency_s)
+    : coordinator_(coordinator),
+      shared_coordinator_(false),
+      pref_(coordinator.collection(), key, std::move(default_value)),
+      stable_write_latency_s_(stable_write_latency_s),
+      unstable_write_latency_s_(unstable_write_latency_s),
+      pending_write_(),
+      last_write_ms_(0),
+      last_change_ms_(0) {
+  if (unstable_write_latency_s_ < stable_write_latency_s_) {
+    unstable_write_latency_s_ = stable_write_latency_s_;
+  }
+}
+
 template <typename T>
 LazyWritePref<T>::LazyWritePref(Collection& collection,
                                 roo_scheduler::Scheduler& scheduler,
-                                const char* key, T default_value,
+                                const char* key,
+                                typename Pref<T>::DefaultType default_value,
                                 uint8_t stable_write_latency_s,
                                 uint8_t unstable_write_latency_s)
-    : pref_(collection, key, std::move(default_value)),
+    : coordinator_(LazyWriteCoordinator::AcquireShared(collection, scheduler)),
+      shared_coordinator_(true),
+      pref_(collection, key, std::move(default_value)),
       stable_write_latency_s_(stable_write_latency_s),
       unstable_write_latency_s_(unstable_write_latency_s),
       pending_write_(),
-      flusher_(scheduler, [this]() { maybeFlush(); }),
       last_write_ms_(0),
       last_change_ms_(0) {
   if (unstable_write_latency_s_ < stable_write_latency_s_) {
@@ -84,6 +223,15 @@ LazyWritePref<T>::LazyWritePref(Collection& collection,
   }
 }
 
+template <typename T>
+LazyWritePref<T>::~LazyWritePref() {
+  {
+    std::lock_guard<internal::Mutex> lock(coordinator_.collection().mutex_);
+    coordinator_.cancel(*this);
+  }
+  if (shared_coordinator_) LazyWriteCoordinator::ReleaseShared(coordinator_);
+}
+
 template <typename T>
 bool LazyWritePref<T>::isSet() const {
   return has_pending_write() || pref_.isSet();
@@ -91,46 +239,65 @@ bool LazyWritePref<T>::isSet() const {
 
 template <typename T>
 const T& LazyWritePref<T>::get() const {
-  return has_pending_write() ? pending_write_ : pref_.get();
+  return has_pending_write() ? pending_write_.get() : pref_.get();
 }
 
 template <typename T>
 bool LazyWritePref<T>::set(const T& value) {
+  return write(value);
+}
+
+template <typename T>
+bool LazyWritePref<T>::set(T&& value) {
+  return write(std::move(value));
+}
+
+template <typename T>
+template <typename V>
+bool LazyWritePref<T>::write(V&& value) {
+  std::lock_guard<internal::Mutex> lock(coordinator_.collection().mutex_);
   uint32_t now = roo_time::Uptime::Now().inMillis();
   if (has_pending_write()) {
-    if (pending_write_ == value) return true;
+    if (pending_write_.get() == value) return true;
   } else {
     if (pref_.get() == value) return true;
     last_write_ms_ = now;
-    flusher_.scheduleAfter(roo_time::Seconds(stable_write_latency_s_));
   }
-  pending_write_ = value;
+  pending_write_.set(std::forward<V>(value));
   last_change_ms_ = now;
+  // Flush once the value has been stable for a while, but no later than the
+  // unstable latency after it first changed.
+  uint32_t stable_deadline = last_change_ms_ + stable_write_latency_s_ * 1000;
+  uint32_t unstable_deadline =
+      last_write_ms_ + unstable_write_latency_s_ * 1000;
+  deadline_ms_ = ((int32_t)(unstable_deadline - stable_deadline) < 0)
+                     ? unstable_deadline
+                     : stable_deadline;
+  coordinator_.schedule(*this);
   return true;
 }
 
 template <typename T>
-void LazyWritePref<T>::maybeFlush() {
+bool LazyWritePref<T>::flush() {
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kLazyFlush);
   uint32_t now = roo_time::Uptime::Now().inMillis();
-  uint32_t ms_elapsed_since_last_write_s = (now - last_write_ms_) / 1000;
-  uint32_t ms_elapsed_since_last_change_s = (now - last_change_ms_) / 1000;
-  if (ms_elapsed_since_last_write_s >= unstable_write_latency_s_ ||
-      ms_elapsed_since_last_change_s >= stable_write_latency_s_) {
-    if (pref_.set(pending_write_)) {
-      last_write_ms_ = now;
-      return;
-    }
+  // If the write fails, the value is left intact, to be retried.
+  if (pref_.set(std::move(pending_write_.get()))) {
+    pending_write_.reset();
+    last_write_ms_ = now;
+    return true;
   }
-  /// Reschedule the update.
-  flusher_.scheduleAfter(roo_time::Seconds(stable_write_latency_s_),
-                         roo_scheduler::PRIORITY_BACKGROUND);
+  /// Retry later.
+  deadline_ms_ = now + stable_write_latency_s_ * 1000;
+  return false;
 }
 
 template <typename T>
 bool LazyWritePref<T>::clear() {
+  std::lock_guard<internal::Mutex> lock(coordinator_.collection().mutex_);
   if (!pref_.clear()) return false;
-  flusher_.cancel();
-  pending_write_ = pref_.get();
+  coordinator_.cancel(*this);
+  pending_write_.reset();
   uint32_t now = roo_time::Uptime::Now().inMillis();
   last_write_ms_ = now;
   last_change_ms_ = now;
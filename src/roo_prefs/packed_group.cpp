@@ -0,0 +1,197 @@
+#include "roo_prefs/packed_group.h"
+
+#include "roo_logging.h"
+#include "roo_prefs/transaction.h"
+
+namespace roo_prefs {
+
+namespace {
+
+uint32_t GetBits(const std::vector<uint8_t>& data, uint16_t offset,
+                 uint8_t width) {
+  uint32_t result = 0;
+  for (uint8_t i = 0; i < width; ++i) {
+    uint16_t bit = offset + i;
+    if (data[bit / 8] & (1 << (bit % 8))) result |= ((uint32_t)1 << i);
+  }
+  return result;
+}
+
+void SetBits(std::vector<uint8_t>& data, uint16_t offset, uint8_t width,
+             uint32_t value) {
+  for (uint8_t i = 0; i < width; ++i) {
+    uint16_t bit = offset + i;
+    if (value & ((uint32_t)1 << i)) {
+      data[bit / 8] |= (1 << (bit % 8));
+    } else {
+      data[bit / 8] &= ~(1 << (bit % 8));
+    }
+  }
+}
+
+// Sets the 'set' bit and the value bits of the field. The value bits of
+// cleared fields are zeroed, so that the blob does not depend on the history.
+void SetField(std::vector<uint8_t>& data, uint16_t offset, uint8_t width,
+              bool set, uint32_t value) {
+  SetBits(data, offset, 1, set ? 1 : 0);
+  SetBits(data, offset + 1, width, set ? value : 0);
+}
+
+}  // namespace
+
+class PackedGroup::BatchedWrite : public internal::BatchedOp {
+ public:
+  explicit BatchedWrite(PackedGroup& group)
+      : internal::BatchedOp(group.key_), group_(group) {}
+
+  bool write(Store& store) override {
+    return store.writeBytes(group_.key_, &group_.pending_[0],
+                            group_.pending_.size()) == WriteResult::kOk;
+  }
+
+  void finish(bool ok) override {
+    group_.batched_ = false;
+    if (ok) group_.data_.swap(group_.pending_);
+    group_.pending_.clear();
+  }
+
+ private:
+  PackedGroup& group_;
+};
+
+PackedGroup::PackedGroup(Collection& collection, const char* key)
+    : internal::PrefNode(key),
+      collection_(collection),
+      bits_(0),
+      state_(State::kUnknown),
+      backoff_(),
+      batched_(false),
+      data_(),
+      pending_() {
+  collection_.registerPref(*this);
+}
+
+PackedGroup::~PackedGroup() {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  if (batched_) collection_.cancelPending(key_);
+  collection_.unregisterPref(*this);
+}
+
+uint16_t PackedGroup::addField(uint8_t width) {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  uint16_t offset = bits_;
+  bits_ += 1 + width;
+  // Fields declared after the blob has been loaded start unset.
+  if (data_.size() < byteSize()) data_.resize(byteSize(), 0);
+  return offset;
+}
+
+bool PackedGroup::read(uint16_t offset, uint8_t width, uint32_t& value) {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  sync();
+  if (GetBits(data_, offset, 1) == 0) return false;
+  value = GetBits(data_, offset + 1, width);
+  return true;
+}
+
+bool PackedGroup::write(uint16_t offset, uint8_t width, bool set,
+                        uint32_t value) {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  // Writing a blob built from incomplete data would lose the other values,
+  // so the read is retried regardless of the backoff.
+  if (state_ != State::kLoaded) reload();
+  if (state_ != State::kLoaded) return false;
+  if (collection_.batching()) {
+    if (!batched_) pending_ = data_;
+    SetField(pending_, offset, width, set, value);
+    if (pending_ == data_) {
+      if (batched_) collection_.cancelPending(key_);
+      batched_ = false;
+      pending_.clear();
+      collection_.store_.onWriteSuppressed(key_);
+    } else if (!batched_) {
+      collection_.enqueue(
+          std::unique_ptr<internal::BatchedOp>(new BatchedWrite(*this)));
+      batched_ = true;
+    }
+    return true;
+  }
+  uint32_t old_set = GetBits(data_, offset, 1);
+  uint32_t old_value = GetBits(data_, offset + 1, width);
+  SetField(data_, offset, width, set, value);
+  if (old_set == GetBits(data_, offset, 1) &&
+      old_value == GetBits(data_, offset + 1, width)) {
+    collection_.store_.onWriteSuppressed(key_);
+    return true;
+  }
+  Transaction t(collection_);
+  if (t.active() && t.store().writeBytes(key_, &data_[0], data_.size()) ==
+                        WriteResult::kOk) {
+    return true;
+  }
+  SetField(data_, offset, width, old_set != 0, old_value);
+  return false;
+}
+
+void PackedGroup::sync() {
+  if (state_ == State::kLoaded) return;
+  if (state_ == State::kError && collection_.skipRead(backoff_)) return;
+  reload();
+}
+
+void PackedGroup::reload() {
+  Transaction t(collection_, Transaction::Mode::kReadOnly);
+  load(t.active() ? &t.store() : nullptr);
+}
+
+bool PackedGroup::load(Store* store) {
+  data_.assign(byteSize(), 0);
+  if (store == nullptr || data_.empty()) {
+    state_ = State::kLoaded;
+    backoff_.reset();
+    return true;
+  }
+  size_t len = 0;
+  ReadResult result = store->readBytesLength(key_, &len);
+  if (result == ReadResult::kOk) {
+    // The blob may be longer if preferences have been removed from the end
+    // of the group; the excess is dropped on the next write.
+    if (len > data_.size()) data_.resize(len, 0);
+    result = store->readBytes(key_, &data_[0], len, &len);
+    data_.resize(byteSize());
+  }
+  switch (result) {
+    case ReadResult::kOk:
+    case ReadResult::kNotFound: {
+      state_ = State::kLoaded;
+      backoff_.reset();
+      return true;
+    }
+    case ReadResult::kWrongType: {
+      LOG(WARNING) << "Preference group " << key_
+                   << " has the wrong type; ignoring the stored value";
+      data_.assign(byteSize(), 0);
+      state_ = State::kLoaded;
+      backoff_.reset();
+      return true;
+    }
+    default: {
+      data_.assign(byteSize(), 0);
+      state_ = State::kError;
+      collection_.onReadError(backoff_);
+      return false;
+    }
+  }
+}
+
+bool PackedGroup::preload(Store* store) {
+  if (state_ == State::kLoaded) return true;
+  return load(store);
+}
+
+void PackedGroup::invalidate() {
+  backoff_.reset();
+  state_ = State::kUnknown;
+}
+
+}  // namespace roo_prefs
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "roo_prefs/collection.h"
+
+namespace roo_prefs {
+
+/// Group of small preferences (booleans and integers of up to 32 bits),
+/// stored together in a single blob, under a single key of the collection.
+/// Each preference takes a 'set' bit, plus one bit (for `bool`) or its bit
+/// width, rather than an NVS entry of its own. Changing one of them rewrites
+/// the (small) blob, in a single write.
+///
+/// The preferences are assigned to bit positions in the order in which they
+/// are constructed. Declare them right after the group, in one place, and add
+/// new ones only at the end; reordering or removing them invalidates the
+/// stored values.
+///
+/// @code
+/// roo_prefs::Collection col("ui");
+/// roo_prefs::PackedGroup toggles(col, "toggles");
+/// roo_prefs::PackedBool show_clock(toggles, true);
+/// roo_prefs::PackedBool show_date(toggles);
+/// roo_prefs::PackedUint8 brightness(toggles, 128);
+/// @endcode
+///
+/// The group caches the blob, and reads it on first access of any of its
+/// preferences. If the blob can't be read because of a storage error, the
+/// preferences return their defaults, and `set()` and `clear()` fail, so that
+/// the other values do not get overwritten; the read is retried as per the
+/// collection's `ErrorPolicy`, and on each `set()` and `clear()`. Inside a
+/// `Transaction::Mode::kBatched` transaction, changes to the group are
+/// written together, once.
+class PackedGroup : private internal::PrefNode {
+ public:
+  PackedGroup(Collection& collection, const char* key);
+
+  ~PackedGroup() override;
+
+  /// Returns the size of the blob, in bytes, given the preferences declared
+  /// so far.
+  size_t byteSize() const { return (bits_ + 7) / 8; }
+
+ private:
+  template <typename T>
+  friend class PackedPref;
+
+  class BatchedWrite;
+
+  enum class State : uint8_t { kUnknown, kLoaded, kError };
+
+  // Reserves a field of `width` value bits, preceded by its 'set' bit.
+  // Returns the offset of the 'set' bit.
+  uint16_t addField(uint8_t width);
+
+  // Returns true if the field is set, in which case also stores its value
+  // bits in `value`.
+  bool read(uint16_t offset, uint8_t width, uint32_t& value);
+
+  // Sets (or, if `set` is false, clears) the field, and writes the blob.
+  bool write(uint16_t offset, uint8_t width, bool set, uint32_t value);
+
+  // Reads the blob unless cached, or skipped because of the read backoff
+  // (see `ErrorPolicy`). Must be called with the collection lock held.
+  void sync();
+
+  // Reads the blob. Must be called with the collection lock held.
+  void reload();
+
+  bool load(Store* store);
+
+  bool preload(Store* store) override;
+
+  void invalidate() override;
+
+  Collection& collection_;
+  uint16_t bits_;
+  State state_;
+  internal::ReadBackoff backoff_;
+  // True while a batched write of the group is queued.
+  bool batched_;
+  std::vector<uint8_t> data_;
+  // Contents to be written by the queued batched write.
+  std::vector<uint8_t> pending_;
+};
+
+namespace internal {
+
+template <typename T>
+struct PackedTraits {
+  static_assert(std::is_integral<T>::value && sizeof(T) <= 4,
+                "Only bool and integers of up to 32 bits can be packed");
+
+  static constexpr uint8_t kWidth = sizeof(T) * 8;
+
+  static uint32_t ToBits(T value) {
+    return (typename std::make_unsigned<T>::type)value;
+  }
+
+  static T FromBits(uint32_t bits) {
+    return (T)(typename std::make_unsigned<T>::type)bits;
+  }
+};
+
+template <>
+struct PackedTraits<bool> {
+  static constexpr uint8_t kWidth = 1;
+
+  static uint32_t ToBits(bool value) { return value ? 1 : 0; }
+
+  static bool FromBits(uint32_t bits) { return bits != 0; }
+};
+
+}  // namespace internal
+
+/// Preference stored in a `PackedGroup`. Has the same semantics as `Pref<T>`,
+/// except that `get()` returns the value rather than a reference.
+template <typename T>
+class PackedPref {
+ public:
+  explicit PackedPref(PackedGroup& group, T default_value = T())
+      : group_(group),
+        offset_(group.addField(internal::PackedTraits<T>::kWidth)),
+        default_value_(default_value) {}
+
+  PackedPref(const PackedPref&) = delete;
+  PackedPref& operator=(const PackedPref&) = delete;
+
+  bool isSet() const {
+    uint32_t bits;
+    return group_.read(offset_, internal::PackedTraits<T>::kWidth, bits);
+  }
+
+  T get() const {
+    uint32_t bits;
+    return group_.read(offset_, internal::PackedTraits<T>::kWidth, bits)
+               ? internal::PackedTraits<T>::FromBits(bits)
+               : default_value_;
+  }
+
+  bool set(T value) {
+    return group_.write(offset_, internal::PackedTraits<T>::kWidth, true,
+                        internal::PackedTraits<T>::ToBits(value));
+  }
+
+  bool clear() {
+    return group_.write(offset_, internal::PackedTraits<T>::kWidth, false, 0);
+  }
+
+ private:
+  PackedGroup& group_;
+  uint16_t offset_;
+  T default_value_;
+};
+
+using PackedBool = PackedPref<bool>;
+using PackedUint8 = PackedPref<uint8_t>;
+using PackedInt8 = PackedPref<int8_t>;
+using PackedUint16 = PackedPref<uint16_t>;
+using PackedInt16 = PackedPref<int16_t>;
+using PackedUint32 = PackedPref<uint32_t>;
+using PackedInt32 = PackedPref<int32_t>;
+
+}  // namespace roo_prefs
@@ -1,17 +1,64 @@
 #pragma once
 
 #include <inttypes.h>
+#include <string.h>
 
+#include <memory>
+#include <mutex>
 #include <string>
+#include <type_traits>
+#include <utility>
 
 #include "roo_prefs/collection.h"
 #include "roo_prefs/serialization.h"
 #include "roo_prefs/status.h"
 #include "roo_prefs/transaction.h"
+#include "roo_prefs/impl/default_value.h"
+#include "roo_prefs/impl/sync.h"
 #include "roo_prefs/impl/value_holder.h"
 
 namespace roo_prefs {
 
+/// Modifiable copy of the value of a preference `P` (`Pref<T>` or
+/// `LazyWritePref<T>`), returned by its `edit()`. The value is written back
+/// with `set()`, which skips the write if nothing has changed, when the
+/// editor goes out of scope (or on `commit()`). Changes made to the
+/// preference in the meantime get overwritten.
+template <typename P, typename T>
+class PrefEditor {
+ public:
+  PrefEditor(P& pref, T value) : pref_(&pref), value_(std::move(value)) {}
+
+  PrefEditor(PrefEditor&& other)
+      : pref_(other.pref_), value_(std::move(other.value_)) {
+    other.pref_ = nullptr;
+  }
+
+  PrefEditor(const PrefEditor&) = delete;
+  PrefEditor& operator=(const PrefEditor&) = delete;
+
+  ~PrefEditor() { commit(); }
+
+  T& operator*() { return value_; }
+  T* operator->() { return &value_; }
+
+  /// Writes the value back now. Returns the result of `set()`. The editor
+  /// can't be used afterwards.
+  bool commit() {
+    if (pref_ == nullptr) return false;
+    P* pref = pref_;
+    pref_ = nullptr;
+    return pref->set(std::move(value_));
+  }
+
+  /// Discards the changes.
+  void cancel() { pref_ = nullptr; }
+
+ private:
+  P* pref_;
+  T value_;
+};
+
 /// Persistent preference of a specific type.
 /// The preference will store its value in the preferences collection provided
 /// in the constructor, under the specified key (which needs to remain
@@ -34,6 +81,13 @@ namespace roo_prefs {
 ///   b = pref2.get();
 /// }
 ///
+/// Inside a `Transaction::Mode::kBatched` transaction, `set()` and `clear()`
+/// only queue the change and return true; see `Transaction`.
+///
+/// In thread-safe builds (see `Collection`), a preference can be used from
+/// multiple threads. Use `load()` rather than `get()` if other threads may
+/// modify the preference concurrently.
+///
 /// For simple types, use aliases defined later in the file (Uint8, String,
 /// etc.)
 ///
@@ -50,28 +104,118 @@ namespace roo_prefs {
 /// objects using this template.
 ///
 template <typename T>
-class Pref {
+class Pref : private internal::PrefNode {
  public:
-  Pref(Collection& collection, const char* key, T default_value = T());
+  /// The default value. Besides a value of type `T`, can be given as
+  /// `StaticDefault(constant)` or `GeneratedDefault(function)`, which avoid
+  /// keeping a copy. For string types, can also be a `const char*`, which is
+  /// copied, or `StaticDefault("literal")`, which is referenced instead.
+  using DefaultType = internal::DefaultValue<T>;
+
+  Pref(Collection& collection, const char* key,
+       DefaultType default_value = DefaultType());
+
+  /// Takes the default as a `T`, so that it can be brace-initialized, e.g.
+  /// `Pref<Point> origin(col, "origin", {0, 0})`. (String types take
+  /// character strings, through `DefaultType`, instead.)
+  template <typename S = T, typename = typename std::enable_if<
+                                !internal::IsStringLike<S>::value>::type>
+  Pref(Collection& collection, const char* key, const T& default_value)
+      : Pref(collection, key, DefaultType(default_value)) {}
+
+  ~Pref() override;
 
   bool isSet() const;
 
+  /// Returns a reference to the cached value. The value is read from the
+  /// store on first access.
   const T& get() const;
 
+  /// Returns a copy of the value. Unlike `get()`, safe to call while other
+  /// threads modify the preference. Once the value is cached, and if `T` is
+  /// trivially copyable (e.g. a scalar), does not take the collection lock.
+  T load() const;
+
   template <typename V = T>
   bool set(const V& value);
 
+  /// Like `set()`, but moves the value into the cache, rather than copying
+  /// it. If the write fails, `value` is left intact.
+  bool set(T&& value);
+
+  /// Returns an editor, holding a copy of the value, to be modified in place
+  /// and written back (if changed) when the editor goes out of scope:
+  ///
+  ///   {
+  ///     auto config = pref.edit();
+  ///     config->brightness = 80;
+  ///     config->name = "Kitchen";
+  ///   }
+  ///
+  /// This writes once, rather than once per modified field.
+  PrefEditor<Pref<T>, T> edit() {
+    return PrefEditor<Pref<T>, T>(*this, load());
+  }
+
+  /// Calls `fn(T&)` on a copy of the value, and writes it back (if changed).
+  /// Returns the result of the write.
+  template <typename Fn>
+  bool edit(Fn&& fn) {
+    PrefEditor<Pref<T>, T> editor = edit();
+    fn(*editor);
+    return editor.commit();
+  }
+
   bool clear();
 
  private:
-  enum class PrefState { kUnknown, kUnset, kSet, kError };
+  enum class PrefState : uint8_t { kUnknown, kUnset, kSet, kError };
+
+  class BatchedWrite;
+  class BatchedClear;
+
+  static bool IsSynced(PrefState state) {
+    return state == PrefState::kSet || state == PrefState::kUnset;
+  }
 
   void sync() const;
 
+  template <typename V>
+  bool write(V&& value);
+
+  // Reads the value from the store, or marks the preference unset if the
+  // store is null. Returns false if the read failed. Must be called with the
+  // collection lock held.
+  bool load(Store* store) const;
+
+  bool preload(Store* store) override;
+
+  void invalidate() override;
+
+  // Updates the cached value, and then publishes the new state. Must be
+  // called with the collection lock held.
+  template <typename V>
+  void update(PrefState state, V&& value) const;
+
+  // Like `update()`, but sets the cached value to the default.
+  void updateToDefault(PrefState state) const;
+
+  void setError() const {
+    state_.store(PrefState::kError, std::memory_order_release);
+  }
+
+  // Applies the collection's error policy after a failed read.
+  void onReadError() const;
+
+  T loadCached(std::true_type trivially_copyable) const;
+  T loadCached(std::false_type trivially_copyable) const;
+
   Collection& collection_;
-  const char* key_;
-  T default_value_;
-  mutable PrefState state_;
+  DefaultType default_value_;
+  mutable internal::Atomic<PrefState> state_;
+  // Lets `load()` copy the value without holding the collection lock.
+  mutable internal::SeqCount seq_;
+  mutable internal::ReadBackoff backoff_;
   mutable internal::ValueHolder<T> value_;
 };
 
@@ -95,20 +239,84 @@ using ArduinoString = Pref<::String>;
 
 using String = StdString;
 
+/// String preference of up to `N` characters, with inline storage.
+template <size_t N>
+using FixedStringPref = Pref<FixedString<N>>;
+
 /// Implementation details follow.
 
 template <typename T>
-Pref<T>::Pref(Collection& collection, const char* key, T default_value)
-    : collection_(collection),
-      key_(key),
+class Pref<T>::BatchedWrite : public internal::BatchedOp {
+ public:
+  template <typename V>
+  BatchedWrite(Pref<T>& pref, V&& value)
+      : internal::BatchedOp(pref.key_),
+        pref_(pref),
+        value_(std::forward<V>(value)) {}
+
+  bool write(Store& store) override {
+    return StoreWrite(store, pref_.key_, value_.get()) == WriteResult::kOk;
+  }
+
+  void finish(bool ok) override {
+    if (ok) {
+      pref_.update(PrefState::kSet, std::move(value_.get()));
+    } else {
+      pref_.setError();
+    }
+  }
+
+ private:
+  Pref<T>& pref_;
+  internal::ValueHolder<T> value_;
+};
+
+template <typename T>
+class Pref<T>::BatchedClear : public internal::BatchedOp {
+ public:
+  BatchedClear(Pref<T>& pref) : internal::BatchedOp(pref.key_), pref_(pref) {}
+
+  bool write(Store& store) override {
+    return StoreClear(store, pref_.key_) == ClearResult::kOk;
+  }
+
+  void finish(bool ok) override {
+    if (ok) {
+      pref_.updateToDefault(PrefState::kUnset);
+    } else {
+      pref_.setError();
+    }
+  }
+
+ private:
+  Pref<T>& pref_;
+};
+
+template <typename T>
+Pref<T>::Pref(Collection& collection, const char* key,
+              DefaultType default_value)
+    : internal::PrefNode(key),
+      collection_(collection),
       default_value_(std::move(default_value)),
       state_(PrefState::kUnknown),
-      value_(default_value) {}
+      seq_(),
+      backoff_(),
+      value_(default_value_.value()) {
+  collection_.registerPref(*this);
+}
+
+template <typename T>
+Pref<T>::~Pref() {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  // Pending batched operations refer to this preference.
+  collection_.cancelPending(key_);
+  collection_.unregisterPref(*this);
+}
 
 template <typename T>
 bool Pref<T>::isSet() const {
   sync();
-  return (state_ == PrefState::kSet);
+  return (state_.load(std::memory_order_acquire) == PrefState::kSet);
 }
 
 template <typename T>
@@ -117,27 +325,78 @@ const T& Pref<T>::get() const {
   return value_.get();
 }
 
+template <typename T>
+T Pref<T>::load() const {
+  sync();
+  return loadCached(std::integral_constant<
+                    bool, std::is_trivially_copyable<T>::value>());
+}
+
+template <typename T>
+T Pref<T>::loadCached(std::true_type) const {
+  // While unset, the cache holds the default, so there is no need to
+  // materialize it again.
+  uint32_t token = seq_.beginRead();
+  T result(value_.get());
+  while (seq_.retryRead(token)) {
+    token = seq_.beginRead();
+    memcpy(&result, &value_.get(), sizeof(T));
+  }
+  return result;
+}
+
+template <typename T>
+T Pref<T>::loadCached(std::false_type) const {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  return value_.get();
+}
+
 template <typename T>
 template <typename V>
 bool Pref<T>::set(const V& value) {
-  sync();
-  if (state_ == PrefState::kSet && value_.equals(value)) {
+  return write(value);
+}
+
+template <typename T>
+bool Pref<T>::set(T&& value) {
+  return write(std::move(value));
+}
+
+template <typename T>
+template <typename V>
+bool Pref<T>::write(V&& value) {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  // In the error state, the write does not need the stored value, so it
+  // neither waits for the read backoff, nor counts toward it.
+  if (!backoff_.active()) sync();
+  PrefState state = state_.load(std::memory_order_relaxed);
+  if (collection_.batching()) {
+    if (state == PrefState::kSet && value_.equals(value)) {
+      collection_.cancelPending(key_);
+      collection_.store_.onWriteSuppressed(key_);
+    } else {
+      collection_.enqueue(std::unique_ptr<internal::BatchedOp>(
+          new BatchedWrite(*this, std::forward<V>(value))));
+    }
+    return true;
+  }
+  if (state == PrefState::kSet && value_.equals(value)) {
+    collection_.store_.onWriteSuppressed(key_);
     return true;
   }
   Transaction t(collection_);
   if (!t.active()) {
-    state_ = PrefState::kError;
+    setError();
     return false;
   }
   switch (StoreWrite(t.store(), key_,
                      internal::ValueHolder<T>::Assignable(value))) {
     case WriteResult::kOk: {
-      value_.set(value);
-      state_ = PrefState::kSet;
+      update(PrefState::kSet, std::forward<V>(value));
       return true;
     }
     default: {
-      state_ = PrefState::kError;
+      setError();
       return false;
     }
   }
@@ -145,23 +404,34 @@ bool Pref<T>::set(const V& value) {
 
 template <typename T>
 bool Pref<T>::clear() {
-  sync();
-  if (state_ == PrefState::kUnset) {
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  // See `write()`.
+  if (!backoff_.active()) sync();
+  PrefState state = state_.load(std::memory_order_relaxed);
+  if (collection_.batching()) {
+    if (state == PrefState::kUnset) {
+      collection_.cancelPending(key_);
+    } else {
+      collection_.enqueue(
+          std::unique_ptr<internal::BatchedOp>(new BatchedClear(*this)));
+    }
+    return true;
+  }
+  if (state == PrefState::kUnset) {
     return true;
   }
   Transaction t(collection_);
   if (!t.active()) {
-    state_ = PrefState::kError;
+    setError();
     return false;
   }
   switch (StoreClear(t.store(), key_)) {
     case ClearResult::kOk: {
-      state_ = PrefState::kUnset;
-      value_.set(default_value_);
+      updateToDefault(PrefState::kUnset);
       return true;
     }
     default: {
-      state_ = PrefState::kError;
+      setError();
       return false;
     }
   }
@@ -169,29 +439,83 @@ bool Pref<T>::clear() {
 
 template <typename T>
 void Pref<T>::sync() const {
-  if (state_ == PrefState::kUnknown || state_ == PrefState::kError) {
-    Transaction t(collection_, Transaction::Mode::kReadOnly);
-    if (!t.active()) {
-      state_ = PrefState::kUnset;
-      value_.set(default_value_);
-      return;
+  if (IsSynced(state_.load(std::memory_order_acquire))) return;
+  std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+  PrefState state = state_.load(std::memory_order_relaxed);
+  // Another thread might have synced the value while we waited for the lock.
+  if (IsSynced(state)) return;
+  if (state == PrefState::kError && collection_.skipRead(backoff_)) return;
+  Transaction t(collection_, Transaction::Mode::kReadOnly);
+  load(t.active() ? &t.store() : nullptr);
+}
+
+template <typename T>
+bool Pref<T>::load(Store* store) const {
+  if (store == nullptr) {
+    updateToDefault(PrefState::kUnset);
+    return true;
+  }
+  seq_.beginWrite();
+  ReadResult result = StoreRead(*store, key_, value_.get());
+  seq_.endWrite();
+  switch (result) {
+    case ReadResult::kOk: {
+      backoff_.reset();
+      state_.store(PrefState::kSet, std::memory_order_release);
+      return true;
     }
-    switch (StoreRead(t.store(), key_, value_.get())) {
-      case ReadResult::kOk: {
-        state_ = PrefState::kSet;
-        return;
-      }
-      case ReadResult::kNotFound: {
-        state_ = PrefState::kUnset;
-        value_.set(default_value_);
-        return;
-      }
-      default: {
-        state_ = PrefState::kError;
-        return;
-      }
+    case ReadResult::kNotFound: {
+      updateToDefault(PrefState::kUnset);
+      return true;
+    }
+    default: {
+      onReadError();
+      return false;
     }
   }
 }
 
+template <typename T>
+bool Pref<T>::preload(Store* store) {
+  if (IsSynced(state_.load(std::memory_order_relaxed))) return true;
+  return load(store);
+}
+
+template <typename T>
+void Pref<T>::invalidate() {
+  backoff_.reset();
+  state_.store(PrefState::kUnknown, std::memory_order_release);
+}
+
+template <typename T>
+template <typename V>
+void Pref<T>::update(PrefState state, V&& value) const {
+  seq_.beginWrite();
+  value_.set(std::forward<V>(value));
+  seq_.endWrite();
+  backoff_.reset();
+  state_.store(state, std::memory_order_release);
+}
+
+template <typename T>
+void Pref<T>::updateToDefault(PrefState state) const {
+  seq_.beginWrite();
+  default_value_.assignTo(value_);
+  seq_.endWrite();
+  backoff_.reset();
+  state_.store(state, std::memory_order_release);
+}
+
+template <typename T>
+void Pref<T>::onReadError() const {
+  const ErrorPolicy& policy = collection_.errorPolicy();
+  if (policy.fallback_to_default) {
+    seq_.beginWrite();
+    default_value_.assignTo(value_);
+    seq_.endWrite();
+  }
+  collection_.onReadError(backoff_);
+  setError();
+}
+
 }  // namespace roo_prefs
\ No newline at end of file
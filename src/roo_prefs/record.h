@@ -0,0 +1,312 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+#include "roo_logging.h"
+#include "roo_prefs/collection.h"
+#include "roo_prefs/impl/write_batch.h"
+#include "roo_prefs/pref.h"
+#include "roo_prefs/transaction.h"
+
+namespace roo_prefs {
+
+/// Describes a field of a `Record` type. Use `ROO_PREFS_FIELD` to declare it.
+struct FieldInfo {
+  const char* name;
+  uint16_t offset;
+  uint16_t size;
+  /// 'b' for bool, 'i' / 'u' for signed / unsigned integers, 'f' for floating
+  /// point, and 'x' for anything else.
+  char kind;
+};
+
+namespace internal {
+
+template <typename F>
+constexpr char FieldKind() {
+  return std::is_same<F, bool>::value        ? 'b'
+         : std::is_floating_point<F>::value ? 'f'
+         : !std::is_integral<F>::value      ? 'x'
+         : std::is_signed<F>::value         ? 'i'
+                                            : 'u';
+}
+
+constexpr uint32_t HashByte(uint32_t hash, uint8_t byte) {
+  return (hash ^ byte) * 16777619u;
+}
+
+constexpr uint32_t HashU32(uint32_t hash, uint32_t value) {
+  return HashByte(HashByte(HashByte(HashByte(hash, value & 0xFF),
+                                    (value >> 8) & 0xFF),
+                           (value >> 16) & 0xFF),
+                  value >> 24);
+}
+
+}  // namespace internal
+
+/// Returns the FNV-1a hash of the field names, kinds, offsets and sizes, and
+/// of the record size. Changes whenever the layout of the record does.
+template <size_t N>
+constexpr uint32_t SchemaHash(const FieldInfo (&fields)[N],
+                              size_t record_size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < N; ++i) {
+    for (const char* c = fields[i].name; *c != '\0'; ++c) {
+      hash = internal::HashByte(hash, (uint8_t)*c);
+    }
+    hash = internal::HashByte(hash, 0);
+    hash = internal::HashByte(hash, (uint8_t)fields[i].kind);
+    hash = internal::HashU32(hash, fields[i].offset);
+    hash = internal::HashU32(hash, fields[i].size);
+  }
+  return internal::HashU32(hash, (uint32_t)record_size);
+}
+
+/// Returns false if the fields leave a gap in the record that cannot be
+/// padding, i.e. a gap of at least `record_align` bytes, which means that the
+/// schema is missing a field. (Gaps shorter than that, e.g. a missing `bool`
+/// next to an `int32_t`, cannot be told apart from padding.)
+template <size_t N>
+constexpr bool SchemaCoversRecord(const FieldInfo (&fields)[N],
+                                  size_t record_size, size_t record_align) {
+  size_t covered = 0;
+  while (covered < record_size) {
+    // Extend the covered prefix by the fields that start within it, or else
+    // skip to the start of the next field.
+    size_t extent = covered;
+    size_t next = record_size;
+    for (size_t i = 0; i < N; ++i) {
+      size_t begin = fields[i].offset;
+      size_t end = begin + fields[i].size;
+      if (begin <= covered) {
+        if (end > extent) extent = end;
+      } else if (begin < next) {
+        next = begin;
+      }
+    }
+    if (extent > covered) {
+      covered = extent;
+      continue;
+    }
+    if (next - covered >= record_align) return false;
+    covered = next;
+  }
+  return true;
+}
+
+/// Declares a field of a `Record` type, for use in its schema.
+#define ROO_PREFS_FIELD(type, field)                                     \
+  ::roo_prefs::FieldInfo {                                               \
+    #field, (uint16_t)offsetof(type, field),                             \
+        (uint16_t)sizeof(((type*)nullptr)->field),                       \
+        ::roo_prefs::internal::FieldKind<decltype(type::field)>()        \
+  }
+
+namespace internal {
+
+// Copies the bytes of the specified fields of an object of `size` bytes, and
+// zeroes all other bytes (i.e. the padding) of the destination.
+inline void CopyFields(void* dst, const void* src, size_t size,
+                       const FieldInfo* fields, size_t field_count) {
+  memset(dst, 0, size);
+  for (size_t i = 0; i < field_count; ++i) {
+    if (fields[i].offset + fields[i].size > size) continue;
+    memcpy(static_cast<uint8_t*>(dst) + fields[i].offset,
+           static_cast<const uint8_t*>(src) + fields[i].offset,
+           fields[i].size);
+  }
+}
+
+// The stored representation of a record: the schema hash, followed by the
+// record itself. Only the bytes of the fields listed in the schema are
+// copied; all other bytes (the padding, both between the hash and the record,
+// and within the record) are zeroed. Equal records thus have equal bytes, and
+// can be compared with `memcmp`.
+template <typename T>
+struct Stamped {
+  Stamped() { memset(static_cast<void*>(this), 0, sizeof(*this)); }
+
+  Stamped(uint32_t hash, const T& value, const FieldInfo* fields,
+          size_t field_count)
+      : Stamped() {
+    this->hash = hash;
+    CopyFields(&this->value, &value, sizeof(T), fields, field_count);
+  }
+
+  bool operator==(const Stamped& other) const {
+    return memcmp(this, &other, sizeof(*this)) == 0;
+  }
+
+  uint32_t hash;
+  T value;
+};
+
+// Reads the record, treating records stored with a different layout as
+// absent. `val.hash` must be set to the expected hash.
+template <typename T>
+ReadResult StoreRead(Store& store, const char* key, Stamped<T>& val) {
+  Stamped<T> stored;
+  size_t size = 0;
+  ReadResult result = store.readBytes(key, &stored, sizeof(stored), &size);
+  if (result == ReadResult::kOk) {
+    if (size == sizeof(stored) && stored.hash == val.hash) {
+      val = stored;
+      return ReadResult::kOk;
+    }
+  } else if (result != ReadResult::kError || size <= sizeof(stored)) {
+    // Stores report the actual size of values that do not fit; other errors
+    // are genuine.
+    return result;
+  }
+  LOG(WARNING) << "Record " << key
+               << " has been stored with a different layout; ignoring";
+  return ReadResult::kNotFound;
+}
+
+// Removes a record that reads as unset, but might have been stored with a
+// different layout.
+class StaleRecordClear : public BatchedOp {
+ public:
+  explicit StaleRecordClear(const char* key) : BatchedOp(key) {}
+
+  bool write(Store& store) override {
+    return !store.isKey(key()) || store.clear(key()) == ClearResult::kOk;
+  }
+
+  void finish(bool) override {}
+};
+
+}  // namespace internal
+
+/// A preference holding a plain struct, described by a schema declared at
+/// compile time. The whole record is read with a single blob read, and
+/// written with a single blob write, instead of one entry (and one commit)
+/// per field. Fields are accessed directly, as plain struct members.
+///
+/// The record is stored along with a hash of the schema. If the layout of
+/// the struct changes (fields are added, removed, reordered, renamed or
+/// retyped), the stored record is ignored, and the defaults are used until
+/// the record is written again.
+///
+/// @code
+/// struct Settings {
+///   uint8_t brightness = 128;
+///   bool show_clock = true;
+///   int16_t utc_offset_min = 0;
+/// };
+///
+/// constexpr roo_prefs::FieldInfo kSettingsSchema[] = {
+///     ROO_PREFS_FIELD(Settings, brightness),
+///     ROO_PREFS_FIELD(Settings, show_clock),
+///     ROO_PREFS_FIELD(Settings, utc_offset_min),
+/// };
+///
+/// roo_prefs::Record<Settings> settings(col, "settings", kSettingsSchema);
+///
+/// uint8_t brightness = settings.get().brightness;
+/// settings.set(&Settings::show_clock, false);
+/// @endcode
+///
+/// The schema must list all the fields of `T`, and must outlive the record
+/// (e.g. be a global constant). Bytes not covered by any field, i.e. the
+/// padding, are stored as zeros, so that records that differ only in padding
+/// are not written again. A field missing from the schema would thus be lost
+/// on every write; the constructor logs an error if the schema leaves a gap
+/// that cannot be padding (see `SchemaCoversRecord()`). The check can also be
+/// done at compile time:
+///
+/// @code
+/// static_assert(roo_prefs::SchemaCoversRecord(kSettingsSchema,
+///                                             sizeof(Settings),
+///                                             alignof(Settings)),
+///               "Schema is missing fields");
+/// @endcode
+///
+/// `T` must be trivially copyable. Its default value (by default, `T()`,
+/// which picks up default member initializers) is used while the record is
+/// not set.
+template <typename T>
+class Record {
+ public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Records must be trivially copyable");
+
+  template <size_t N>
+  Record(Collection& collection, const char* key,
+         const FieldInfo (&schema)[N], const T& default_value = T())
+      : collection_(collection),
+        key_(key),
+        schema_(schema),
+        schema_size_(N),
+        pref_(collection, key,
+              internal::Stamped<T>(SchemaHash(schema, sizeof(T)),
+                                   default_value, schema, N)) {
+    for (size_t i = 0; i < N; ++i) {
+      if (schema[i].offset + schema[i].size > sizeof(T)) {
+        LOG(ERROR) << "Field " << schema[i].name << " of record " << key
+                   << " lies outside of the record";
+      }
+    }
+    if (!SchemaCoversRecord(schema, sizeof(T), alignof(T))) {
+      LOG(ERROR) << "The schema of record " << key
+                 << " does not list all of its fields; the missing fields "
+                    "are not stored";
+    }
+  }
+
+  /// Returns the hash of the schema, stored along with the record.
+  uint32_t schemaHash() const { return pref_.get().hash; }
+
+  bool isSet() const { return pref_.isSet(); }
+
+  const T& get() const { return pref_.get().value; }
+
+  /// Returns a copy of the record. See `Pref::load()`.
+  T load() const { return pref_.load().value; }
+
+  bool set(const T& value) {
+    return pref_.set(
+        internal::Stamped<T>(schemaHash(), value, schema_, schema_size_));
+  }
+
+  /// Updates a single field, and writes the record.
+  template <typename F, typename V>
+  bool set(F T::*field, const V& value) {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    T record = get();
+    record.*field = value;
+    return set(record);
+  }
+
+  /// Removes the record from the store, also if it has been stored with a
+  /// different layout (and thus reads as unset).
+  bool clear() {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    bool was_set = pref_.isSet();
+    if (!pref_.clear()) return false;
+    if (was_set) return true;
+    if (collection_.batching()) {
+      collection_.enqueue(std::unique_ptr<internal::BatchedOp>(
+          new internal::StaleRecordClear(key_)));
+      return true;
+    }
+    Transaction t(collection_);
+    if (!t.active()) return false;
+    return internal::StaleRecordClear(key_).write(t.store());
+  }
+
+ private:
+  Collection& collection_;
+  const char* key_;
+  const FieldInfo* schema_;
+  size_t schema_size_;
+  Pref<internal::Stamped<T>> pref_;
+};
+
+}  // namespace roo_prefs
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mutex>
+#include <type_traits>
+
+#include "roo_logging.h"
+#include "roo_prefs/collection.h"
+#include "roo_prefs/impl/key_suffix.h"
+#include "roo_prefs/transaction.h"
+
+namespace roo_prefs {
+
+/// Log of the last `N` records (e.g. fault codes, or calibration history),
+/// stored as a ring of `N` slots, one key per slot: "<key>.0" to
+/// "<key>.<N-1>". Each append writes a single slot, of `sizeof(T)` plus 4
+/// bytes, rather than rewriting the whole log. Records are read from the
+/// store one at a time, and are not cached; in RAM, the log only keeps the
+/// position of its head.
+///
+/// Each slot stores the sequence number of its record, along with the
+/// record. The head is found by scanning the slots on first access (or in
+/// `Collection::preloadAll()`). Slots whose write has failed, or has been
+/// interrupted by a reset, are skipped.
+///
+/// @code
+/// struct Fault {
+///   uint32_t time;
+///   uint16_t code;
+/// };
+///
+/// roo_prefs::RingLogPref<Fault, 16> faults(col, "faults");
+///
+/// faults.append(Fault{now, code});
+/// faults.forEach([](const Fault& fault) { Report(fault); });
+/// @endcode
+///
+/// `T` must be trivially copyable. The slot keys must fit in 15 characters
+/// (`kMaxKeyLength`), as required by the ESP32 NVS; a log with a longer key
+/// logs an error, and then fails all operations. Appends are written
+/// immediately, also within batched transactions.
+template <typename T, size_t N>
+class RingLogPref : private internal::PrefNode {
+ public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Logged records must be trivially copyable");
+  static_assert(N > 0 && N <= 1000, "Ring log capacity must be 1 to 1000");
+
+  RingLogPref(Collection& collection, const char* key)
+      : internal::PrefNode(key),
+        collection_(collection),
+        state_(State::kUnknown),
+        backoff_(),
+        last_seq_(0) {
+    if (strlen(key) + kSlotSuffixLength > kMaxKeyLength) {
+      LOG(ERROR) << "Ring log key " << key << " is too long";
+      state_ = State::kInvalidKey;
+    }
+    collection_.registerPref(*this);
+  }
+
+  ~RingLogPref() override { collection_.unregisterPref(*this); }
+
+  static constexpr size_t capacity() { return N; }
+
+  /// Returns the number of records in the log, including those that failed
+  /// to write.
+  size_t size() const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    sync();
+    return last_seq_ < N ? last_seq_ : N;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /// Appends the record, overwriting the oldest one if the log is full.
+  /// Returns false if the write failed, or if the log could not be read
+  /// (and the head is unknown).
+  bool append(const T& record) {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    // Appending needs the head, so the scan is retried regardless of the
+    // read backoff.
+    if (state_ == State::kUnknown || state_ == State::kError) reload();
+    if (state_ != State::kLoaded) return false;
+    Slot slot = Slot();
+    slot.seq = last_seq_ + 1;
+    slot.value = record;
+    char key[kSlotKeySize];
+    slotKey(slot.seq, key);
+    Transaction t(collection_);
+    if (!t.active() ||
+        t.store().writeObject(key, slot) != WriteResult::kOk) {
+      return false;
+    }
+    last_seq_ = slot.seq;
+    return true;
+  }
+
+  /// Reads the record at the specified position, with 0 being the oldest.
+  /// Returns false if there is no such record, or it could not be read.
+  bool read(size_t index, T& record) const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    sync();
+    if (index >= (last_seq_ < N ? last_seq_ : N)) return false;
+    Transaction t(collection_, Transaction::Mode::kReadOnly);
+    return t.active() && readSlot(t.store(), firstSeq() + index, record);
+  }
+
+  /// Calls `fn(const T&)` for each record, from the oldest to the newest,
+  /// reading them one at a time, within a single transaction. Returns the
+  /// number of records visited.
+  template <typename Fn>
+  size_t forEach(Fn&& fn) const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    sync();
+    if (last_seq_ == 0) return 0;
+    Transaction t(collection_, Transaction::Mode::kReadOnly);
+    if (!t.active()) return 0;
+    size_t count = 0;
+    T record;
+    for (uint32_t seq = firstSeq(); seq <= last_seq_; ++seq) {
+      if (!readSlot(t.store(), seq, record)) continue;
+      fn(static_cast<const T&>(record));
+      ++count;
+    }
+    return count;
+  }
+
+  /// Removes all records from the store.
+  bool clear() {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    if (state_ == State::kInvalidKey) return false;
+    Transaction t(collection_);
+    if (!t.active()) return false;
+    bool ok = true;
+    char key[kSlotKeySize];
+    for (size_t i = 0; i < N; ++i) {
+      slotKey(i + 1, key);
+      if (t.store().isKey(key) &&
+          t.store().clear(key) != ClearResult::kOk) {
+        ok = false;
+      }
+    }
+    // After a failure, the remaining slots are found by the next scan.
+    state_ = ok ? State::kLoaded : State::kUnknown;
+    backoff_.reset();
+    last_seq_ = 0;
+    return ok;
+  }
+
+ private:
+  // kInvalidKey is final; the slot keys would be rejected by the store.
+  enum class State : uint8_t { kUnknown, kLoaded, kError, kInvalidKey };
+
+  // Length of the slot key suffix, e.g. ".15".
+  static constexpr size_t kSlotSuffixLength =
+      internal::IndexSuffixLength(N - 1);
+
+  struct Slot {
+    // Sequence number of the record, starting at 1.
+    uint32_t seq;
+    T value;
+  };
+
+  static constexpr size_t kSlotKeySize = 32;
+
+  // Composes the key of the slot holding the record with the specified
+  // sequence number.
+  void slotKey(uint32_t seq, char* key) const {
+    snprintf(key, kSlotKeySize, "%s.%u", key_, (unsigned)((seq - 1) % N));
+  }
+
+  uint32_t firstSeq() const { return last_seq_ < N ? 1 : last_seq_ - N + 1; }
+
+  bool readSlot(Store& store, uint32_t seq, T& record) const {
+    char key[kSlotKeySize];
+    slotKey(seq, key);
+    Slot slot;
+    if (store.readObject(key, slot) != ReadResult::kOk || slot.seq != seq) {
+      return false;
+    }
+    record = slot.value;
+    return true;
+  }
+
+  // Finds the head unless known, or skipped because of the read backoff (see
+  // `ErrorPolicy`). Must be called with the collection lock held.
+  void sync() const {
+    if (state_ == State::kLoaded || state_ == State::kInvalidKey) return;
+    if (state_ == State::kError && collection_.skipRead(backoff_)) return;
+    reload();
+  }
+
+  // Scans the slots for the head. Must be called with the collection lock
+  // held.
+  void reload() const {
+    Transaction t(collection_, Transaction::Mode::kReadOnly);
+    load(t.active() ? &t.store() : nullptr);
+  }
+
+  bool load(Store* store) const {
+    last_seq_ = 0;
+    if (store == nullptr) {
+      state_ = State::kLoaded;
+      backoff_.reset();
+      return true;
+    }
+    char key[kSlotKeySize];
+    Slot slot;
+    for (size_t i = 0; i < N; ++i) {
+      slotKey(i + 1, key);
+      switch (store->readObject(key, slot)) {
+        case ReadResult::kOk: {
+          if (slot.seq > last_seq_) last_seq_ = slot.seq;
+          break;
+        }
+        case ReadResult::kError: {
+          state_ = State::kError;
+          collection_.onReadError(backoff_);
+          return false;
+        }
+        default: {
+          break;
+        }
+      }
+    }
+    state_ = State::kLoaded;
+    backoff_.reset();
+    return true;
+  }
+
+  bool preload(Store* store) override {
+    if (state_ == State::kLoaded) return true;
+    if (state_ == State::kInvalidKey) return false;
+    return load(store);
+  }
+
+  void invalidate() override {
+    if (state_ == State::kInvalidKey) return;
+    backoff_.reset();
+    state_ = State::kUnknown;
+  }
+
+  Collection& collection_;
+  mutable State state_;
+  mutable internal::ReadBackoff backoff_;
+  // Sequence number of the newest record, or 0 if the log is empty.
+  mutable uint32_t last_seq_;
+};
+
+}  // namespace roo_prefs
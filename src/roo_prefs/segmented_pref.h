@@ -0,0 +1,426 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+
+#include "roo_logging.h"
+#include "roo_prefs/collection.h"
+#include "roo_prefs/impl/key_suffix.h"
+#include "roo_prefs/impl/write_batch.h"
+#include "roo_prefs/pref.h"
+#include "roo_prefs/record.h"
+#include "roo_prefs/transaction.h"
+
+namespace roo_prefs {
+
+/// A preference holding a plain struct, stored as a sequence of segments of
+/// `S` bytes, one key per segment: "<key>.0", "<key>.1", etc. `set()`
+/// compares the new value with the cached one, segment by segment, and only
+/// writes the segments that have changed. Changing one field of a 200-byte
+/// struct thus writes 32 bytes (by default) rather than 200. On first access
+/// (or in `Collection::preloadAll()`), the value is reassembled from all the
+/// segments.
+///
+/// @code
+/// struct ZoneSchedule {
+///   uint8_t enabled;
+///   uint8_t duration_min[7];
+///   uint16_t start_min[7][4];
+/// };
+///
+/// roo_prefs::SegmentedPref<ZoneSchedule> schedule(col, "zone1");
+///
+/// schedule.set(&ZoneSchedule::enabled, 1);
+/// schedule.edit([](ZoneSchedule& s) { s.duration_min[2] = 15; });
+/// @endcode
+///
+/// If more than one segment changes, a reset in the middle of `set()` can
+/// leave a mix of old and new segments. To prevent that, call
+/// `setAtomicWrites(true)`: the changed segments are then first saved in a
+/// journal (see `Transaction::Mode::kAtomic`), which roughly doubles the
+/// bytes written. Edits of a single segment never need the journal. Within a
+/// batched transaction, the changed segments join the batch; within a plain
+/// one, they are written before `set()` returns.
+///
+/// Segments are compared byte by byte. If `T` has padding, whose bytes are
+/// indeterminate, pass a schema listing its fields (see `Record`); the
+/// padding is then zeroed before the comparison, and in the store. Without a
+/// schema, `T` must have unique object representations (in C++17, this is
+/// checked at compile time); e.g. it must have no padding.
+///
+/// @code
+/// struct Calibration {
+///   uint8_t channel;
+///   float gain;
+/// };
+///
+/// constexpr roo_prefs::FieldInfo kCalibrationSchema[] = {
+///     ROO_PREFS_FIELD(Calibration, channel),
+///     ROO_PREFS_FIELD(Calibration, gain),
+/// };
+///
+/// roo_prefs::SegmentedPref<Calibration> calibration(col, "cal",
+///                                                   kCalibrationSchema);
+/// @endcode
+///
+/// `T` must be trivially copyable. Group fields that change together, so
+/// that they fall into the same segment. If the size of `T` changes, the
+/// stored value is ignored, and the default is used until it is written
+/// again. The segment keys must fit in 15 characters (`kMaxKeyLength`), as
+/// required by the ESP32 NVS; a preference with a longer key logs an error,
+/// keeps its default value, and fails all writes.
+template <typename T, size_t S = 32>
+class SegmentedPref : private internal::PrefNode {
+ public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "Segmented preferences must be trivially copyable");
+  static_assert(S > 0, "Segment size must be positive");
+
+  static constexpr size_t kSegments = (sizeof(T) + S - 1) / S;
+
+  static_assert(kSegments <= 1000, "Too many segments; increase S");
+
+  /// The default value; see `Pref::DefaultType`.
+  using DefaultType = internal::DefaultValue<T>;
+
+  SegmentedPref(Collection& collection, const char* key,
+                DefaultType default_value = DefaultType())
+      : SegmentedPref(collection, key, nullptr, 0, std::move(default_value)) {
+#if defined(__cpp_lib_has_unique_object_representations)
+    static_assert(std::has_unique_object_representations<T>::value,
+                  "T may have padding, or floating-point fields, which "
+                  "cannot be compared byte by byte; pass a schema");
+#endif
+  }
+
+  /// Takes a schema listing the fields of `T`, which must outlive the
+  /// preference. See `Record`.
+  template <size_t N>
+  SegmentedPref(Collection& collection, const char* key,
+                const FieldInfo (&schema)[N],
+                DefaultType default_value = DefaultType())
+      : SegmentedPref(collection, key, schema, N, std::move(default_value)) {
+    if (!SchemaCoversRecord(schema, sizeof(T), alignof(T))) {
+      LOG(ERROR) << "The schema of segmented preference " << key
+                 << " does not list all of its fields; the missing fields "
+                    "are not stored";
+    }
+  }
+
+  /// Takes the default as a `T`, so that it can be brace-initialized.
+  template <typename U = T, typename = typename std::enable_if<
+                                !internal::IsStringLike<U>::value>::type>
+  SegmentedPref(Collection& collection, const char* key,
+                const T& default_value)
+      : SegmentedPref(collection, key, DefaultType(default_value)) {}
+
+  ~SegmentedPref() override {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    // Pending batched segment writes refer to this preference.
+    char key[kSegmentKeySize];
+    for (size_t i = 0; i < kSegments; ++i) {
+      segmentKey(i, key);
+      collection_.cancelPending(key);
+    }
+    collection_.unregisterPref(*this);
+  }
+
+  static constexpr size_t segments() { return kSegments; }
+
+  /// If true, writes that change more than one segment are journaled, so
+  /// that they are applied all or nothing, even if interrupted by a reset.
+  /// Defaults to false.
+  void setAtomicWrites(bool atomic) {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    atomic_ = atomic;
+  }
+
+  bool isSet() const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    sync();
+    return state_ == State::kSet;
+  }
+
+  /// Returns a reference to the cached value. The value is read from the
+  /// store on first access.
+  const T& get() const {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    sync();
+    return value_;
+  }
+
+  /// Writes the segments that differ from the cached value (or all of them,
+  /// if the preference is not set). Returns true on success, including when
+  /// nothing has changed.
+  bool set(const T& value) {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    // In the error state, all segments get written, so the stored value is
+    // not needed; the write neither waits for the read backoff, nor counts
+    // toward it.
+    if (!backoff_.active()) sync();
+    if (state_ == State::kInvalidKey) return false;
+    if (collection_.batching()) {
+      // The batch becomes atomic, as if a nested atomic transaction joined it.
+      if (atomic_) collection_.startBatch(true);
+      enqueueChanges(value, collection_.batch_);
+      return true;
+    }
+    // Uses a batch of its own, rather than a nested batched transaction,
+    // which would defer the writes of the enclosing transaction, if any.
+    Transaction t(collection_);
+    if (!t.active()) return false;
+    internal::WriteBatch batch;
+    if (enqueueChanges(value, batch) == 0) {
+      collection_.store_.onWriteSuppressed(key_);
+      return true;
+    }
+    return collection_.applyWrites(batch, atomic_);
+  }
+
+  /// Sets a single field, writing only the segments it spans.
+  template <typename F, typename V>
+  bool set(F T::*field, const V& value) {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    T updated = get();
+    updated.*field = value;
+    return set(updated);
+  }
+
+  /// Returns an editor, holding a copy of the value, to be modified in place
+  /// and set when the editor goes out of scope. See `Pref::edit()`.
+  PrefEditor<SegmentedPref<T, S>, T> edit() {
+    return PrefEditor<SegmentedPref<T, S>, T>(*this, get());
+  }
+
+  /// Calls `fn(T&)` on a copy of the value, and sets it.
+  template <typename Fn>
+  bool edit(Fn&& fn) {
+    PrefEditor<SegmentedPref<T, S>, T> editor = edit();
+    fn(*editor);
+    return editor.commit();
+  }
+
+  /// Removes all segments from the store. Applied immediately, also within
+  /// batched transactions.
+  bool clear() {
+    std::lock_guard<internal::Mutex> lock(collection_.mutex_);
+    if (state_ == State::kInvalidKey) return false;
+    Transaction t(collection_);
+    if (!t.active()) return false;
+    bool ok = true;
+    char key[kSegmentKeySize];
+    for (size_t i = 0; i < kSegments; ++i) {
+      segmentKey(i, key);
+      collection_.cancelPending(key);
+      if (t.store().isKey(key) && t.store().clear(key) != ClearResult::kOk) {
+        ok = false;
+      }
+    }
+    // After a failure, the remaining segments are found by the next read.
+    state_ = ok ? State::kUnset : State::kUnknown;
+    backoff_.reset();
+    value_ = default_value_.value();
+    return ok;
+  }
+
+ private:
+  // kInvalidKey is final; the segment keys would be rejected by the store.
+  enum class State : uint8_t { kUnknown, kUnset, kSet, kError, kInvalidKey };
+
+  // Length of the segment key suffix, e.g. ".2".
+  static constexpr size_t kSegmentSuffixLength =
+      internal::IndexSuffixLength(kSegments - 1);
+
+  class SegmentWrite;
+
+  static constexpr size_t kSegmentKeySize = 32;
+
+  SegmentedPref(Collection& collection, const char* key,
+                const FieldInfo* schema, size_t schema_size,
+                DefaultType default_value)
+      : internal::PrefNode(key),
+        collection_(collection),
+        state_(State::kUnknown),
+        backoff_(),
+        atomic_(false),
+        schema_(schema),
+        schema_size_(schema_size),
+        default_value_(std::move(default_value)),
+        value_(default_value_.value()) {
+    if (strlen(key) + kSegmentSuffixLength > kMaxKeyLength) {
+      LOG(ERROR) << "Segmented preference key " << key << " is too long";
+      state_ = State::kInvalidKey;
+    }
+    collection_.registerPref(*this);
+  }
+
+  static size_t segmentSize(size_t index) {
+    return index + 1 < kSegments ? S : sizeof(T) - index * S;
+  }
+
+  void segmentKey(size_t index, char* key) const {
+    snprintf(key, kSegmentKeySize, "%s.%u", key_, (unsigned)index);
+  }
+
+  // Queues writes of the segments that have changed, and cancels pending
+  // writes of those that have not. Returns the number of writes queued.
+  size_t enqueueChanges(const T& value, internal::WriteBatch& batch) {
+    T normalized;
+    if (schema_ == nullptr) {
+      normalized = value;
+    } else {
+      internal::CopyFields(&normalized, &value, sizeof(T), schema_,
+                           schema_size_);
+    }
+    const uint8_t* updated = reinterpret_cast<const uint8_t*>(&normalized);
+    const uint8_t* cached = reinterpret_cast<const uint8_t*>(&value_);
+    size_t count = 0;
+    char key[kSegmentKeySize];
+    for (size_t i = 0; i < kSegments; ++i) {
+      if (state_ == State::kSet &&
+          memcmp(cached + i * S, updated + i * S, segmentSize(i)) == 0) {
+        segmentKey(i, key);
+        batch.cancel(key);
+        continue;
+      }
+      batch.put(std::unique_ptr<internal::BatchedOp>(
+          new SegmentWrite(*this, i, updated + i * S)));
+      ++count;
+    }
+    return count;
+  }
+
+  // Reads all segments unless known, or skipped because of the read backoff
+  // (see `ErrorPolicy`). Must be called with the collection lock held.
+  void sync() const {
+    if (state_ != State::kUnknown && state_ != State::kError) return;
+    if (state_ == State::kError && collection_.skipRead(backoff_)) return;
+    Transaction t(collection_, Transaction::Mode::kReadOnly);
+    load(t.active() ? &t.store() : nullptr);
+  }
+
+  bool load(Store* store) const {
+    value_ = default_value_.value();
+    if (store == nullptr) {
+      state_ = State::kUnset;
+      backoff_.reset();
+      return true;
+    }
+    T stored;
+    uint8_t* data = reinterpret_cast<uint8_t*>(&stored);
+    char key[kSegmentKeySize];
+    size_t found = 0;
+    bool valid = true;
+    for (size_t i = 0; i < kSegments; ++i) {
+      segmentKey(i, key);
+      // Stores report the actual length of segments that do not fit.
+      size_t len = segmentSize(i);
+      switch (store->readBytes(key, data + i * S, segmentSize(i), &len)) {
+        case ReadResult::kOk: {
+          if (len != segmentSize(i)) valid = false;
+          ++found;
+          break;
+        }
+        case ReadResult::kNotFound: {
+          break;
+        }
+        case ReadResult::kWrongType: {
+          valid = false;
+          break;
+        }
+        default: {
+          if (len != segmentSize(i)) {
+            valid = false;
+            break;
+          }
+          state_ = State::kError;
+          collection_.onReadError(backoff_);
+          return false;
+        }
+      }
+    }
+    // A segment past the last one means that the type has shrunk.
+    segmentKey(kSegments, key);
+    if (found > 0 && store->isKey(key)) valid = false;
+    if (found == 0) {
+      state_ = State::kUnset;
+      backoff_.reset();
+      return true;
+    }
+    if (!valid || found < kSegments) {
+      LOG(WARNING) << "Segmented preference " << key_
+                   << " has been stored with a different layout; ignoring";
+      state_ = State::kUnset;
+      backoff_.reset();
+      return true;
+    }
+    value_ = stored;
+    state_ = State::kSet;
+    backoff_.reset();
+    return true;
+  }
+
+  bool preload(Store* store) override {
+    if (state_ == State::kSet || state_ == State::kUnset) return true;
+    if (state_ == State::kInvalidKey) return false;
+    return load(store);
+  }
+
+  void invalidate() override {
+    if (state_ == State::kInvalidKey) return;
+    backoff_.reset();
+    state_ = State::kUnknown;
+  }
+
+  Collection& collection_;
+  mutable State state_;
+  mutable internal::ReadBackoff backoff_;
+  bool atomic_;
+  // Fields of T, if given; used to zero the padding.
+  const FieldInfo* schema_;
+  size_t schema_size_;
+  DefaultType default_value_;
+  mutable T value_;
+};
+
+/// Implementation details follow.
+
+template <typename T, size_t S>
+class SegmentedPref<T, S>::SegmentWrite : public internal::BatchedOp {
+ public:
+  SegmentWrite(SegmentedPref<T, S>& pref, size_t index, const uint8_t* data)
+      : internal::BatchedOp(key_), pref_(pref), index_(index) {
+    pref.segmentKey(index, key_);
+    memcpy(data_, data, segmentSize(index));
+  }
+
+  bool write(Store& store) override {
+    return store.writeBytes(key_, data_, segmentSize(index_)) ==
+           WriteResult::kOk;
+  }
+
+  void finish(bool ok) override {
+    if (!ok) {
+      // Re-reads the value, to find out which segments got written.
+      pref_.state_ = State::kUnknown;
+      return;
+    }
+    memcpy(reinterpret_cast<uint8_t*>(&pref_.value_) + index_ * S, data_,
+           segmentSize(index_));
+    if (pref_.state_ != State::kUnknown) pref_.state_ = State::kSet;
+  }
+
+ private:
+  SegmentedPref<T, S>& pref_;
+  size_t index_;
+  char key_[kSegmentKeySize];
+  uint8_t data_[S];
+};
+
+}  // namespace roo_prefs
@@ -4,7 +4,8 @@
 
 #include <string>
 
-#include "roo_prefs/store/preferences_store.h"
+#include "roo_prefs/fixed_string.h"
+#include "roo_prefs/store/store.h"
 
 #ifdef ARDUINO
 #include <Arduino.h>
@@ -12,8 +13,6 @@
 
 namespace roo_prefs {
 
-using Store = PreferencesStore;
-
 inline ClearResult StoreClear(Store& store, const char* key) {
   return store.clear(key);
 }
@@ -176,6 +175,26 @@ inline ReadResult StoreRead<std::string>(Store& store, const char* key,
   return store.readString(key, val);
 }
 
+template <size_t N>
+inline WriteResult StoreWrite(Store& store, const char* key,
+                              const FixedString<N>& val) {
+  return store.writeString(key, val.view());
+}
+
+template <size_t N>
+inline ReadResult StoreRead(Store& store, const char* key,
+                            FixedString<N>& val) {
+  size_t len;
+  ReadResult result = store.readStringInto(key, val.data_, N + 1, &len);
+  if (result == ReadResult::kOk) {
+    val.size_ = len;
+  } else {
+    // Keep the previous value, in case the buffer was left untouched.
+    val.data_[val.size_] = '\0';
+  }
+  return result;
+}
+
 #ifdef ARDUINO
 template <>
 inline WriteResult StoreWrite<String>(Store& store, const char* key,
@@ -186,10 +205,18 @@ inline WriteResult StoreWrite<String>(Store& store, const char* key,
 template <>
 inline ReadResult StoreRead<String>(Store& store, const char* key,
                                     String& val) {
+  // Most strings fit on the stack; only longer ones need a temporary.
+  char buf[96];
+  ReadResult result = store.readStringInto(key, buf, sizeof(buf), nullptr);
+  if (result == ReadResult::kOk) {
+    val = buf;
+    return result;
+  }
+  if (result != ReadResult::kError) return result;
   std::string temp;
-  ReadResult result = store.readString(key, temp);
+  result = store.readString(key, temp);
   if (result == ReadResult::kOk) {
-    val = String(temp.c_str());
+    val = temp.c_str();
   }
   return result;
 }
@@ -0,0 +1,260 @@
+#include "roo_prefs/store/accounting_store.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "roo_logging.h"
+
+namespace roo_prefs {
+
+namespace {
+
+// Size of an NVS entry, in bytes.
+constexpr size_t kNvsEntrySize = 32;
+
+uint32_t DataEntries(size_t len) {
+  return (len + kNvsEntrySize - 1) / kNvsEntrySize;
+}
+
+// Header entry, plus the data, including the terminating NUL.
+uint32_t StringEntries(size_t len) { return 1 + DataEntries(len + 1); }
+
+// Blob index entry, chunk header entry, plus the data.
+uint32_t BlobEntries(size_t len) { return 2 + DataEntries(len); }
+
+}  // namespace
+
+AccountingStore::AccountingStore(Store& delegate)
+    : ForwardingStore(delegate),
+      collection_name_(""),
+      stats_(),
+      totals_(Stats{0, 0, 0, 0, 0, 0}) {}
+
+const AccountingStore::Stats* AccountingStore::stats(const char* key) const {
+  auto itr = stats_.find(key);
+  return itr == stats_.end() ? nullptr : &itr->second;
+}
+
+void AccountingStore::reset() {
+  stats_.clear();
+  totals_ = Stats{0, 0, 0, 0, 0, 0};
+}
+
+void AccountingStore::dump(size_t max_keys) const {
+  LOG(INFO) << "Store usage of " << collection_name_ << ": "
+            << totals_.writes << " writes (" << totals_.bytes_written
+            << " bytes, ~" << totals_.nvs_entries << " NVS entries), "
+            << totals_.suppressed_writes << " suppressed writes, "
+            << totals_.clears << " clears, " << totals_.reads << " reads, "
+            << stats_.size() << " keys";
+  std::vector<const StatsMap::value_type*> sorted;
+  sorted.reserve(stats_.size());
+  for (const auto& entry : stats_) sorted.push_back(&entry);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const StatsMap::value_type* a,
+                      const StatsMap::value_type* b) {
+                     return a->second.nvs_entries > b->second.nvs_entries;
+                   });
+  if (sorted.size() > max_keys) sorted.resize(max_keys);
+  for (const auto* entry : sorted) {
+    const Stats& s = entry->second;
+    LOG(INFO) << "  " << entry->first << ": " << s.writes << " writes ("
+              << s.bytes_written << " bytes, ~" << s.nvs_entries
+              << " NVS entries), " << s.suppressed_writes
+              << " suppressed writes, " << s.clears << " clears, " << s.reads
+              << " reads";
+  }
+}
+
+bool AccountingStore::begin(const char* collection_name, bool read_only) {
+  collection_name_ = collection_name;
+  return ForwardingStore::begin(collection_name, read_only);
+}
+
+AccountingStore::Stats& AccountingStore::at(const char* key) {
+  auto itr = stats_.find(key);
+  if (itr == stats_.end()) {
+    itr = stats_.emplace(key, Stats{0, 0, 0, 0, 0, 0}).first;
+  }
+  return itr->second;
+}
+
+WriteResult AccountingStore::countWrite(const char* key, WriteResult result,
+                                        size_t bytes, uint32_t nvs_entries) {
+  if (result != WriteResult::kOk) return result;
+  Stats& s = at(key);
+  ++s.writes;
+  s.bytes_written += bytes;
+  s.nvs_entries += nvs_entries;
+  ++totals_.writes;
+  totals_.bytes_written += bytes;
+  totals_.nvs_entries += nvs_entries;
+  return result;
+}
+
+ReadResult AccountingStore::countRead(const char* key, ReadResult result) {
+  ++at(key).reads;
+  ++totals_.reads;
+  return result;
+}
+
+void AccountingStore::onWriteSuppressed(const char* key) {
+  ++at(key).suppressed_writes;
+  ++totals_.suppressed_writes;
+  ForwardingStore::onWriteSuppressed(key);
+}
+
+bool AccountingStore::isKey(const char* key) {
+  ++at(key).reads;
+  ++totals_.reads;
+  return ForwardingStore::isKey(key);
+}
+
+ClearResult AccountingStore::clear(const char* key) {
+  ClearResult result = ForwardingStore::clear(key);
+  if (result == ClearResult::kOk) {
+    ++at(key).clears;
+    ++totals_.clears;
+  }
+  return result;
+}
+
+WriteResult AccountingStore::writeBool(const char* key, bool val) {
+  return countWrite(key, ForwardingStore::writeBool(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeU8(const char* key, uint8_t val) {
+  return countWrite(key, ForwardingStore::writeU8(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeI8(const char* key, int8_t val) {
+  return countWrite(key, ForwardingStore::writeI8(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeU16(const char* key, uint16_t val) {
+  return countWrite(key, ForwardingStore::writeU16(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeI16(const char* key, int16_t val) {
+  return countWrite(key, ForwardingStore::writeI16(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeU32(const char* key, uint32_t val) {
+  return countWrite(key, ForwardingStore::writeU32(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeI32(const char* key, int32_t val) {
+  return countWrite(key, ForwardingStore::writeI32(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeU64(const char* key, uint64_t val) {
+  return countWrite(key, ForwardingStore::writeU64(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeI64(const char* key, int64_t val) {
+  return countWrite(key, ForwardingStore::writeI64(key, val), sizeof(val), 1);
+}
+
+WriteResult AccountingStore::writeFloat(const char* key, float val) {
+  // Stored as a U32 entry by `PreferencesStore`.
+  return countWrite(key, ForwardingStore::writeFloat(key, val), sizeof(val),
+                    1);
+}
+
+WriteResult AccountingStore::writeDouble(const char* key, double val) {
+  // Stored as a U64 entry by `PreferencesStore`.
+  return countWrite(key, ForwardingStore::writeDouble(key, val), sizeof(val),
+                    1);
+}
+
+WriteResult AccountingStore::writeString(const char* key,
+                                         roo::string_view val) {
+  // `PreferencesStore` stores non-empty strings as blobs, and empty ones as
+  // NVS strings.
+  return countWrite(key, ForwardingStore::writeString(key, val), val.size(),
+                    val.empty() ? StringEntries(0) : BlobEntries(val.size()));
+}
+
+WriteResult AccountingStore::writeBytes(const char* key, const void* val,
+                                        size_t len) {
+  return countWrite(key, ForwardingStore::writeBytes(key, val, len), len,
+                    BlobEntries(len));
+}
+
+WriteResult AccountingStore::writeObjectInternal(const char* key,
+                                                 const void* val,
+                                                 size_t size) {
+  return countWrite(key, ForwardingStore::writeObjectInternal(key, val, size),
+                    size, BlobEntries(size));
+}
+
+ReadResult AccountingStore::readBool(const char* key, bool& val) {
+  return countRead(key, ForwardingStore::readBool(key, val));
+}
+
+ReadResult AccountingStore::readU8(const char* key, uint8_t& val) {
+  return countRead(key, ForwardingStore::readU8(key, val));
+}
+
+ReadResult AccountingStore::readI8(const char* key, int8_t& val) {
+  return countRead(key, ForwardingStore::readI8(key, val));
+}
+
+ReadResult AccountingStore::readU16(const char* key, uint16_t& val) {
+  return countRead(key, ForwardingStore::readU16(key, val));
+}
+
+ReadResult AccountingStore::readI16(const char* key, int16_t& val) {
+  return countRead(key, ForwardingStore::readI16(key, val));
+}
+
+ReadResult AccountingStore::readU32(const char* key, uint32_t& val) {
+  return countRead(key, ForwardingStore::readU32(key, val));
+}
+
+ReadResult AccountingStore::readI32(const char* key, int32_t& val) {
+  return countRead(key, ForwardingStore::readI32(key, val));
+}
+
+ReadResult AccountingStore::readU64(const char* key, uint64_t& val) {
+  return countRead(key, ForwardingStore::readU64(key, val));
+}
+
+ReadResult AccountingStore::readI64(const char* key, int64_t& val) {
+  return countRead(key, ForwardingStore::readI64(key, val));
+}
+
+ReadResult AccountingStore::readFloat(const char* key, float& val) {
+  return countRead(key, ForwardingStore::readFloat(key, val));
+}
+
+ReadResult AccountingStore::readDouble(const char* key, double& val) {
+  return countRead(key, ForwardingStore::readDouble(key, val));
+}
+
+ReadResult AccountingStore::readString(const char* key, std::string& val) {
+  return countRead(key, ForwardingStore::readString(key, val));
+}
+
+ReadResult AccountingStore::readStringInto(const char* key, char* buf,
+                                           size_t capacity, size_t* out_len) {
+  return countRead(
+      key, ForwardingStore::readStringInto(key, buf, capacity, out_len));
+}
+
+ReadResult AccountingStore::readBytes(const char* key, void* val,
+                                      size_t max_len, size_t* out_len) {
+  return countRead(key, ForwardingStore::readBytes(key, val, max_len, out_len));
+}
+
+ReadResult AccountingStore::readBytesLength(const char* key,
+                                            size_t* out_len) {
+  return countRead(key, ForwardingStore::readBytesLength(key, out_len));
+}
+
+ReadResult AccountingStore::readObjectInternal(const char* key, void* val,
+                                               size_t size) {
+  return countRead(key, ForwardingStore::readObjectInternal(key, val, size));
+}
+
+}  // namespace roo_prefs
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include "roo_prefs/store/forwarding_store.h"
+
+namespace roo_prefs {
+
+/// Store decorator that counts, per key, the operations that reach the
+/// underlying store. Use it to find out which preferences wear out the flash.
+///
+/// @code
+/// roo_prefs::PreferencesStore nvs_store;
+/// roo_prefs::AccountingStore accounting(nvs_store);
+/// roo_prefs::Collection prefs("main", accounting);
+/// ...
+/// accounting.dump();
+/// @endcode
+///
+/// Costs a map entry (with a copy of the key) per key accessed.
+class AccountingStore : public ForwardingStore {
+ public:
+  struct Stats {
+    /// Successful writes.
+    uint32_t writes;
+
+    /// Payload bytes of successful writes.
+    uint32_t bytes_written;
+
+    /// Writes skipped by preferences because the value did not change.
+    uint32_t suppressed_writes;
+
+    /// Successful clears.
+    uint32_t clears;
+
+    /// Reads (including type and length probes).
+    uint32_t reads;
+
+    /// Estimated number of 32-byte NVS entries written. Each write of a
+    /// scalar takes one entry; strings and blobs take a header entry plus
+    /// the entries holding the data.
+    uint32_t nvs_entries;
+  };
+
+  using StatsMap = std::map<std::string, Stats, std::less<>>;
+
+  explicit AccountingStore(Store& delegate);
+
+  /// Returns the name of the collection that last opened the store.
+  const char* collection_name() const { return collection_name_; }
+
+  /// Returns the sums over all keys.
+  const Stats& totals() const { return totals_; }
+
+  /// Returns the counters of the specified key, or nullptr if the key has
+  /// not been accessed.
+  const Stats* stats(const char* key) const;
+
+  const StatsMap& all_stats() const { return stats_; }
+
+  /// Zeroes all counters.
+  void reset();
+
+  /// Logs the totals, and the counters of up to `max_keys` keys, in the
+  /// descending order of NVS entries written.
+  void dump(size_t max_keys = 16) const;
+
+  bool isKey(const char* key) override;
+
+  ClearResult clear(const char* key) override;
+
+  WriteResult writeBool(const char* key, bool val) override;
+
+  WriteResult writeU8(const char* key, uint8_t val) override;
+
+  WriteResult writeI8(const char* key, int8_t val) override;
+
+  WriteResult writeU16(const char* key, uint16_t val) override;
+
+  WriteResult writeI16(const char* key, int16_t val) override;
+
+  WriteResult writeU32(const char* key, uint32_t val) override;
+
+  WriteResult writeI32(const char* key, int32_t val) override;
+
+  WriteResult writeU64(const char* key, uint64_t val) override;
+
+  WriteResult writeI64(const char* key, int64_t val) override;
+
+  WriteResult writeFloat(const char* key, float val) override;
+
+  WriteResult writeDouble(const char* key, double val) override;
+
+  WriteResult writeString(const char* key, roo::string_view val) override;
+
+  WriteResult writeBytes(const char* key, const void* val,
+                         size_t len) override;
+
+  ReadResult readBool(const char* key, bool& val) override;
+
+  ReadResult readU8(const char* key, uint8_t& val) override;
+
+  ReadResult readI8(const char* key, int8_t& val) override;
+
+  ReadResult readU16(const char* key, uint16_t& val) override;
+
+  ReadResult readI16(const char* key, int16_t& val) override;
+
+  ReadResult readU32(const char* key, uint32_t& val) override;
+
+  ReadResult readI32(const char* key, int32_t& val) override;
+
+  ReadResult readU64(const char* key, uint64_t& val) override;
+
+  ReadResult readI64(const char* key, int64_t& val) override;
+
+  ReadResult readFloat(const char* key, float& val) override;
+
+  ReadResult readDouble(const char* key, double& val) override;
+
+  ReadResult readString(const char* key, std::string& val) override;
+
+  ReadResult readStringInto(const char* key, char* buf, size_t capacity,
+                            size_t* out_len) override;
+
+  ReadResult readBytes(const char* key, void* val, size_t max_len,
+                       size_t* out_len) override;
+
+  ReadResult readBytesLength(const char* key, size_t* out_len) override;
+
+  void onWriteSuppressed(const char* key) override;
+
+ protected:
+  bool begin(const char* collection_name, bool read_only) override;
+
+  WriteResult writeObjectInternal(const char* key, const void* val,
+                                  size_t size) override;
+
+  ReadResult readObjectInternal(const char* key, void* val,
+                                size_t size) override;
+
+ private:
+  Stats& at(const char* key);
+
+  WriteResult countWrite(const char* key, WriteResult result, size_t bytes,
+                         uint32_t nvs_entries);
+
+  ReadResult countRead(const char* key, ReadResult result);
+
+  const char* collection_name_;
+  StatsMap stats_;
+  Stats totals_;
+};
+
+}  // namespace roo_prefs
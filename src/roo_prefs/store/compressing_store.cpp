@@ -0,0 +1,306 @@
+#include "roo_prefs/store/compressing_store.h"
+
+#include <string.h>
+
+#include "roo_prefs/impl/lz.h"
+
+namespace roo_prefs {
+
+namespace {
+
+// Compressed values start with a tag: two magic bytes (0xFF can't begin
+// valid UTF-8 text), a checksum of the rest of the value (16-bit,
+// little-endian), the codec, and the raw length (32-bit, little-endian). The
+// lengths and the checksum must agree with the stored value, so that values
+// written without the decorator are practically never mistaken for tagged
+// ones.
+constexpr uint8_t kMagic0 = 0xFF;
+constexpr uint8_t kMagic1 = 'Z';
+constexpr size_t kChecksumOffset = 2;
+constexpr size_t kCodecOffset = 4;
+constexpr size_t kTagSize = 9;
+
+enum Codec : uint8_t {
+  // Stored as is. Used for uncompressed values that would otherwise be
+  // mistaken for compressed ones.
+  kStored = 0,
+  kLz = 1,
+};
+
+bool LooksTagged(const void* data, size_t len) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  return len >= kTagSize && bytes[0] == kMagic0 && bytes[1] == kMagic1;
+}
+
+// Fletcher-16 checksum.
+uint16_t Checksum(const uint8_t* data, size_t len) {
+  uint32_t a = 0;
+  uint32_t b = 0;
+  while (len > 0) {
+    // Defers the modulo while the sums can't overflow.
+    size_t n = len < 2048 ? len : 2048;
+    len -= n;
+    while (n-- > 0) {
+      a += *data++;
+      b += a;
+    }
+    a %= 255;
+    b %= 255;
+  }
+  return (uint16_t)((b << 8) | a);
+}
+
+// Writes the tag of the value of `len` bytes in `out`, whose payload (past
+// the tag) must already be in place.
+void PutTag(uint8_t* out, size_t len, Codec codec, size_t raw_len) {
+  out[0] = kMagic0;
+  out[1] = kMagic1;
+  out[kCodecOffset] = codec;
+  for (int i = 0; i < 4; ++i) {
+    out[kCodecOffset + 1 + i] = (raw_len >> (8 * i)) & 0xFF;
+  }
+  uint16_t checksum = Checksum(out + kCodecOffset, len - kCodecOffset);
+  out[kChecksumOffset] = checksum & 0xFF;
+  out[kChecksumOffset + 1] = checksum >> 8;
+}
+
+// Returns false if the data is not tagged. Otherwise, sets `raw_len`.
+bool ParseTag(const void* data, size_t len, size_t& raw_len) {
+  if (!LooksTagged(data, len)) return false;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  raw_len = 0;
+  for (int i = 0; i < 4; ++i) {
+    raw_len |= (size_t)bytes[kCodecOffset + 1 + i] << (8 * i);
+  }
+  switch (bytes[kCodecOffset]) {
+    case kStored: {
+      if (raw_len != len - kTagSize) return false;
+      break;
+    }
+    case kLz: {
+      // Values are only stored compressed if that makes them smaller.
+      if (raw_len <= len || raw_len > internal::kLzMaxInput) return false;
+      break;
+    }
+    default: {
+      return false;
+    }
+  }
+  uint16_t checksum = bytes[kChecksumOffset] |
+                      (uint16_t)bytes[kChecksumOffset + 1] << 8;
+  return checksum == Checksum(bytes + kCodecOffset, len - kCodecOffset);
+}
+
+// Decodes tagged data of `raw_len` bytes into `out`.
+bool Decode(const void* data, size_t len, void* out, size_t raw_len) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  if (bytes[kCodecOffset] == kStored) {
+    memcpy(out, bytes + kTagSize, raw_len);
+    return true;
+  }
+  return internal::LzDecompress(bytes + kTagSize, len - kTagSize,
+                                static_cast<uint8_t*>(out), raw_len);
+}
+
+}  // namespace
+
+CompressingStore::CompressingStore(Store& delegate, size_t min_size)
+    : ForwardingStore(delegate),
+      min_size_(min_size),
+      stats_(Stats{0, 0, 0, 0}),
+      scratch_() {}
+
+void CompressingStore::resetStats() { stats_ = Stats{0, 0, 0, 0}; }
+
+bool CompressingStore::compress(const void* val, size_t len) {
+  if (len < min_size_ || len <= kTagSize + 1) return false;
+  if (len > internal::kLzMaxInput) return false;
+  // Only worth it if it saves something.
+  scratch_.resize(len - 1);
+  size_t compressed =
+      internal::LzCompress(static_cast<const uint8_t*>(val), len,
+                           scratch_.data() + kTagSize,
+                           scratch_.size() - kTagSize);
+  if (compressed == 0) return false;
+  scratch_.resize(kTagSize + compressed);
+  PutTag(scratch_.data(), scratch_.size(), kLz, len);
+  return true;
+}
+
+void CompressingStore::wrap(const void* val, size_t len) {
+  scratch_.resize(kTagSize + len);
+  memcpy(scratch_.data() + kTagSize, val, len);
+  PutTag(scratch_.data(), scratch_.size(), kStored, len);
+}
+
+void CompressingStore::record(size_t len, size_t stored_len) {
+  if (len < min_size_) return;
+  ++stats_.writes;
+  if (stored_len < len) ++stats_.compressed_writes;
+  stats_.raw_bytes += len;
+  stats_.stored_bytes += stored_len;
+}
+
+WriteResult CompressingStore::writeString(const char* key,
+                                          roo::string_view val) {
+  if (!compress(val.data(), val.size())) {
+    if (!LooksTagged(val.data(), val.size())) {
+      WriteResult result = ForwardingStore::writeString(key, val);
+      if (result == WriteResult::kOk) record(val.size(), val.size());
+      return result;
+    }
+    wrap(val.data(), val.size());
+  }
+  WriteResult result = ForwardingStore::writeString(
+      key, roo::string_view((const char*)scratch_.data(), scratch_.size()));
+  if (result == WriteResult::kOk) record(val.size(), scratch_.size());
+  return result;
+}
+
+WriteResult CompressingStore::writeBytes(const char* key, const void* val,
+                                         size_t len) {
+  if (!compress(val, len)) {
+    if (!LooksTagged(val, len)) {
+      WriteResult result = ForwardingStore::writeBytes(key, val, len);
+      if (result == WriteResult::kOk) record(len, len);
+      return result;
+    }
+    wrap(val, len);
+  }
+  WriteResult result =
+      ForwardingStore::writeBytes(key, scratch_.data(), scratch_.size());
+  if (result == WriteResult::kOk) record(len, scratch_.size());
+  return result;
+}
+
+WriteResult CompressingStore::writeObjectInternal(const char* key,
+                                                  const void* val,
+                                                  size_t size) {
+  // Objects have a known size; the stored length tells whether they are
+  // compressed, so uncompressed ones are stored as they are.
+  if (!compress(val, size)) {
+    WriteResult result = ForwardingStore::writeObjectInternal(key, val, size);
+    if (result == WriteResult::kOk) record(size, size);
+    return result;
+  }
+  WriteResult result =
+      ForwardingStore::writeBytes(key, scratch_.data(), scratch_.size());
+  if (result == WriteResult::kOk) record(size, scratch_.size());
+  return result;
+}
+
+ReadResult CompressingStore::readString(const char* key, std::string& val) {
+  ReadResult result = ForwardingStore::readString(key, val);
+  size_t raw_len;
+  if (result != ReadResult::kOk) return result;
+  if (!ParseTag(val.data(), val.size(), raw_len)) return ReadResult::kOk;
+  std::string decoded(raw_len, '\0');
+  if (!Decode(val.data(), val.size(), &decoded[0], raw_len)) {
+    return ReadResult::kError;
+  }
+  val.swap(decoded);
+  return ReadResult::kOk;
+}
+
+ReadResult CompressingStore::readStringInto(const char* key, char* buf,
+                                            size_t capacity,
+                                            size_t* out_len) {
+  size_t len = 0;
+  ReadResult result =
+      ForwardingStore::readStringInto(key, buf, capacity, &len);
+  if (result == ReadResult::kError) {
+    // A compressed string is shorter than the raw one, but a tagged
+    // uncompressed one is longer, and might have not fit.
+    return Store::readStringInto(key, buf, capacity, out_len);
+  }
+  if (result != ReadResult::kOk) return result;
+  size_t raw_len;
+  if (ParseTag(buf, len, raw_len)) {
+    if (raw_len >= capacity) return ReadResult::kError;
+    scratch_.assign(buf, buf + len);
+    if (!Decode(scratch_.data(), scratch_.size(), buf, raw_len)) {
+      return ReadResult::kError;
+    }
+    buf[raw_len] = '\0';
+    len = raw_len;
+  }
+  if (out_len != nullptr) *out_len = len;
+  return ReadResult::kOk;
+}
+
+ReadResult CompressingStore::readBytes(const char* key, void* val,
+                                       size_t max_len, size_t* out_len) {
+  size_t len = 0;
+  ReadResult result = ForwardingStore::readBytes(key, val, max_len, &len);
+  if (result == ReadResult::kError) {
+    // A tagged uncompressed value is longer than the raw one, and might have
+    // not fit.
+    result = ForwardingStore::readBytesLength(key, &len);
+    if (result != ReadResult::kOk || len <= max_len) return ReadResult::kError;
+    scratch_.resize(len);
+    result = ForwardingStore::readBytes(key, scratch_.data(), len, &len);
+    if (result != ReadResult::kOk) return result;
+  } else if (result != ReadResult::kOk) {
+    return result;
+  } else {
+    const uint8_t* data = static_cast<const uint8_t*>(val);
+    if (!LooksTagged(data, len)) {
+      if (out_len != nullptr) *out_len = len;
+      return ReadResult::kOk;
+    }
+    scratch_.assign(data, data + len);
+  }
+  size_t raw_len;
+  if (!ParseTag(scratch_.data(), scratch_.size(), raw_len)) {
+    // Not tagged after all.
+    if (out_len != nullptr) *out_len = len;
+    if (len > max_len) return ReadResult::kError;
+    memcpy(val, scratch_.data(), len);
+    return ReadResult::kOk;
+  }
+  if (out_len != nullptr) *out_len = raw_len;
+  if (raw_len > max_len) return ReadResult::kError;
+  if (!Decode(scratch_.data(), scratch_.size(), val, raw_len)) {
+    return ReadResult::kError;
+  }
+  return ReadResult::kOk;
+}
+
+ReadResult CompressingStore::readBytesLength(const char* key,
+                                             size_t* out_len) {
+  size_t len = 0;
+  ReadResult result = ForwardingStore::readBytesLength(key, &len);
+  if (result != ReadResult::kOk || len < kTagSize) {
+    if (out_len != nullptr) *out_len = len;
+    return result;
+  }
+  // The raw length is in the tag, if there is one.
+  scratch_.resize(len);
+  result = ForwardingStore::readBytes(key, scratch_.data(), len, &len);
+  if (result != ReadResult::kOk) return result;
+  size_t raw_len;
+  if (!ParseTag(scratch_.data(), len, raw_len)) raw_len = len;
+  if (out_len != nullptr) *out_len = raw_len;
+  return ReadResult::kOk;
+}
+
+ReadResult CompressingStore::readObjectInternal(const char* key, void* val,
+                                                size_t size) {
+  size_t len = 0;
+  ReadResult result = ForwardingStore::readBytesLength(key, &len);
+  if (result != ReadResult::kOk) return result;
+  if (len == size) return ForwardingStore::readObjectInternal(key, val, size);
+  // Otherwise, the object must be compressed (and hence shorter).
+  if (len > size || len < kTagSize) return ReadResult::kWrongType;
+  scratch_.resize(len);
+  result = ForwardingStore::readBytes(key, scratch_.data(), len, &len);
+  if (result != ReadResult::kOk) return result;
+  size_t raw_len;
+  if (!ParseTag(scratch_.data(), len, raw_len) || raw_len != size) {
+    return ReadResult::kWrongType;
+  }
+  if (!Decode(scratch_.data(), len, val, size)) return ReadResult::kError;
+  return ReadResult::kOk;
+}
+
+}  // namespace roo_prefs
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "roo_prefs/store/forwarding_store.h"
+
+namespace roo_prefs {
+
+/// Store decorator that compresses large strings and blobs (including
+/// objects written by `Pref<T>`) before passing them to the underlying store,
+/// with a fast LZ77 codec that uses 1 KB of working memory. Fewer bytes per
+/// write mean fewer flash entries consumed, and less frequent page erases.
+///
+/// @code
+/// roo_prefs::PreferencesStore nvs_store;
+/// roo_prefs::CompressingStore compressing(nvs_store);
+/// roo_prefs::Collection prefs("config", compressing);
+/// @endcode
+///
+/// Only values of at least `min_size` bytes are compressed, and only if
+/// that makes them smaller. Compressed values carry a tag that can't begin
+/// valid text, and that includes the lengths and a 16-bit checksum, so values
+/// written without compression (e.g. before the decorator was added) still
+/// read. (A blob written that way would only be misread if it began with the
+/// two magic bytes of the tag, 0xFF 'Z', with a matching length, and a
+/// matching checksum.) Values written compressed can't be read without the
+/// decorator. Values larger than 64 KB are stored as they are. The decorator
+/// keeps a buffer as large as the largest value written or read.
+class CompressingStore : public ForwardingStore {
+ public:
+  struct Stats {
+    /// Writes of values large enough to be compressed.
+    uint32_t writes;
+
+    /// Those of the writes that were stored compressed.
+    uint32_t compressed_writes;
+
+    /// Size of the written values.
+    uint32_t raw_bytes;
+
+    /// Size of the written values, as stored (compressed or not).
+    uint32_t stored_bytes;
+
+    /// Returns the compression ratio, i.e. the raw size divided by the stored
+    /// size, of the written values. Values above 1 mean savings.
+    float ratio() const {
+      return stored_bytes == 0 ? 1.0f : (float)raw_bytes / stored_bytes;
+    }
+  };
+
+  static constexpr size_t kDefaultMinSize = 64;
+
+  explicit CompressingStore(Store& delegate,
+                            size_t min_size = kDefaultMinSize);
+
+  const Stats& stats() const { return stats_; }
+
+  /// Zeroes the counters.
+  void resetStats();
+
+  WriteResult writeString(const char* key, roo::string_view val) override;
+
+  WriteResult writeBytes(const char* key, const void* val,
+                         size_t len) override;
+
+  ReadResult readString(const char* key, std::string& val) override;
+
+  ReadResult readStringInto(const char* key, char* buf, size_t capacity,
+                            size_t* out_len) override;
+
+  ReadResult readBytes(const char* key, void* val, size_t max_len,
+                       size_t* out_len) override;
+
+  /// Returns the length of the value before compression. Stores can't read
+  /// just the tag, so this reads the whole value; prefer `readBytes()` into a
+  /// buffer of the expected size, which reports the length of values that
+  /// do not fit.
+  ReadResult readBytesLength(const char* key, size_t* out_len) override;
+
+ protected:
+  WriteResult writeObjectInternal(const char* key, const void* val,
+                                  size_t size) override;
+
+  ReadResult readObjectInternal(const char* key, void* val,
+                                size_t size) override;
+
+ private:
+  // Compresses the value into `scratch_`, prefixed with the tag. Returns
+  // false if the value is too small, or compression would not make it
+  // smaller.
+  bool compress(const void* val, size_t len);
+
+  // Copies the value into `scratch_`, uncompressed, prefixed with the tag.
+  void wrap(const void* val, size_t len);
+
+  // Updates the stats after a successful write of a value of `len` bytes,
+  // stored in `stored_len` bytes.
+  void record(size_t len, size_t stored_len);
+
+  size_t min_size_;
+  Stats stats_;
+  // Holds encoded values, reused across writes and reads, so that they do
+  // not allocate each time.
+  std::vector<uint8_t> scratch_;
+};
+
+}  // namespace roo_prefs
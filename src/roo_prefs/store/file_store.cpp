@@ -0,0 +1,265 @@
+#include "roo_prefs/store/file_store.h"
+
+#include <string.h>
+
+#include "roo_logging.h"
+
+namespace roo_prefs {
+
+namespace {
+
+// File layout: kMagic, followed by records. Each record is:
+//   op (1 byte), type (1 byte), key length (1 byte), data length (4 bytes LE),
+//   key, data, FNV-1a checksum of all the preceding record bytes (4 bytes LE).
+
+constexpr char kMagic[4] = {'R', 'P', 'L', '1'};
+constexpr size_t kHeaderSize = 7;
+constexpr size_t kChecksumSize = 4;
+
+constexpr uint8_t kOpPut = 1;
+constexpr uint8_t kOpRemove = 2;
+
+// Logs smaller than this are never compacted.
+constexpr size_t kMinCompactionSize = 4096;
+
+size_t RecordSize(size_t key_len, size_t data_len) {
+  return kHeaderSize + key_len + data_len + kChecksumSize;
+}
+
+uint32_t Fnv1a(uint32_t hash, const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= p[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void EncodeU32(uint32_t val, uint8_t* out) {
+  out[0] = val & 0xFF;
+  out[1] = (val >> 8) & 0xFF;
+  out[2] = (val >> 16) & 0xFF;
+  out[3] = (val >> 24) & 0xFF;
+}
+
+uint32_t DecodeU32(const uint8_t* in) {
+  return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) |
+         ((uint32_t)in[3] << 24);
+}
+
+void EncodeRecord(uint8_t op, uint8_t type, roo::string_view key,
+                  const void* data, size_t len, std::string& out) {
+  uint8_t header[kHeaderSize];
+  header[0] = op;
+  header[1] = type;
+  header[2] = (uint8_t)key.size();
+  EncodeU32((uint32_t)len, &header[3]);
+  out.assign((const char*)header, kHeaderSize);
+  out.append(key.data(), key.size());
+  if (len > 0) out.append((const char*)data, len);
+  uint8_t checksum[kChecksumSize];
+  EncodeU32(Fnv1a(2166136261u, out.data(), out.size()), checksum);
+  out.append((const char*)checksum, kChecksumSize);
+}
+
+bool WriteFully(FILE* f, const void* data, size_t len) {
+  return fwrite(data, 1, len, f) == len;
+}
+
+}  // namespace
+
+FileStore::FileStore(const char* path)
+    : MemoryStore(),
+      path_(path),
+      file_(nullptr),
+      loaded_(false),
+      needs_compaction_(false),
+      log_size_(0),
+      live_size_(0) {}
+
+FileStore::~FileStore() { closeFile(); }
+
+bool FileStore::begin(const char* collection_name, bool read_only) {
+  if (!load()) return false;
+  return MemoryStore::begin(collection_name, read_only);
+}
+
+void FileStore::end() {
+  flush();
+  MemoryStore::end();
+}
+
+void FileStore::flush() {
+  if (file_ == nullptr) return;
+  if (log_size_ > kMinCompactionSize && log_size_ > 2 * live_size_) {
+    compact();
+  } else {
+    closeFile();
+  }
+}
+
+WriteResult FileStore::put(const char* key, EntryType type, const void* data,
+                           size_t len) {
+  if (!is_writable() || key == nullptr) return WriteResult::kError;
+  size_t key_len = strlen(key);
+  if (key_len > 255 || len > UINT32_MAX) return WriteResult::kError;
+  if (!append(kOpPut, key, type, data, len)) return WriteResult::kError;
+  auto itr = entries().find(key);
+  if (itr != entries().end()) {
+    live_size_ -= RecordSize(key_len, itr->second.data.size());
+  }
+  live_size_ += RecordSize(key_len, len);
+  return MemoryStore::put(key, type, data, len);
+}
+
+ClearResult FileStore::remove(const char* key) {
+  if (!is_writable() || key == nullptr) return ClearResult::kError;
+  auto itr = entries().find(key);
+  if (itr == entries().end()) return ClearResult::kError;
+  if (!append(kOpRemove, key, itr->second.type, nullptr, 0)) {
+    return ClearResult::kError;
+  }
+  live_size_ -= RecordSize(strlen(key), itr->second.data.size());
+  return MemoryStore::remove(key);
+}
+
+bool FileStore::load() {
+  if (loaded_) return true;
+  FILE* f = fopen(path_, "rb");
+  if (f == nullptr) {
+    // Recover from a crash between writing and renaming a compacted log.
+    std::string tmp = std::string(path_) + ".tmp";
+    if (rename(tmp.c_str(), path_) == 0) f = fopen(path_, "rb");
+  }
+  if (f == nullptr) {
+    // Fresh store; the file gets created by the first write.
+    loaded_ = true;
+    return true;
+  }
+  char magic[sizeof(kMagic)];
+  size_t magic_len = fread(magic, 1, sizeof(magic), f);
+  if (magic_len == sizeof(magic) && memcmp(magic, kMagic, sizeof(kMagic))) {
+    LOG(ERROR) << "Unrecognized preferences log format in " << path_;
+    fclose(f);
+    return false;
+  }
+  EntryMap& map = entries();
+  size_t valid = 0;
+  if (magic_len == sizeof(magic)) {
+    valid = sizeof(kMagic);
+    std::string record;
+    while (true) {
+      uint8_t header[kHeaderSize];
+      if (fread(header, 1, kHeaderSize, f) != kHeaderSize) break;
+      size_t key_len = header[2];
+      size_t data_len = DecodeU32(&header[3]);
+      size_t payload_len = key_len + data_len + kChecksumSize;
+      record.assign((const char*)header, kHeaderSize);
+      record.resize(kHeaderSize + payload_len);
+      if (fread(&record[kHeaderSize], 1, payload_len, f) != payload_len) {
+        break;
+      }
+      size_t checksum_pos = kHeaderSize + key_len + data_len;
+      if (Fnv1a(2166136261u, record.data(), checksum_pos) !=
+          DecodeU32((const uint8_t*)&record[checksum_pos])) {
+        break;
+      }
+      std::string key = record.substr(kHeaderSize, key_len);
+      auto itr = map.find(key);
+      if (itr != map.end()) {
+        live_size_ -= RecordSize(key_len, itr->second.data.size());
+      }
+      if (header[0] == kOpPut) {
+        Entry& entry = map[key];
+        entry.type = (EntryType)header[1];
+        entry.data = record.substr(kHeaderSize + key_len, data_len);
+        live_size_ += RecordSize(key_len, data_len);
+      } else if (itr != map.end()) {
+        map.erase(itr);
+      }
+      valid += record.size();
+    }
+  }
+  fseek(f, 0, SEEK_END);
+  long file_size = ftell(f);
+  fclose(f);
+  if (file_size < 0 || (size_t)file_size != valid) {
+    LOG(WARNING) << "Dropping " << (file_size - (long)valid)
+                 << " trailing bytes of preferences log " << path_;
+    needs_compaction_ = true;
+  }
+  log_size_ = valid;
+  loaded_ = true;
+  return true;
+}
+
+bool FileStore::append(uint8_t op, const char* key, EntryType type,
+                       const void* data, size_t len) {
+  if (needs_compaction_ && !compact()) return false;
+  if (file_ == nullptr) {
+    file_ = fopen(path_, "ab");
+    if (file_ == nullptr) {
+      LOG(ERROR) << "Failed to open preferences log " << path_;
+      return false;
+    }
+    if (log_size_ == 0) {
+      if (!WriteFully(file_, kMagic, sizeof(kMagic))) {
+        needs_compaction_ = true;
+        return false;
+      }
+      log_size_ = sizeof(kMagic);
+    }
+  }
+  std::string record;
+  EncodeRecord(op, (uint8_t)type, key, data, len, record);
+  if (!WriteFully(file_, record.data(), record.size())) {
+    LOG(ERROR) << "Failed to write to preferences log " << path_;
+    needs_compaction_ = true;
+    return false;
+  }
+  log_size_ += record.size();
+  return true;
+}
+
+bool FileStore::compact() {
+  closeFile();
+  std::string tmp = std::string(path_) + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == nullptr) {
+    LOG(ERROR) << "Failed to create " << tmp.c_str();
+    return false;
+  }
+  bool ok = WriteFully(f, kMagic, sizeof(kMagic));
+  std::string record;
+  for (const auto& itr : entries()) {
+    if (!ok) break;
+    EncodeRecord(kOpPut, (uint8_t)itr.second.type,
+                 roo::string_view(itr.first.data(), itr.first.size()),
+                 itr.second.data.data(), itr.second.data.size(), record);
+    ok = WriteFully(f, record.data(), record.size());
+  }
+  ok = (fclose(f) == 0) && ok;
+  if (ok && rename(tmp.c_str(), path_) != 0) {
+    // Some file systems (e.g. SPIFFS) do not rename over existing files.
+    ::remove(path_);
+    ok = (rename(tmp.c_str(), path_) == 0);
+  }
+  if (!ok) {
+    LOG(ERROR) << "Failed to compact preferences log " << path_;
+    ::remove(tmp.c_str());
+    return false;
+  }
+  log_size_ = sizeof(kMagic) + live_size_;
+  needs_compaction_ = false;
+  return true;
+}
+
+void FileStore::closeFile() {
+  if (file_ == nullptr) return;
+  if (fclose(file_) != 0) {
+    LOG(ERROR) << "Failed to flush preferences log " << path_;
+  }
+  file_ = nullptr;
+}
+
+}  // namespace roo_prefs
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+
+#include "roo_prefs/store/memory_store.h"
+
+namespace roo_prefs {
+
+/// Store that persists values in a log-structured file.
+///
+/// All values are kept in RAM (as in `MemoryStore`); every write and clear
+/// is additionally appended as a checksummed record to the log file. The file
+/// is replayed on the first `begin()`. Records are flushed when the
+/// outermost transaction ends, even if the collection keeps the store open.
+/// When the log grows well beyond the size of the live data, it is compacted
+/// (rewritten to a temporary file and renamed over the original).
+///
+/// A torn trailing record (e.g. after a crash in the middle of a write) is
+/// ignored on replay, and the file is compacted before the next write.
+///
+/// Works with anything that provides stdio: host builds, and ESP32 file
+/// systems mounted through VFS (SPIFFS, LittleFS, FAT).
+///
+/// @code
+/// roo_prefs::FileStore store("/tmp/sim_prefs.log");
+/// roo_prefs::Collection col("sim", store);
+/// @endcode
+class FileStore : public MemoryStore {
+ public:
+  /// Creates the store backed by the specified file. The path must remain
+  /// valid for the lifetime of the store.
+  explicit FileStore(const char* path);
+
+  ~FileStore() override;
+
+  /// Returns the current size of the log file, in bytes.
+  size_t log_size() const { return log_size_; }
+
+ protected:
+  bool begin(const char* collection_name, bool read_only) override;
+  void end() override;
+  void flush() override;
+
+  WriteResult put(const char* key, EntryType type, const void* data,
+                  size_t len) override;
+
+  ClearResult remove(const char* key) override;
+
+ private:
+  bool load();
+  bool append(uint8_t op, const char* key, EntryType type, const void* data,
+              size_t len);
+  bool compact();
+  void closeFile();
+
+  const char* path_;
+  FILE* file_;
+  bool loaded_;
+
+  // True if the file ends with garbage (torn record) that must be dropped
+  // before anything else is appended.
+  bool needs_compaction_;
+
+  size_t log_size_;
+  size_t live_size_;
+};
+
+}  // namespace roo_prefs
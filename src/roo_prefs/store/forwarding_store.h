@@ -0,0 +1,164 @@
+#pragma once
+
+#include "roo_prefs/store/store.h"
+
+namespace roo_prefs {
+
+/// Store that forwards all calls to another store. Use it as a base class for
+/// decorators (e.g. instrumentation), overriding only the methods of interest.
+///
+/// The delegate must outlive the forwarding store, and must not be used by
+/// any collection directly.
+class ForwardingStore : public Store {
+ public:
+  explicit ForwardingStore(Store& delegate) : delegate_(delegate) {}
+
+  bool isKey(const char* key) override { return delegate_.isKey(key); }
+
+  ClearResult clear(const char* key) override { return delegate_.clear(key); }
+
+  WriteResult writeBool(const char* key, bool val) override {
+    return delegate_.writeBool(key, val);
+  }
+
+  WriteResult writeU8(const char* key, uint8_t val) override {
+    return delegate_.writeU8(key, val);
+  }
+
+  WriteResult writeI8(const char* key, int8_t val) override {
+    return delegate_.writeI8(key, val);
+  }
+
+  WriteResult writeU16(const char* key, uint16_t val) override {
+    return delegate_.writeU16(key, val);
+  }
+
+  WriteResult writeI16(const char* key, int16_t val) override {
+    return delegate_.writeI16(key, val);
+  }
+
+  WriteResult writeU32(const char* key, uint32_t val) override {
+    return delegate_.writeU32(key, val);
+  }
+
+  WriteResult writeI32(const char* key, int32_t val) override {
+    return delegate_.writeI32(key, val);
+  }
+
+  WriteResult writeU64(const char* key, uint64_t val) override {
+    return delegate_.writeU64(key, val);
+  }
+
+  WriteResult writeI64(const char* key, int64_t val) override {
+    return delegate_.writeI64(key, val);
+  }
+
+  WriteResult writeFloat(const char* key, float val) override {
+    return delegate_.writeFloat(key, val);
+  }
+
+  WriteResult writeDouble(const char* key, double val) override {
+    return delegate_.writeDouble(key, val);
+  }
+
+  WriteResult writeString(const char* key, roo::string_view val) override {
+    return delegate_.writeString(key, val);
+  }
+
+  WriteResult writeBytes(const char* key, const void* val,
+                         size_t len) override {
+    return delegate_.writeBytes(key, val, len);
+  }
+
+  ReadResult readBool(const char* key, bool& val) override {
+    return delegate_.readBool(key, val);
+  }
+
+  ReadResult readU8(const char* key, uint8_t& val) override {
+    return delegate_.readU8(key, val);
+  }
+
+  ReadResult readI8(const char* key, int8_t& val) override {
+    return delegate_.readI8(key, val);
+  }
+
+  ReadResult readU16(const char* key, uint16_t& val) override {
+    return delegate_.readU16(key, val);
+  }
+
+  ReadResult readI16(const char* key, int16_t& val) override {
+    return delegate_.readI16(key, val);
+  }
+
+  ReadResult readU32(const char* key, uint32_t& val) override {
+    return delegate_.readU32(key, val);
+  }
+
+  ReadResult readI32(const char* key, int32_t& val) override {
+    return delegate_.readI32(key, val);
+  }
+
+  ReadResult readU64(const char* key, uint64_t& val) override {
+    return delegate_.readU64(key, val);
+  }
+
+  ReadResult readI64(const char* key, int64_t& val) override {
+    return delegate_.readI64(key, val);
+  }
+
+  ReadResult readFloat(const char* key, float& val) override {
+    return delegate_.readFloat(key, val);
+  }
+
+  ReadResult readDouble(const char* key, double& val) override {
+    return delegate_.readDouble(key, val);
+  }
+
+  ReadResult readString(const char* key, std::string& val) override {
+    return delegate_.readString(key, val);
+  }
+
+  ReadResult readStringInto(const char* key, char* buf, size_t capacity,
+                            size_t* out_len) override {
+    return delegate_.readStringInto(key, buf, capacity, out_len);
+  }
+
+  ReadResult readBytes(const char* key, void* val, size_t max_len,
+                       size_t* out_len) override {
+    return delegate_.readBytes(key, val, max_len, out_len);
+  }
+
+  ReadResult readBytesLength(const char* key, size_t* out_len) override {
+    return delegate_.readBytesLength(key, out_len);
+  }
+
+  void onWriteSuppressed(const char* key) override {
+    delegate_.onWriteSuppressed(key);
+  }
+
+ protected:
+  bool begin(const char* collection_name, bool read_only) override {
+    return delegate_.begin(collection_name, read_only);
+  }
+
+  void end() override { delegate_.end(); }
+
+  void flush() override { delegate_.flush(); }
+
+  WriteResult writeObjectInternal(const char* key, const void* val,
+                                  size_t size) override {
+    return delegate_.writeObjectInternal(key, val, size);
+  }
+
+  ReadResult readObjectInternal(const char* key, void* val,
+                                size_t size) override {
+    return delegate_.readObjectInternal(key, val, size);
+  }
+
+  Store& delegate() { return delegate_; }
+
+ private:
+  Store& delegate_;
+};
+
+}  // namespace roo_prefs
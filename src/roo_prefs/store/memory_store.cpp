@@ -0,0 +1,229 @@
+#include "roo_prefs/store/memory_store.h"
+
+#include <string.h>
+
+namespace roo_prefs {
+
+MemoryStore::MemoryStore() : entries_(), open_(false), read_only_(true) {}
+
+bool MemoryStore::begin(const char*, bool read_only) {
+  open_ = true;
+  read_only_ = read_only;
+  return true;
+}
+
+void MemoryStore::end() { open_ = false; }
+
+const MemoryStore::Entry* MemoryStore::find(const char* key) const {
+  if (!open_ || key == nullptr) return nullptr;
+  auto itr = entries_.find(key);
+  return itr == entries_.end() ? nullptr : &itr->second;
+}
+
+WriteResult MemoryStore::put(const char* key, EntryType type, const void* data,
+                             size_t len) {
+  if (!is_writable() || key == nullptr) return WriteResult::kError;
+  auto itr = entries_.find(key);
+  if (itr == entries_.end()) {
+    itr = entries_.emplace(key, Entry{type, std::string()}).first;
+  }
+  itr->second.type = type;
+  itr->second.data.assign(static_cast<const char*>(data), len);
+  return WriteResult::kOk;
+}
+
+ClearResult MemoryStore::remove(const char* key) {
+  if (!is_writable() || key == nullptr) return ClearResult::kError;
+  auto itr = entries_.find(key);
+  if (itr == entries_.end()) return ClearResult::kError;
+  entries_.erase(itr);
+  return ClearResult::kOk;
+}
+
+template <typename T>
+ReadResult MemoryStore::readScalar(const char* key, EntryType type, T& val) {
+  const Entry* entry = find(key);
+  if (entry == nullptr) return ReadResult::kNotFound;
+  if (entry->type != type || entry->data.size() != sizeof(T)) {
+    return ReadResult::kWrongType;
+  }
+  memcpy(&val, entry->data.data(), sizeof(T));
+  return ReadResult::kOk;
+}
+
+bool MemoryStore::isKey(const char* key) { return find(key) != nullptr; }
+
+ClearResult MemoryStore::clear(const char* key) { return remove(key); }
+
+WriteResult MemoryStore::writeBytes(const char* key, const void* val,
+                                    size_t len) {
+  if (len == 0) return WriteResult::kError;
+  return put(key, EntryType::kBlob, val, len);
+}
+
+WriteResult MemoryStore::writeObjectInternal(const char* key, const void* val,
+                                             size_t size) {
+  return writeBytes(key, val, size);
+}
+
+WriteResult MemoryStore::writeBool(const char* key, bool val) {
+  uint8_t v = val ? 1 : 0;
+  return put(key, EntryType::kU8, &v, sizeof(v));
+}
+
+WriteResult MemoryStore::writeU8(const char* key, uint8_t val) {
+  return put(key, EntryType::kU8, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeI8(const char* key, int8_t val) {
+  return put(key, EntryType::kI8, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeU16(const char* key, uint16_t val) {
+  return put(key, EntryType::kU16, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeI16(const char* key, int16_t val) {
+  return put(key, EntryType::kI16, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeU32(const char* key, uint32_t val) {
+  return put(key, EntryType::kU32, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeI32(const char* key, int32_t val) {
+  return put(key, EntryType::kI32, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeU64(const char* key, uint64_t val) {
+  return put(key, EntryType::kU64, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeI64(const char* key, int64_t val) {
+  return put(key, EntryType::kI64, &val, sizeof(val));
+}
+
+// As in `PreferencesStore`, floats and doubles are stored as their bit
+// patterns, in U32 / U64 entries.
+WriteResult MemoryStore::writeFloat(const char* key, float val) {
+  return put(key, EntryType::kU32, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeDouble(const char* key, double val) {
+  return put(key, EntryType::kU64, &val, sizeof(val));
+}
+
+WriteResult MemoryStore::writeString(const char* key, roo::string_view val) {
+  return put(key, EntryType::kString, val.data(), val.size());
+}
+
+ReadResult MemoryStore::readObjectInternal(const char* key, void* val,
+                                           size_t size) {
+  const Entry* entry = find(key);
+  if (entry == nullptr) return ReadResult::kNotFound;
+  if (entry->type != EntryType::kBlob || entry->data.size() != size) {
+    return ReadResult::kWrongType;
+  }
+  memcpy(val, entry->data.data(), size);
+  return ReadResult::kOk;
+}
+
+ReadResult MemoryStore::readBool(const char* key, bool& val) {
+  uint8_t v;
+  ReadResult result = readScalar(key, EntryType::kU8, v);
+  if (result == ReadResult::kOk) val = (v == 1);
+  return result;
+}
+
+ReadResult MemoryStore::readU8(const char* key, uint8_t& val) {
+  return readScalar(key, EntryType::kU8, val);
+}
+
+ReadResult MemoryStore::readI8(const char* key, int8_t& val) {
+  return readScalar(key, EntryType::kI8, val);
+}
+
+ReadResult MemoryStore::readU16(const char* key, uint16_t& val) {
+  return readScalar(key, EntryType::kU16, val);
+}
+
+ReadResult MemoryStore::readI16(const char* key, int16_t& val) {
+  return readScalar(key, EntryType::kI16, val);
+}
+
+ReadResult MemoryStore::readU32(const char* key, uint32_t& val) {
+  return readScalar(key, EntryType::kU32, val);
+}
+
+ReadResult MemoryStore::readI32(const char* key, int32_t& val) {
+  return readScalar(key, EntryType::kI32, val);
+}
+
+ReadResult MemoryStore::readU64(const char* key, uint64_t& val) {
+  return readScalar(key, EntryType::kU64, val);
+}
+
+ReadResult MemoryStore::readI64(const char* key, int64_t& val) {
+  return readScalar(key, EntryType::kI64, val);
+}
+
+// Fixed-size blobs are read too, as earlier versions stored floats and
+// doubles that way (see `FileStore`).
+ReadResult MemoryStore::readFloat(const char* key, float& val) {
+  ReadResult result = readScalar(key, EntryType::kU32, val);
+  if (result != ReadResult::kWrongType) return result;
+  return readScalar(key, EntryType::kBlob, val);
+}
+
+ReadResult MemoryStore::readDouble(const char* key, double& val) {
+  ReadResult result = readScalar(key, EntryType::kU64, val);
+  if (result != ReadResult::kWrongType) return result;
+  return readScalar(key, EntryType::kBlob, val);
+}
+
+ReadResult MemoryStore::readString(const char* key, std::string& val) {
+  const Entry* entry = find(key);
+  if (entry == nullptr) return ReadResult::kNotFound;
+  if (entry->type != EntryType::kString && entry->type != EntryType::kBlob) {
+    return ReadResult::kWrongType;
+  }
+  val = entry->data;
+  return ReadResult::kOk;
+}
+
+ReadResult MemoryStore::readStringInto(const char* key, char* buf,
+                                       size_t capacity, size_t* out_len) {
+  const Entry* entry = find(key);
+  if (entry == nullptr) return ReadResult::kNotFound;
+  if (entry->type != EntryType::kString && entry->type != EntryType::kBlob) {
+    return ReadResult::kWrongType;
+  }
+  size_t size = entry->data.size();
+  if (size >= capacity) return ReadResult::kError;
+  memcpy(buf, entry->data.data(), size);
+  buf[size] = '\0';
+  if (out_len != nullptr) *out_len = size;
+  return ReadResult::kOk;
+}
+
+ReadResult MemoryStore::readBytes(const char* key, void* val, size_t max_len,
+                                  size_t* out_len) {
+  const Entry* entry = find(key);
+  if (entry == nullptr) return ReadResult::kNotFound;
+  if (entry->type != EntryType::kBlob) return ReadResult::kWrongType;
+  size_t size = entry->data.size();
+  if (out_len != nullptr) *out_len = size;
+  if (size > max_len) return ReadResult::kError;
+  memcpy(val, entry->data.data(), size);
+  return ReadResult::kOk;
+}
+
+ReadResult MemoryStore::readBytesLength(const char* key, size_t* out_len) {
+  const Entry* entry = find(key);
+  if (entry == nullptr) return ReadResult::kNotFound;
+  if (entry->type != EntryType::kBlob) return ReadResult::kWrongType;
+  if (out_len != nullptr) *out_len = entry->data.size();
+  return ReadResult::kOk;
+}
+
+}  // namespace roo_prefs
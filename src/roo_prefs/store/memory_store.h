@@ -0,0 +1,149 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include "roo_prefs/store/store.h"
+
+namespace roo_prefs {
+
+/// Store that keeps all values in RAM. Data survives `begin()` / `end()`
+/// cycles for as long as the store object lives, but is not persisted.
+///
+/// Useful for host-side simulators and tests, where the emulated `Preferences`
+/// are unnecessarily slow, and for collections that do not need to survive a
+/// reset.
+///
+/// @code
+/// roo_prefs::MemoryStore store;
+/// roo_prefs::Collection col("sim", store);
+/// roo_prefs::Int32 pref(col, "pref");
+/// @endcode
+class MemoryStore : public Store {
+ public:
+  MemoryStore();
+
+  bool isKey(const char* key) override;
+
+  ClearResult clear(const char* key) override;
+
+  WriteResult writeBool(const char* key, bool val) override;
+
+  WriteResult writeU8(const char* key, uint8_t val) override;
+
+  WriteResult writeI8(const char* key, int8_t val) override;
+
+  WriteResult writeU16(const char* key, uint16_t val) override;
+
+  WriteResult writeI16(const char* key, int16_t val) override;
+
+  WriteResult writeU32(const char* key, uint32_t val) override;
+
+  WriteResult writeI32(const char* key, int32_t val) override;
+
+  WriteResult writeU64(const char* key, uint64_t val) override;
+
+  WriteResult writeI64(const char* key, int64_t val) override;
+
+  WriteResult writeFloat(const char* key, float val) override;
+
+  WriteResult writeDouble(const char* key, double val) override;
+
+  WriteResult writeString(const char* key, roo::string_view val) override;
+
+  WriteResult writeBytes(const char* key, const void* val,
+                         size_t len) override;
+
+  ReadResult readBool(const char* key, bool& val) override;
+
+  ReadResult readU8(const char* key, uint8_t& val) override;
+
+  ReadResult readI8(const char* key, int8_t& val) override;
+
+  ReadResult readU16(const char* key, uint16_t& val) override;
+
+  ReadResult readI16(const char* key, int16_t& val) override;
+
+  ReadResult readU32(const char* key, uint32_t& val) override;
+
+  ReadResult readI32(const char* key, int32_t& val) override;
+
+  ReadResult readU64(const char* key, uint64_t& val) override;
+
+  ReadResult readI64(const char* key, int64_t& val) override;
+
+  ReadResult readFloat(const char* key, float& val) override;
+
+  ReadResult readDouble(const char* key, double& val) override;
+
+  ReadResult readString(const char* key, std::string& val) override;
+
+  ReadResult readStringInto(const char* key, char* buf, size_t capacity,
+                            size_t* out_len) override;
+
+  ReadResult readBytes(const char* key, void* val, size_t max_len,
+                       size_t* out_len) override;
+
+  ReadResult readBytesLength(const char* key, size_t* out_len) override;
+
+  /// Returns the number of stored keys.
+  size_t size() const { return entries_.size(); }
+
+ protected:
+  /// Type tags of stored entries. Mirror the NVS entry types, so that
+  /// type-mismatch semantics match `PreferencesStore`.
+  enum class EntryType : uint8_t {
+    kU8 = 0,
+    kI8 = 1,
+    kU16 = 2,
+    kI16 = 3,
+    kU32 = 4,
+    kI32 = 5,
+    kU64 = 6,
+    kI64 = 7,
+    kString = 8,
+    kBlob = 9,
+  };
+
+  struct Entry {
+    EntryType type;
+    std::string data;
+  };
+
+  using EntryMap = std::map<std::string, Entry, std::less<>>;
+
+  bool begin(const char* collection_name, bool read_only) override;
+  void end() override;
+
+  WriteResult writeObjectInternal(const char* key, const void* val,
+                                  size_t size) override;
+
+  ReadResult readObjectInternal(const char* key, void* val,
+                                size_t size) override;
+
+  /// Stores the entry, replacing any previous value. Subclasses override this
+  /// (and `remove()`) to persist the changes.
+  virtual WriteResult put(const char* key, EntryType type, const void* data,
+                          size_t len);
+
+  /// Removes the entry. Returns `ClearResult::kError` if it does not exist.
+  virtual ClearResult remove(const char* key);
+
+  bool is_open() const { return open_; }
+  bool is_writable() const { return open_ && !read_only_; }
+
+  EntryMap& entries() { return entries_; }
+
+ private:
+  const Entry* find(const char* key) const;
+
+  template <typename T>
+  ReadResult readScalar(const char* key, EntryType type, T& val);
+
+  EntryMap entries_;
+  bool open_;
+  bool read_only_;
+};
+
+}  // namespace roo_prefs
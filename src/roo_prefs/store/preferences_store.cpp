@@ -1,5 +1,11 @@
 #include "roo_prefs/store/preferences_store.h"
 
+#include <string.h>
+
+#include <algorithm>
+
+#include "roo_prefs/latency_stats.h"
+
 namespace roo_prefs {
 
 namespace {
@@ -32,300 +38,460 @@ bool PreferencesStore::begin(const char* collection_name, bool read_only) {
 
 void PreferencesStore::end() { prefs_.end(); }
 
-bool PreferencesStore::isKey(const char* key) { return prefs_.isKey(key); }
+void PreferencesStore::setKeyIndexEnabled(bool enabled) {
+  if (!enabled) {
+    index_.reset();
+  } else if (index_ == nullptr) {
+    index_.reset(new KeyIndex());
+  }
+}
+
+const PreferencesStore::KeyInfo* PreferencesStore::lookup(
+    const char* key) const {
+  if (index_ == nullptr || index_->empty()) return nullptr;
+  auto itr = index_->find(key);
+  return (itr == index_->end()) ? nullptr : &itr->second;
+}
+
+void PreferencesStore::remember(const char* key, PreferenceType type,
+                                size_t size) {
+  if (index_ == nullptr) return;
+  auto itr = index_->find(key);
+  if (itr == index_->end()) {
+    index_->emplace(key, KeyInfo{type, size});
+  } else {
+    itr->second = KeyInfo{type, size};
+  }
+}
+
+void PreferencesStore::forget(const char* key) {
+  if (index_ == nullptr) return;
+  auto itr = index_->find(key);
+  if (itr != index_->end()) index_->erase(itr);
+}
+
+WriteResult PreferencesStore::recordWrite(const char* key, bool ok,
+                                          PreferenceType type, size_t size) {
+  if (!ok) {
+    // The state of the entry is unknown after a failed write.
+    forget(key);
+    return WriteResult::kError;
+  }
+  remember(key, type, size);
+  return WriteResult::kOk;
+}
+
+ReadResult PreferencesStore::classifyMiss(const char* key,
+                                          PreferenceType expected_type) {
+  // Only runs on the slow path, because `getType()` probes the entry types
+  // one by one.
+  PreferenceType type = prefs_.getType(key);
+  if (type == PT_INVALID) {
+    remember(key, PT_INVALID, 0);
+    return ReadResult::kNotFound;
+  }
+  if (type != expected_type) {
+    if (type != PT_BLOB && type != PT_STR) remember(key, type, 0);
+    return ReadResult::kWrongType;
+  }
+  // The entry exists with the expected type, yet could not be read.
+  return ReadResult::kError;
+}
+
+ReadResult PreferencesStore::probeBlob(const char* key, size_t& size) {
+  const KeyInfo* info = lookup(key);
+  if (info != nullptr) {
+    if (info->type == PT_INVALID) return ReadResult::kNotFound;
+    if (info->type != PT_BLOB) return ReadResult::kWrongType;
+    size = info->size;
+    return ReadResult::kOk;
+  }
+  size = prefs_.getBytesLength(key);
+  if (size == 0) return classifyMiss(key, PT_BLOB);
+  remember(key, PT_BLOB, size);
+  return ReadResult::kOk;
+}
+
+// Reads a scalar using a single typed lookup. `Preferences` reports failures
+// only by returning the supplied default, so we pass a sentinel, and only
+// inspect the entry further if the sentinel comes back - i.e. if the key is
+// missing, has a different type, or actually stores the sentinel value.
+template <typename T>
+ReadResult PreferencesStore::readScalar(const char* key, PreferenceType type,
+                                        T (Preferences::*getter)(const char*,
+                                                                 T),
+                                        T sentinel, T& val) {
+  const KeyInfo* info = lookup(key);
+  if (info != nullptr) {
+    if (info->type == PT_INVALID) return ReadResult::kNotFound;
+    if (info->type != type) return ReadResult::kWrongType;
+  }
+  T result = (prefs_.*getter)(key, sentinel);
+  if (result == sentinel) {
+    if (info == nullptr) {
+      ReadResult status = classifyMiss(key, type);
+      if (status != ReadResult::kError) return status;
+    }
+    // The entry has the expected type; confirm that it stores the sentinel.
+    if ((prefs_.*getter)(key, static_cast<T>(~sentinel)) != sentinel) {
+      forget(key);
+      return ReadResult::kError;
+    }
+  }
+  if (info == nullptr) remember(key, type, 0);
+  val = result;
+  return ReadResult::kOk;
+}
+
+// Reads a float or double, stored as its bit pattern in a `Bits` entry, or,
+// by earlier versions, as a fixed-size blob.
+template <typename T, typename Bits>
+ReadResult PreferencesStore::readFloatingPoint(
+    const char* key, PreferenceType type,
+    Bits (Preferences::*getter)(const char*, Bits), Bits sentinel, T& val) {
+  const KeyInfo* info = lookup(key);
+  if (info == nullptr || info->type != PT_BLOB) {
+    Bits bits;
+    ReadResult status = readScalar(key, type, getter, sentinel, bits);
+    if (status == ReadResult::kOk) memcpy(&val, &bits, sizeof(val));
+    if (status != ReadResult::kWrongType) return status;
+  }
+  return readBlobScalar(key, val);
+}
+
+// Reads a float or double stored as a fixed-size blob.
+template <typename T>
+ReadResult PreferencesStore::readBlobScalar(const char* key, T& val) {
+  const KeyInfo* info = lookup(key);
+  if (info != nullptr && (info->type != PT_BLOB || info->size != sizeof(T))) {
+    return (info->type == PT_INVALID) ? ReadResult::kNotFound
+                                      : ReadResult::kWrongType;
+  }
+  T result;
+  size_t size = prefs_.getBytes(key, &result, sizeof(result));
+  if (size == sizeof(result)) {
+    if (info == nullptr) remember(key, PT_BLOB, size);
+    val = result;
+    return ReadResult::kOk;
+  }
+  if (info != nullptr) {
+    forget(key);
+    return ReadResult::kError;
+  }
+  if (size != 0) {
+    remember(key, PT_BLOB, size);
+    return ReadResult::kWrongType;
+  }
+  ReadResult status = classifyMiss(key, PT_BLOB);
+  // A blob that does not fit in the buffer has the wrong length.
+  return (status == ReadResult::kError) ? ReadResult::kWrongType : status;
+}
+
+bool PreferencesStore::isKey(const char* key) {
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  const KeyInfo* info = lookup(key);
+  if (info != nullptr) return info->type != PT_INVALID;
+  if (prefs_.isKey(key)) return true;
+  remember(key, PT_INVALID, 0);
+  return false;
+}
 
 ClearResult PreferencesStore::clear(const char* key) {
-  return prefs_.remove(key) ? ClearResult::kOk : ClearResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kClear);
+  if (!prefs_.remove(key)) {
+    forget(key);
+    return ClearResult::kError;
+  }
+  remember(key, PT_INVALID, 0);
+  return ClearResult::kOk;
 }
 
 WriteResult PreferencesStore::writeBytes(const char* key, const void* val,
                                          size_t len) {
-  return (prefs_.putBytes(key, val, len) > 0) ? WriteResult::kOk
-                                              : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putBytes(key, val, len) > 0, PT_BLOB, len);
 }
 
 WriteResult PreferencesStore::writeObjectInternal(const char* key,
                                                   const void* val,
                                                   size_t size) {
+  // Measured by writeBytes().
   return writeBytes(key, val, size);
 }
 
 WriteResult PreferencesStore::writeBool(const char* key, bool val) {
-  return (prefs_.putBool(key, val) > 0) ? WriteResult::kOk
-                                        : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putBool(key, val) > 0, PT_U8, 0);
 }
 
 WriteResult PreferencesStore::writeU8(const char* key, uint8_t val) {
-  return (prefs_.putUChar(key, val) > 0) ? WriteResult::kOk
-                                         : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putUChar(key, val) > 0, PT_U8, 0);
 }
 
 WriteResult PreferencesStore::writeI8(const char* key, int8_t val) {
-  return (prefs_.putChar(key, val) > 0) ? WriteResult::kOk
-                                        : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putChar(key, val) > 0, PT_I8, 0);
 }
 
 WriteResult PreferencesStore::writeU16(const char* key, uint16_t val) {
-  return (prefs_.putUShort(key, val) > 0) ? WriteResult::kOk
-                                          : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putUShort(key, val) > 0, PT_U16, 0);
 }
 
 WriteResult PreferencesStore::writeI16(const char* key, int16_t val) {
-  return (prefs_.putShort(key, val) > 0) ? WriteResult::kOk
-                                         : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putShort(key, val) > 0, PT_I16, 0);
 }
 
 WriteResult PreferencesStore::writeU32(const char* key, uint32_t val) {
-  return (prefs_.putULong(key, val) > 0) ? WriteResult::kOk
-                                         : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putULong(key, val) > 0, PT_U32, 0);
 }
 
 WriteResult PreferencesStore::writeI32(const char* key, int32_t val) {
-  return (prefs_.putLong(key, val) > 0) ? WriteResult::kOk
-                                        : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putLong(key, val) > 0, PT_I32, 0);
 }
 
 WriteResult PreferencesStore::writeU64(const char* key, uint64_t val) {
-  return (prefs_.putULong64(key, val) > 0) ? WriteResult::kOk
-                                           : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putULong64(key, val) > 0, PT_U64, 0);
 }
 
 WriteResult PreferencesStore::writeI64(const char* key, int64_t val) {
-  return (prefs_.putLong64(key, val) > 0) ? WriteResult::kOk
-                                          : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  return recordWrite(key, prefs_.putLong64(key, val) > 0, PT_I64, 0);
 }
 
+// Floats and doubles are stored as their bit patterns, in single U32 / U64
+// entries, rather than as blobs (as `putFloat()` / `putDouble()` do). Writing
+// an existing key replaces its type, so values stored as blobs by earlier
+// versions are migrated on the next write.
 WriteResult PreferencesStore::writeFloat(const char* key, float val) {
-  return (prefs_.putFloat(key, val) > 0) ? WriteResult::kOk
-                                         : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  uint32_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return recordWrite(key, prefs_.putULong(key, bits) > 0, PT_U32, 0);
 }
 
 WriteResult PreferencesStore::writeDouble(const char* key, double val) {
-  return (prefs_.putDouble(key, val) > 0) ? WriteResult::kOk
-                                          : WriteResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
+  uint64_t bits;
+  memcpy(&bits, &val, sizeof(bits));
+  return recordWrite(key, prefs_.putULong64(key, bits) > 0, PT_U64, 0);
 }
 
 WriteResult PreferencesStore::writeString(const char* key,
                                           roo::string_view val) {
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kWrite);
   if (val.size() == 0) {
-    if (IsStoredEmptyString(prefs_, key)) return WriteResult::kOk;
+    const KeyInfo* info = lookup(key);
+    if (info != nullptr && info->type == PT_STR && info->size == 0) {
+      return WriteResult::kOk;
+    }
+    if (IsStoredEmptyString(prefs_, key)) {
+      remember(key, PT_STR, 0);
+      return WriteResult::kOk;
+    }
     prefs_.putString(key, "");
-    return IsStoredEmptyString(prefs_, key) ? WriteResult::kOk
-                                            : WriteResult::kError;
+    return recordWrite(key, IsStoredEmptyString(prefs_, key), PT_STR, 0);
   }
-  return (prefs_.putBytes(key, val.data(), val.size()) > 0)
-             ? WriteResult::kOk
-             : WriteResult::kError;
+  return recordWrite(key, prefs_.putBytes(key, val.data(), val.size()) > 0,
+                     PT_BLOB, val.size());
 }
 
 ReadResult PreferencesStore::readObjectInternal(const char* key, void* val,
                                                 size_t size) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_BLOB) return ReadResult::kWrongType;
-  if (prefs_.getBytesLength(key) != size) {
-    return ReadResult::kWrongType;
-  }
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  size_t stored_size;
+  ReadResult status = probeBlob(key, stored_size);
+  if (status != ReadResult::kOk) return status;
+  if (stored_size != size) return ReadResult::kWrongType;
   if (prefs_.getBytes(key, val, size) != size) {
+    forget(key);
     return ReadResult::kError;
   }
   return ReadResult::kOk;
 }
 
 ReadResult PreferencesStore::readBool(const char* key, bool& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_U8) return ReadResult::kWrongType;
-  bool v1 = prefs_.getBool(key, false);
-  bool v2 = prefs_.getBool(key, true);
-  if (v1 != v2) {
-    return ReadResult::kError;
-  }
-  val = v1;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  uint8_t result;
+  ReadResult status = readScalar(key, PT_U8, &Preferences::getUChar,
+                                 static_cast<uint8_t>(0xDF), result);
+  if (status == ReadResult::kOk) val = (result == 1);
+  return status;
 }
 
 ReadResult PreferencesStore::readU8(const char* key, uint8_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_U8) return ReadResult::kWrongType;
-  constexpr uint8_t magic = 0xDF;
-  uint8_t result = prefs_.getUChar(key, magic);
-  if (result == magic) {
-    constexpr uint8_t magic2 = 0x12;
-    if (prefs_.getUChar(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_U8, &Preferences::getUChar,
+                    static_cast<uint8_t>(0xDF), val);
 }
 
 ReadResult PreferencesStore::readI8(const char* key, int8_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_I8) return ReadResult::kWrongType;
-  constexpr int8_t magic = 0xDF;
-  int8_t result = prefs_.getChar(key, magic);
-  if (result == magic) {
-    constexpr int8_t magic2 = 0x12;
-    if (prefs_.getChar(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_I8, &Preferences::getChar,
+                    static_cast<int8_t>(0xDF), val);
 }
 
 ReadResult PreferencesStore::readU16(const char* key, uint16_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_U16) return ReadResult::kWrongType;
-  constexpr uint16_t magic = 0xDFB1;
-  uint16_t result = prefs_.getUShort(key, magic);
-  if (result == magic) {
-    constexpr uint16_t magic2 = 0x1223;
-    if (prefs_.getUShort(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_U16, &Preferences::getUShort,
+                    static_cast<uint16_t>(0xDFB1), val);
 }
 
 ReadResult PreferencesStore::readI16(const char* key, int16_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_I16) return ReadResult::kWrongType;
-  constexpr int16_t magic = 0xDFB1;
-  int16_t result = prefs_.getShort(key, magic);
-  if (result == magic) {
-    constexpr int16_t magic2 = 0x1223;
-    if (prefs_.getShort(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_I16, &Preferences::getShort,
+                    static_cast<int16_t>(0xDFB1), val);
 }
 
 ReadResult PreferencesStore::readU32(const char* key, uint32_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_U32) return ReadResult::kWrongType;
-  constexpr uint32_t magic = 0xDFB1BEEF;
-  uint32_t result = prefs_.getULong(key, magic);
-  if (result == magic) {
-    constexpr uint32_t magic2 = 0x12345678;
-    if (prefs_.getULong(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_U32, &Preferences::getULong,
+                    static_cast<uint32_t>(0xDFB1BEEF), val);
 }
 
 ReadResult PreferencesStore::readI32(const char* key, int32_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_I32) return ReadResult::kWrongType;
-  constexpr int32_t magic = 0xDFB1BEEF;
-  int32_t result = prefs_.getLong(key, magic);
-  if (result == magic) {
-    constexpr int32_t magic2 = 0x12345678;
-    if (prefs_.getLong(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_I32, &Preferences::getLong,
+                    static_cast<int32_t>(0xDFB1BEEF), val);
 }
 
 ReadResult PreferencesStore::readU64(const char* key, uint64_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_U64) return ReadResult::kWrongType;
-  constexpr uint64_t magic = 0x3E3E1254DFB1BEEFLL;
-  uint64_t result = prefs_.getULong64(key, magic);
-  if (result == magic) {
-    constexpr uint64_t magic2 = 0x1234567812345678LL;
-    if (prefs_.getULong64(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_U64, &Preferences::getULong64,
+                    static_cast<uint64_t>(0x3E3E1254DFB1BEEFLL), val);
 }
 
 ReadResult PreferencesStore::readI64(const char* key, int64_t& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_I64) return ReadResult::kWrongType;
-  constexpr int64_t magic = 0x3E3E1254DFB1BEEF;
-  int64_t result = prefs_.getLong64(key, magic);
-  if (result == magic) {
-    constexpr int64_t magic2 = 0x1234567812345678LL;
-    if (prefs_.getLong64(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readScalar(key, PT_I64, &Preferences::getLong64,
+                    static_cast<int64_t>(0x3E3E1254DFB1BEEFLL), val);
 }
 
 ReadResult PreferencesStore::readFloat(const char* key, float& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_BLOB) return ReadResult::kWrongType;
-  constexpr float magic = -0.123456;
-  float result = prefs_.getFloat(key, magic);
-  if (result == magic) {
-    constexpr float magic2 = 1.54e10;
-    if (prefs_.getFloat(key, magic2) != result) return ReadResult::kError;
-  }
-  val = result;
-  return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readFloatingPoint(key, PT_U32, &Preferences::getULong,
+                           static_cast<uint32_t>(0xDFB1BEEF), val);
 }
 
 ReadResult PreferencesStore::readDouble(const char* key, double& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_BLOB) return ReadResult::kWrongType;
-  constexpr double magic = -0.123456;
-  double result = prefs_.getDouble(key, magic);
-  if (result == magic) {
-    constexpr double magic2 = 1.54e10;
-    if (prefs_.getDouble(key, magic2) != result) return ReadResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  return readFloatingPoint(key, PT_U64, &Preferences::getULong64,
+                           static_cast<uint64_t>(0x3E3E1254DFB1BEEFLL), val);
+}
+
+ReadResult PreferencesStore::probeString(const char* key, PreferenceType& type,
+                                         size_t& size) {
+  const KeyInfo* info = lookup(key);
+  if (info != nullptr) {
+    type = info->type;
+    size = info->size;
+  } else {
+    // Non-empty strings are stored as blobs; check that first.
+    size = prefs_.getBytesLength(key);
+    type = (size > 0) ? PT_BLOB : prefs_.getType(key);
+    if (type == PT_INVALID || type == PT_BLOB) remember(key, type, size);
   }
-  val = result;
+  if (type == PT_INVALID) return ReadResult::kNotFound;
+  if (type != PT_BLOB && type != PT_STR) return ReadResult::kWrongType;
   return ReadResult::kOk;
 }
 
+// Reads a legacy string entry into the buffer. Returns false if it does not
+// fit, or cannot be read.
+bool PreferencesStore::readStoredString(const char* key, char* buf,
+                                        size_t capacity, size_t& len) {
+  // Returns the length including the terminating NUL, or zero on failure.
+  size_t result = prefs_.getString(key, buf, capacity);
+  if (result == 0) return false;
+  len = result - 1;
+  remember(key, PT_STR, len);
+  return true;
+}
+
 ReadResult PreferencesStore::readString(const char* key, std::string& val) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type == PT_STR) return ReadStoredString(prefs_, key, val);
-  if (type != PT_BLOB) return ReadResult::kWrongType;
-  size_t size = prefs_.getBytesLength(key);
-  if (size == 0) {
-    val.clear();
-    return ReadResult::kOk;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  PreferenceType type;
+  size_t size;
+  ReadResult status = probeString(key, type, size);
+  if (status != ReadResult::kOk) return status;
+  if (type == PT_STR) {
+    // The length of legacy strings is only known once they have been read.
+    // Try reading into the existing storage of `val` (or the remembered
+    // length) first, and only go through an Arduino `String` if it turns out
+    // to be too short. The buffer includes room for the terminating NUL, and
+    // never exceeds the existing capacity unless the string needs more, so
+    // that reusing `val` across reads does not reallocate.
+    size_t capacity = std::max(val.capacity(), std::max(size + 1, size_t{32}));
+    val.resize(capacity);
+    size_t len;
+    if (readStoredString(key, &val[0], capacity, len)) {
+      val.resize(len);
+      return ReadResult::kOk;
+    }
+    status = ReadStoredString(prefs_, key, val);
+    if (status == ReadResult::kOk) remember(key, PT_STR, val.size());
+    return status;
   }
-  auto buf = std::unique_ptr<char[]>(new char[size]);
-  if (prefs_.getBytes(key, &buf[0], size) == size) {
-    val = std::string(&buf[0], size);
+  // Read the blob straight into the string's own buffer.
+  val.resize(size);
+  if (size == 0 || prefs_.getBytes(key, &val[0], size) == size) {
     return ReadResult::kOk;
   }
+  val.clear();
+  forget(key);
   return ReadResult::kError;
 }
 
+ReadResult PreferencesStore::readStringInto(const char* key, char* buf,
+                                            size_t capacity, size_t* out_len) {
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  PreferenceType type;
+  size_t size;
+  ReadResult status = probeString(key, type, size);
+  if (status != ReadResult::kOk) return status;
+  if (type == PT_STR) {
+    size_t len;
+    if (!readStoredString(key, buf, capacity, len)) return ReadResult::kError;
+    if (out_len != nullptr) *out_len = len;
+    return ReadResult::kOk;
+  }
+  if (size >= capacity) return ReadResult::kError;
+  if (size > 0 && prefs_.getBytes(key, buf, size) != size) {
+    forget(key);
+    return ReadResult::kError;
+  }
+  buf[size] = '\0';
+  if (out_len != nullptr) *out_len = size;
+  return ReadResult::kOk;
+}
+
 ReadResult PreferencesStore::readBytes(const char* key, void* val,
                                        size_t max_len, size_t* out_len) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_BLOB) return ReadResult::kWrongType;
-  size_t size = prefs_.getBytesLength(key);
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  size_t size;
+  ReadResult status = probeBlob(key, size);
+  if (status != ReadResult::kOk) return status;
   if (out_len != nullptr) *out_len = size;
-  if (size == 0) return ReadResult::kOk;
   if (size > max_len) return ReadResult::kError;
   if (prefs_.getBytes(key, val, size) == size) {
     return ReadResult::kOk;
   }
+  forget(key);
   return ReadResult::kError;
 }
 
 ReadResult PreferencesStore::readBytesLength(const char* key, size_t* out_len) {
-  PreferenceType type = prefs_.getType(key);
-  if (type == PT_INVALID) return ReadResult::kNotFound;
-  if (type != PT_BLOB) return ReadResult::kWrongType;
-  size_t size = prefs_.getBytesLength(key);
-  if (size == 0) return ReadResult::kError;
+  ROO_PREFS_MEASURE_LATENCY(LatencyOp::kRead);
+  size_t size;
+  ReadResult status = probeBlob(key, size);
+  if (status != ReadResult::kOk) return status;
   if (out_len != nullptr) *out_len = size;
   return ReadResult::kOk;
 }
 
-}  // namespace roo_prefs
\ No newline at end of file
+}  // namespace roo_prefs
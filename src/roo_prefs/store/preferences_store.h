@@ -1,102 +1,161 @@
 #pragma once
 
+#include <functional>
+#include <map>
 #include <memory>
+#include <string>
 
 #include "Preferences.h"
 #include "roo_backport.h"
 #include "roo_backport/string_view.h"
 #include "roo_prefs/status.h"
+#include "roo_prefs/store/store.h"
 
 namespace roo_prefs {
 
-/// Low-level wrapper around the underlying preferences storage.
-class PreferencesStore {
+/// Store backed by the Arduino `Preferences` library (NVS on ESP32). This is
+/// the default backend of a `Collection`.
+class PreferencesStore : public Store {
  public:
-  bool isKey(const char* key);
+  PreferencesStore() : prefs_(), index_() {}
 
-  ClearResult clear(const char* key);
+  /// Enables or disables the key metadata index.
+  ///
+  /// When enabled, the store remembers the type (and, for blobs, the length)
+  /// of every key it has read or written, including keys found to be missing.
+  /// Subsequent reads then skip the `getType()` / `getBytesLength()` lookups,
+  /// and reads of missing keys do not touch the storage at all. The index is
+  /// kept up to date by the store's own writes and clears, and persists
+  /// across transactions.
+  ///
+  /// Costs a few dozen bytes of RAM per key; nothing but a pointer while
+  /// disabled. Only enable it if the namespace is not modified through other
+  /// `Preferences` handles.
+  void setKeyIndexEnabled(bool enabled);
 
-  template <typename T>
-  WriteResult writeObject(const char* key, const T& val) {
-    return writeObjectInternal(key, &val, sizeof(val));
-  }
+  bool isKeyIndexEnabled() const { return index_ != nullptr; }
+
+  bool isKey(const char* key) override;
+
+  ClearResult clear(const char* key) override;
 
-  WriteResult writeBool(const char* key, bool val);
+  WriteResult writeBool(const char* key, bool val) override;
 
-  WriteResult writeU8(const char* key, uint8_t val);
+  WriteResult writeU8(const char* key, uint8_t val) override;
 
-  WriteResult writeI8(const char* key, int8_t val);
+  WriteResult writeI8(const char* key, int8_t val) override;
 
-  WriteResult writeU16(const char* key, uint16_t val);
+  WriteResult writeU16(const char* key, uint16_t val) override;
 
-  WriteResult writeI16(const char* key, int16_t val);
+  WriteResult writeI16(const char* key, int16_t val) override;
 
-  WriteResult writeU32(const char* key, uint32_t val);
+  WriteResult writeU32(const char* key, uint32_t val) override;
 
-  WriteResult writeI32(const char* key, int32_t val);
+  WriteResult writeI32(const char* key, int32_t val) override;
 
-  WriteResult writeU64(const char* key, uint64_t val);
+  WriteResult writeU64(const char* key, uint64_t val) override;
 
-  WriteResult writeI64(const char* key, int64_t val);
+  WriteResult writeI64(const char* key, int64_t val) override;
 
-  WriteResult writeFloat(const char* key, float val);
+  WriteResult writeFloat(const char* key, float val) override;
 
-  WriteResult writeDouble(const char* key, double val);
+  WriteResult writeDouble(const char* key, double val) override;
 
-  WriteResult writeString(const char* key, roo::string_view val);
+  WriteResult writeString(const char* key, roo::string_view val) override;
 
   /// Stores a raw byte blob.
   ///
   /// Empty blobs are unsupported because the underlying Arduino
   /// `Preferences::putBytes()` API rejects zero-length writes.
-  WriteResult writeBytes(const char* key, const void* val, size_t len);
+  WriteResult writeBytes(const char* key, const void* val,
+                         size_t len) override;
 
-  template <typename T>
-  ReadResult readObject(const char* key, T& val) {
-    return readObjectInternal(key, &val, sizeof(val));
-  }
+  ReadResult readBool(const char* key, bool& val) override;
 
-  ReadResult readBool(const char* key, bool& val);
+  ReadResult readU8(const char* key, uint8_t& val) override;
 
-  ReadResult readU8(const char* key, uint8_t& val);
+  ReadResult readI8(const char* key, int8_t& val) override;
 
-  ReadResult readI8(const char* key, int8_t& val);
+  ReadResult readU16(const char* key, uint16_t& val) override;
 
-  ReadResult readU16(const char* key, uint16_t& val);
+  ReadResult readI16(const char* key, int16_t& val) override;
 
-  ReadResult readI16(const char* key, int16_t& val);
+  ReadResult readU32(const char* key, uint32_t& val) override;
 
-  ReadResult readU32(const char* key, uint32_t& val);
+  ReadResult readI32(const char* key, int32_t& val) override;
 
-  ReadResult readI32(const char* key, int32_t& val);
+  ReadResult readU64(const char* key, uint64_t& val) override;
 
-  ReadResult readU64(const char* key, uint64_t& val);
+  ReadResult readI64(const char* key, int64_t& val) override;
 
-  ReadResult readI64(const char* key, int64_t& val);
+  ReadResult readFloat(const char* key, float& val) override;
 
-  ReadResult readFloat(const char* key, float& val);
+  ReadResult readDouble(const char* key, double& val) override;
 
-  ReadResult readDouble(const char* key, double& val);
+  ReadResult readString(const char* key, std::string& val) override;
 
-  ReadResult readString(const char* key, std::string& val);
+  ReadResult readStringInto(const char* key, char* buf, size_t capacity,
+                            size_t* out_len) override;
 
   ReadResult readBytes(const char* key, void* val, size_t max_len,
-                       size_t* out_len);
+                       size_t* out_len) override;
 
-  ReadResult readBytesLength(const char* key, size_t* out_len);
+  ReadResult readBytesLength(const char* key, size_t* out_len) override;
 
  private:
-  friend class Collection;
-
-  bool begin(const char* collection_name, bool read_only);
-  void end();
+  bool begin(const char* collection_name, bool read_only) override;
+  void end() override;
 
   WriteResult writeObjectInternal(const char* key, const void* val,
-                                  size_t size);
+                                  size_t size) override;
+
+  ReadResult readObjectInternal(const char* key, void* val,
+                                size_t size) override;
+
+  // Metadata of a stored entry. `type` is PT_INVALID for keys known to be
+  // absent. `size` is the payload length for blobs and strings.
+  struct KeyInfo {
+    PreferenceType type;
+    size_t size;
+  };
+
+  // Returns the cached metadata, or nullptr if unknown.
+  const KeyInfo* lookup(const char* key) const;
+  void remember(const char* key, PreferenceType type, size_t size);
+  void forget(const char* key);
+
+  WriteResult recordWrite(const char* key, bool ok, PreferenceType type,
+                          size_t size);
+
+  ReadResult classifyMiss(const char* key, PreferenceType expected_type);
+
+  ReadResult probeBlob(const char* key, size_t& size);
+
+  // Resolves the type (PT_BLOB or PT_STR) and the length of a string entry.
+  ReadResult probeString(const char* key, PreferenceType& type, size_t& size);
+
+  bool readStoredString(const char* key, char* buf, size_t capacity,
+                        size_t& len);
+
+  template <typename T>
+  ReadResult readScalar(const char* key, PreferenceType type,
+                        T (Preferences::*getter)(const char*, T), T sentinel,
+                        T& val);
+
+  template <typename T, typename Bits>
+  ReadResult readFloatingPoint(const char* key, PreferenceType type,
+                               Bits (Preferences::*getter)(const char*, Bits),
+                               Bits sentinel, T& val);
+
+  template <typename T>
+  ReadResult readBlobScalar(const char* key, T& val);
 
-  ReadResult readObjectInternal(const char* key, void* val, size_t size);
+  using KeyIndex = std::map<std::string, KeyInfo, std::less<>>;
 
   Preferences prefs_;
+  // Allocated while the index is enabled, so that the store stays small
+  // enough to be embedded in every collection.
+  std::unique_ptr<KeyIndex> index_;
 };
 
 }  // namespace roo_prefs
\ No newline at end of file
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <string>
+
+#include "roo_backport.h"
+#include "roo_backport/string_view.h"
+#include "roo_prefs/status.h"
+
+namespace roo_prefs {
+
+/// The maximum length of a key, not counting the terminating zero, in the
+/// ESP32 NVS (see `PreferencesStore`).
+constexpr size_t kMaxKeyLength = 15;
+
+/// Abstract storage backend behind a `Collection`.
+///
+/// A store instance serves a single collection at a time. The collection calls
+/// `begin()` when the outermost transaction opens, and `end()` when it closes;
+/// all reads and writes happen in between.
+///
+/// Implementations must keep the semantics of `PreferencesStore`: reads of a
+/// missing key return `ReadResult::kNotFound`, and reads of a key stored with
+/// an incompatible type return `ReadResult::kWrongType`.
+class Store {
+ public:
+  virtual ~Store() = default;
+
+  virtual bool isKey(const char* key) = 0;
+
+  virtual ClearResult clear(const char* key) = 0;
+
+  template <typename T>
+  WriteResult writeObject(const char* key, const T& val) {
+    return writeObjectInternal(key, &val, sizeof(val));
+  }
+
+  virtual WriteResult writeBool(const char* key, bool val) = 0;
+
+  virtual WriteResult writeU8(const char* key, uint8_t val) = 0;
+
+  virtual WriteResult writeI8(const char* key, int8_t val) = 0;
+
+  virtual WriteResult writeU16(const char* key, uint16_t val) = 0;
+
+  virtual WriteResult writeI16(const char* key, int16_t val) = 0;
+
+  virtual WriteResult writeU32(const char* key, uint32_t val) = 0;
+
+  virtual WriteResult writeI32(const char* key, int32_t val) = 0;
+
+  virtual WriteResult writeU64(const char* key, uint64_t val) = 0;
+
+  virtual WriteResult writeI64(const char* key, int64_t val) = 0;
+
+  virtual WriteResult writeFloat(const char* key, float val) = 0;
+
+  virtual WriteResult writeDouble(const char* key, double val) = 0;
+
+  virtual WriteResult writeString(const char* key, roo::string_view val) = 0;
+
+  /// Stores a raw byte blob. Empty blobs are unsupported.
+  virtual WriteResult writeBytes(const char* key, const void* val,
+                                 size_t len) = 0;
+
+  template <typename T>
+  ReadResult readObject(const char* key, T& val) {
+    return readObjectInternal(key, &val, sizeof(val));
+  }
+
+  virtual ReadResult readBool(const char* key, bool& val) = 0;
+
+  virtual ReadResult readU8(const char* key, uint8_t& val) = 0;
+
+  virtual ReadResult readI8(const char* key, int8_t& val) = 0;
+
+  virtual ReadResult readU16(const char* key, uint16_t& val) = 0;
+
+  virtual ReadResult readI16(const char* key, int16_t& val) = 0;
+
+  virtual ReadResult readU32(const char* key, uint32_t& val) = 0;
+
+  virtual ReadResult readI32(const char* key, int32_t& val) = 0;
+
+  virtual ReadResult readU64(const char* key, uint64_t& val) = 0;
+
+  virtual ReadResult readI64(const char* key, int64_t& val) = 0;
+
+  virtual ReadResult readFloat(const char* key, float& val) = 0;
+
+  virtual ReadResult readDouble(const char* key, double& val) = 0;
+
+  /// Reads a string, reusing the storage of `val` when it is large enough.
+  virtual ReadResult readString(const char* key, std::string& val) = 0;
+
+  /// Reads a string into the caller-provided buffer of `capacity` bytes. On
+  /// success, the string in `buf` is NUL-terminated, and its length is stored
+  /// in `*out_len` (if not null). Returns `ReadResult::kError` if the string
+  /// and its terminator do not fit.
+  ///
+  /// The default implementation reads via a temporary `std::string`;
+  /// built-in stores override it to avoid the allocation.
+  virtual ReadResult readStringInto(const char* key, char* buf,
+                                    size_t capacity, size_t* out_len) {
+    std::string val;
+    ReadResult result = readString(key, val);
+    if (result != ReadResult::kOk) return result;
+    if (val.size() >= capacity) return ReadResult::kError;
+    memcpy(buf, val.c_str(), val.size() + 1);
+    if (out_len != nullptr) *out_len = val.size();
+    return ReadResult::kOk;
+  }
+
+  virtual ReadResult readBytes(const char* key, void* val, size_t max_len,
+                               size_t* out_len) = 0;
+
+  virtual ReadResult readBytesLength(const char* key, size_t* out_len) = 0;
+
+  /// Called by preferences when they skip a write, because the stored value
+  /// is already equal to the new one. For instrumentation; no-op by default.
+  virtual void onWriteSuppressed(const char* /*key*/) {}
+
+ protected:
+  friend class Collection;
+  friend class ForwardingStore;
+
+  /// Opens the specified namespace. Returns false on failure.
+  virtual bool begin(const char* collection_name, bool read_only) = 0;
+
+  /// Closes the namespace opened by `begin()`.
+  virtual void end() = 0;
+
+  /// Called instead of `end()` when the outermost transaction ends, but the
+  /// collection keeps the namespace open (see `Collection::setKeepOpen()`).
+  /// Stores that buffer writes until `end()` should make them durable here.
+  virtual void flush() {}
+
+  virtual WriteResult writeObjectInternal(const char* key, const void* val,
+                                          size_t size) = 0;
+
+  /// Reads a blob of exactly `size` bytes. Returns `ReadResult::kWrongType` if
+  /// the stored blob has a different size.
+  virtual ReadResult readObjectInternal(const char* key, void* val,
+                                        size_t size) = 0;
+};
+
+}  // namespace roo_prefs
@@ -6,15 +6,45 @@ namespace roo_prefs {
 
 /// Ref-counted RAII for managing access to Preference namespaces. Allows
 /// orchestrating access to the Store.
+///
+/// In `Mode::kBatched`, writes and clears performed through `Pref` objects of
+/// the collection are not applied immediately. They are queued (with later
+/// writes to the same key replacing earlier ones), and applied together when
+/// the outermost transaction ends, or when `commit()` is called. Cached
+/// values of the affected preferences are updated once their writes succeed;
+/// until then, `get()` keeps returning the previous values. Direct writes via
+/// `store()` are not batched.
+///
+/// `Mode::kAtomic` is like `Mode::kBatched`, but the batch is applied all or
+/// nothing, even if interrupted by a reset. If it writes more than one key,
+/// the batch is first saved as a journal entry in the namespace, and the
+/// entry is removed once all writes succeed. An interrupted batch is
+/// completed from the journal when the namespace is next opened; the journal
+/// is replayed only once, so if that fails too, the batch is left incomplete,
+/// and the preferences re-read what got stored. A batch with keys longer
+/// than `kMaxKeyLength` fails as a whole, before writing anything. A batch of
+/// a single key is written directly, at the cost of a plain write. A
+/// `kBatched` transaction nested within an atomic one joins its batch, and
+/// vice versa, the batch becoming atomic.
+///
+/// In thread-safe builds (see `Collection`), the transaction holds the
+/// collection lock, even if it is not active, so it should be kept short.
 class Transaction {
  public:
-  enum class Mode { kReadWrite, kReadOnly };
+  enum class Mode { kReadWrite, kReadOnly, kBatched, kAtomic };
 
   Transaction(Collection& collection, Mode mode = Mode::kReadWrite)
       : collection_(collection) {
+    collection_.mutex_.lock();
     active_ = collection_.inc(mode == Mode::kReadOnly);
+    if (active_ && (mode == Mode::kBatched || mode == Mode::kAtomic)) {
+      collection_.startBatch(mode == Mode::kAtomic);
+    }
   }
 
+  Transaction(const Transaction&) = delete;
+  Transaction& operator=(const Transaction&) = delete;
+
   [[deprecated("Use Transaction(Collection&, Transaction::Mode) instead")]]
   Transaction(Collection& collection, bool read_only)
       : Transaction(collection,
@@ -22,10 +52,15 @@ class Transaction {
 
   ~Transaction() {
     if (active_) collection_.dec();
+    collection_.mutex_.unlock();
   }
 
   bool active() const { return active_; }
 
+  /// Applies the writes queued by batched transactions so far. Returns true
+  /// if the transaction is active and all of them succeeded.
+  bool commit() { return active_ && collection_.applyBatch(); }
+
   Store& store() { return collection_.store_; }
 
  private:
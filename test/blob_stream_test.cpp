@@ -0,0 +1,198 @@
+#include "roo_prefs/blob_stream.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+
+namespace roo_prefs {
+
+std::string Payload(size_t size, char seed) {
+  std::string payload(size, '\0');
+  for (size_t i = 0; i < size; ++i) payload[i] = (char)(seed + i * 7);
+  return payload;
+}
+
+std::string ReadAll(Collection& col, const char* key, size_t step) {
+  BlobReader reader(col, key);
+  EXPECT_EQ(ReadResult::kOk, reader.status());
+  std::string result;
+  char buf[64];
+  while (size_t len = reader.read(buf, step)) {
+    result.append(buf, len);
+  }
+  EXPECT_EQ(ReadResult::kOk, reader.status());
+  EXPECT_EQ(0u, reader.remaining());
+  return result;
+}
+
+TEST(BlobStreamTest, WriteAndReadInChunks) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("blobs", store);
+  EXPECT_EQ(ReadResult::kNotFound, BlobReader(col, "cert").status());
+  std::string payload = Payload(250, 'a');
+  {
+    BlobWriter writer(col, "cert", 100);
+    for (size_t i = 0; i < payload.size(); i += 30) {
+      EXPECT_TRUE(writer.write(&payload[i], std::min<size_t>(30, 250 - i)));
+    }
+    // Not visible until committed.
+    EXPECT_EQ(ReadResult::kNotFound, BlobReader(col, "cert").status());
+    EXPECT_TRUE(writer.commit());
+  }
+  // Three chunks, and the manifest.
+  EXPECT_EQ(4u, store.totals().writes);
+  ASSERT_NE(nullptr, store.stats("cert.a2"));
+  // The data, and the sequence number.
+  EXPECT_EQ(51u, store.stats("cert.a2")->bytes_written);
+  EXPECT_EQ(250u, BlobReader(col, "cert").size());
+  // Chunks larger than the caller's buffer go through the reader's buffer;
+  // others are read directly.
+  EXPECT_EQ(payload, ReadAll(col, "cert", 7));
+  EXPECT_EQ(payload, ReadAll(col, "cert", 64));
+
+  // Replacing the payload removes the previous chunks.
+  std::string replacement = Payload(120, 'x');
+  {
+    BlobWriter writer(col, "cert", 100);
+    EXPECT_TRUE(writer.write(replacement.data(), replacement.size()));
+    EXPECT_TRUE(writer.commit());
+  }
+  EXPECT_EQ(replacement, ReadAll(col, "cert", 64));
+  {
+    Transaction t(col);
+    EXPECT_FALSE(t.store().isKey("cert.a0"));
+    EXPECT_TRUE(t.store().isKey("cert.b1"));
+  }
+
+  EXPECT_TRUE(ClearBlob(col, "cert"));
+  EXPECT_EQ(ReadResult::kNotFound, BlobReader(col, "cert").status());
+  Transaction t(col);
+  EXPECT_FALSE(t.store().isKey("cert.b0"));
+}
+
+TEST(BlobStreamTest, AbandonedWriteIsNeverVisible) {
+  MemoryStore store;
+  Collection col("blobs", store);
+  std::string payload = Payload(150, 'a');
+  {
+    BlobWriter writer(col, "table", 100);
+    EXPECT_TRUE(writer.write(payload.data(), payload.size()));
+    EXPECT_TRUE(writer.commit());
+  }
+  {
+    BlobWriter writer(col, "table", 100);
+    std::string partial = Payload(300, 'z');
+    EXPECT_TRUE(writer.write(partial.data(), partial.size()));
+  }
+  EXPECT_EQ(payload, ReadAll(col, "table", 64));
+  Transaction t(col);
+  EXPECT_FALSE(t.store().isKey("table.b0"));
+}
+
+TEST(BlobStreamTest, ReaderFailsIfReplaced) {
+  MemoryStore store;
+  Collection col("blobs", store);
+  std::string payload = Payload(300, 'a');
+  {
+    BlobWriter writer(col, "model", 100);
+    EXPECT_TRUE(writer.write(payload.data(), payload.size()));
+    EXPECT_TRUE(writer.commit());
+  }
+  BlobReader reader(col, "model");
+  char buf[100];
+  EXPECT_EQ(100u, reader.read(buf, sizeof(buf)));
+  {
+    BlobWriter writer(col, "model", 100);
+    EXPECT_TRUE(writer.write(payload.data(), 10));
+    EXPECT_TRUE(writer.commit());
+  }
+  EXPECT_EQ(0u, reader.read(buf, sizeof(buf)));
+  EXPECT_EQ(ReadResult::kError, reader.status());
+}
+
+TEST(BlobStreamTest, ReaderFailsIfReplacedTwice) {
+  MemoryStore store;
+  Collection col("blobs", store);
+  std::string payload = Payload(300, 'a');
+  {
+    BlobWriter writer(col, "model", 100);
+    EXPECT_TRUE(writer.write(payload.data(), payload.size()));
+    EXPECT_TRUE(writer.commit());
+  }
+  BlobReader reader(col, "model");
+  char buf[100];
+  EXPECT_EQ(100u, reader.read(buf, sizeof(buf)));
+  // The chunks of the second replacement have the same keys as those being
+  // read.
+  std::string replacement = Payload(300, 'x');
+  for (int i = 0; i < 2; ++i) {
+    BlobWriter writer(col, "model", 100);
+    EXPECT_TRUE(writer.write(replacement.data(), replacement.size()));
+    EXPECT_TRUE(writer.commit());
+  }
+  EXPECT_EQ(0u, reader.read(buf, sizeof(buf)));
+  EXPECT_EQ(ReadResult::kError, reader.status());
+  EXPECT_EQ(replacement, ReadAll(col, "model", 64));
+}
+
+TEST(BlobStreamTest, RemovesChunksOfInterruptedWriter) {
+  MemoryStore store;
+  Collection col("blobs", store);
+  {
+    // As if left behind by a writer interrupted by a reset.
+    Transaction t(col);
+    ASSERT_EQ(WriteResult::kOk, t.store().writeBytes("table.a0", "x", 1));
+    ASSERT_EQ(WriteResult::kOk, t.store().writeBytes("table.a1", "y", 1));
+    ASSERT_EQ(WriteResult::kOk, t.store().writeBytes("table.a2", "z", 1));
+  }
+  std::string payload = Payload(150, 'a');
+  {
+    BlobWriter writer(col, "table", 100);
+    EXPECT_TRUE(writer.write(payload.data(), payload.size()));
+    EXPECT_TRUE(writer.commit());
+  }
+  EXPECT_EQ(payload, ReadAll(col, "table", 64));
+  Transaction t(col);
+  EXPECT_TRUE(t.store().isKey("table.a1"));
+  EXPECT_FALSE(t.store().isKey("table.a2"));
+}
+
+TEST(BlobStreamTest, KeyLength) {
+  MemoryStore store;
+  Collection col("blobs", store);
+  // "certificate.a999" would not fit in 15 characters.
+  BlobWriter too_long(col, "certificate", 100);
+  EXPECT_FALSE(too_long.ok());
+  EXPECT_FALSE(too_long.write("data", 4));
+  EXPECT_FALSE(too_long.commit());
+  // "certificat.a999" does.
+  BlobWriter writer(col, "certificat", 100);
+  EXPECT_TRUE(writer.write("data", 4));
+  EXPECT_TRUE(writer.commit());
+}
+
+TEST(BlobStreamTest, ReadsCompressedChunksOnce) {
+  MemoryStore mem;
+  AccountingStore accounting(mem);
+  CompressingStore store(accounting);
+  Collection col("blobs", store);
+  std::string payload;
+  while (payload.size() < 500) payload += "{\"on\":true},";
+  {
+    BlobWriter writer(col, "json", 100);
+    EXPECT_TRUE(writer.write(payload.data(), payload.size()));
+    EXPECT_TRUE(writer.commit());
+  }
+  EXPECT_GT(store.stats().compressed_writes, 0u);
+  accounting.reset();
+  EXPECT_EQ(payload, ReadAll(col, "json", 64));
+  // The length of the first chunk is found out by reading it; the others are
+  // read straight into the reader's buffer.
+  EXPECT_EQ(2u, accounting.stats("json.a0")->reads);
+  EXPECT_EQ(1u, accounting.stats("json.a1")->reads);
+  EXPECT_EQ(1u, accounting.stats("json.a4")->reads);
+}
+
+}  // namespace roo_prefs
@@ -0,0 +1,119 @@
+#include "roo_prefs/keep_alive.h"
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+#include "roo_testing/system/timer.h"
+
+namespace roo_prefs {
+
+// Counts how many times the store gets opened.
+class OpenCountingStore : public ForwardingStore {
+ public:
+  explicit OpenCountingStore(Store& delegate)
+      : ForwardingStore(delegate), opens_(0), read_write_opens_(0) {}
+
+  int opens() const { return opens_; }
+  int read_write_opens() const { return read_write_opens_; }
+
+ protected:
+  bool begin(const char* collection_name, bool read_only) override {
+    ++opens_;
+    if (!read_only) ++read_write_opens_;
+    return ForwardingStore::begin(collection_name, read_only);
+  }
+
+ private:
+  int opens_;
+  int read_write_opens_;
+};
+
+TEST(KeepOpenTest, ReusesStoreUntilClosed) {
+  MemoryStore mem;
+  OpenCountingStore store(mem);
+  Collection col("foo", store);
+  col.setKeepOpen(true);
+  Uint32 pref(col, "u32");
+  for (uint32_t i = 1; i <= 10; ++i) {
+    ASSERT_TRUE(pref.set(i));
+  }
+  // Opened for reading by the first sync, and then reopened for writing.
+  EXPECT_EQ(2, store.opens());
+  EXPECT_TRUE(col.isOpen());
+  EXPECT_FALSE(col.inTransaction());
+
+  EXPECT_TRUE(col.close());
+  EXPECT_FALSE(col.isOpen());
+  Uint32 reread(col, "u32");
+  EXPECT_EQ(10u, reread.get());
+  EXPECT_EQ(3, store.opens());
+}
+
+TEST(KeepOpenTest, CloseFailsInTransaction) {
+  MemoryStore mem;
+  Collection col("foo", mem);
+  col.setKeepOpen(true);
+  {
+    Transaction t(col);
+    EXPECT_FALSE(col.close());
+    EXPECT_TRUE(col.isOpen());
+  }
+  EXPECT_TRUE(col.isOpen());
+  col.setKeepOpen(false);
+  EXPECT_FALSE(col.isOpen());
+}
+
+TEST(KeepOpenTest, PromotesReadOnlyHandle) {
+  MemoryStore mem;
+  OpenCountingStore store(mem);
+  Collection col("foo", store);
+  col.setKeepOpen(true);
+  Uint32 pref(col, "u32");
+  EXPECT_EQ(0u, pref.get());
+  EXPECT_EQ(0, store.read_write_opens());
+  EXPECT_TRUE(pref.set(5));
+  EXPECT_TRUE(pref.set(6));
+  EXPECT_EQ(1, store.read_write_opens());
+  EXPECT_EQ(2, store.opens());
+}
+
+TEST(KeepOpenTest, PromotesWithinReadOnlyTransaction) {
+  MemoryStore mem;
+  Collection col("foo", mem);
+  Uint32 pref(col, "u32");
+  {
+    Transaction t(col, Transaction::Mode::kReadOnly);
+    ASSERT_TRUE(t.active());
+    EXPECT_EQ(0u, pref.get());
+    EXPECT_TRUE(pref.set(7));
+  }
+  EXPECT_FALSE(col.isOpen());
+  Uint32 reread(col, "u32");
+  EXPECT_EQ(7u, reread.get());
+}
+
+TEST(KeepAliveTest, ClosesAfterIdleTimeout) {
+  system_time_set_auto_sync(false);
+  MemoryStore mem;
+  OpenCountingStore store(mem);
+  Collection col("foo", store);
+  roo_scheduler::Scheduler scheduler;
+  KeepAlive keep_alive(col, scheduler, roo_time::Seconds(5));
+  Uint32 pref(col, "u32");
+  ASSERT_TRUE(pref.set(1));
+  roo_time::Delay(roo_time::Seconds(3));
+  scheduler.executeEligibleTasks();
+  EXPECT_TRUE(col.isOpen());
+
+  // The use restarts the idle period.
+  ASSERT_TRUE(pref.set(2));
+  roo_time::Delay(roo_time::Seconds(3));
+  scheduler.executeEligibleTasks();
+  EXPECT_TRUE(col.isOpen());
+  EXPECT_EQ(2, store.opens());
+
+  roo_time::Delay(roo_time::Seconds(3));
+  scheduler.executeEligibleTasks();
+  EXPECT_FALSE(col.isOpen());
+}
+
+}  // namespace roo_prefs
@@ -0,0 +1,80 @@
+#include "roo_prefs/latency_stats.h"
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+
+static_assert(ROO_PREFS_LATENCY_STATS, "Must be built with latency stats on");
+
+namespace roo_prefs {
+
+TEST(LatencyHistogramTest, Buckets) {
+  EXPECT_EQ(0, LatencyHistogram::BucketIndex(0));
+  EXPECT_EQ(1, LatencyHistogram::BucketIndex(1));
+  EXPECT_EQ(2, LatencyHistogram::BucketIndex(2));
+  EXPECT_EQ(2, LatencyHistogram::BucketIndex(3));
+  EXPECT_EQ(11, LatencyHistogram::BucketIndex(1024));
+  EXPECT_EQ(LatencyHistogram::kBucketCount - 1,
+            LatencyHistogram::BucketIndex(0xFFFFFFFF));
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+  LatencyHistogram h;
+  EXPECT_EQ(0u, h.percentile(50));
+  for (int i = 0; i < 98; ++i) h.record(10);
+  h.record(20000);
+  h.record(30000);
+  EXPECT_EQ(100u, h.count());
+  EXPECT_EQ(30000u, h.max_us());
+  // 10 us falls into [8, 16).
+  EXPECT_EQ(15u, h.percentile(50));
+  EXPECT_EQ(15u, h.percentile(98));
+  // 20000 us falls into [16384, 32768).
+  EXPECT_EQ(30000u, h.percentile(99));
+  EXPECT_EQ(30000u, h.percentile(100));
+  h.reset();
+  EXPECT_EQ(0u, h.count());
+  EXPECT_EQ(0u, h.max_us());
+}
+
+TEST(LatencyStatsTest, RecordsOpenAndClose) {
+  ResetLatencyStats();
+  MemoryStore store;
+  Collection col("lat", store);
+  Int32 pref(col, "pref");
+  pref.set(5);
+  // Opened read-only by the sync, and then for the write.
+  EXPECT_EQ(2u, GetLatencyHistogram(LatencyOp::kOpen).count());
+  EXPECT_EQ(2u, GetLatencyHistogram(LatencyOp::kClose).count());
+  LogLatencyStats();
+}
+
+TEST(LatencyStatsTest, RecordsPreferencesStoreOperations) {
+  ResetLatencyStats();
+  PreferencesStore store;
+  Collection col("lat_nvs", store);
+  Int32 pref(col, "pref");
+  EXPECT_TRUE(pref.set(5));
+  EXPECT_TRUE(pref.clear());
+  EXPECT_GT(GetLatencyHistogram(LatencyOp::kRead).count(), 0u);
+  EXPECT_GT(GetLatencyHistogram(LatencyOp::kWrite).count(), 0u);
+  EXPECT_GT(GetLatencyHistogram(LatencyOp::kClear).count(), 0u);
+}
+
+TEST(LatencyStatsTest, RecordsOneSamplePerObjectWrite) {
+  struct Point {
+    bool operator==(const Point& other) const {
+      return x == other.x && y == other.y;
+    }
+    int32_t x;
+    int32_t y;
+  };
+  PreferencesStore store;
+  Collection col("lat_nvs", store);
+  Pref<Point> pref(col, "point");
+  pref.get();
+  ResetLatencyStats();
+  EXPECT_TRUE(pref.set(Point{1, 2}));
+  EXPECT_EQ(1u, GetLatencyHistogram(LatencyOp::kWrite).count());
+}
+
+}  // namespace roo_prefs
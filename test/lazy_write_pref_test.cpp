@@ -2,6 +2,8 @@
 #include <new>
 
 #include "roo_prefs/lazy_write_pref.h"
+#include "roo_prefs/store/forwarding_store.h"
+#include "roo_prefs/store/memory_store.h"
 
 #include "gtest/gtest.h"
 #include "roo_testing/system/timer.h"
@@ -86,6 +88,28 @@ TEST(LazyWritePrefTest, ClearCancelsPendingWrite) {
   }
 }
 
+TEST(LazyWritePrefTest, MoveAndEdit) {
+  system_time_set_auto_sync(false);
+  Collection col("lazy_edit");
+  roo_scheduler::Scheduler scheduler;
+  LazyString lazy(col, scheduler, "str");
+
+  std::string value = "moved";
+  ASSERT_TRUE(lazy.set(std::move(value)));
+  EXPECT_EQ("moved", lazy.get());
+  EXPECT_TRUE(lazy.edit([](std::string& s) { s += " and edited"; }));
+  EXPECT_EQ("moved and edited", lazy.get());
+
+  roo_time::Delay(roo_time::Millis(2100));
+  scheduler.executeEligibleTasks();
+  {
+    Transaction t(col);
+    std::string str;
+    ASSERT_EQ(ReadResult::kOk, t.store().readString("str", str));
+    EXPECT_EQ("moved and edited", str);
+  }
+}
+
 TEST(LazyWritePrefTest, ConstructionDoesNotTouchStorage) {
   system_time_set_auto_sync(false);
   Collection col("lazy_ctor");
@@ -128,4 +152,106 @@ TEST(LazyWritePrefTest, FirstSetDoesNotDependOnPoisonedStorage) {
   lazy->~LazyWritePref<uint32_t>();
 }
 
+TEST(LazyWritePrefTest, SharedCoordinator) {
+  system_time_set_auto_sync(false);
+  Collection col("lazy_shared");
+  roo_scheduler::Scheduler scheduler;
+  LazyWriteCoordinator coordinator(col, scheduler);
+  LazyUint32 fast(coordinator, "fast", 0, 1, 1);
+  LazyUint32 slow(coordinator, "slow", 0, 5, 5);
+  LazyUint32 cleared(coordinator, "cleared");
+
+  EXPECT_FALSE(coordinator.hasPendingWrites());
+  EXPECT_TRUE(slow.set(2));
+  EXPECT_TRUE(fast.set(1));
+  EXPECT_TRUE(cleared.set(3));
+  EXPECT_TRUE(coordinator.hasPendingWrites());
+  EXPECT_TRUE(cleared.clear());
+
+  roo_time::Delay(roo_time::Millis(1100));
+  scheduler.executeEligibleTasks();
+  {
+    Transaction t(col);
+    uint32_t val;
+    ASSERT_EQ(ReadResult::kOk, t.store().readU32("fast", val));
+    EXPECT_EQ(1u, val);
+    EXPECT_EQ(ReadResult::kNotFound, t.store().readU32("slow", val));
+  }
+  EXPECT_EQ(2u, slow.get());
+
+  roo_time::Delay(roo_time::Millis(4000));
+  scheduler.executeEligibleTasks();
+  EXPECT_FALSE(coordinator.hasPendingWrites());
+  {
+    Transaction t(col);
+    uint32_t val;
+    ASSERT_EQ(ReadResult::kOk, t.store().readU32("slow", val));
+    EXPECT_EQ(2u, val);
+    EXPECT_EQ(ReadResult::kNotFound, t.store().readU32("cleared", val));
+  }
+}
+
+class BeginCountingStore : public ForwardingStore {
+ public:
+  explicit BeginCountingStore(Store& delegate)
+      : ForwardingStore(delegate), begins_(0) {}
+
+  int begins() const { return begins_; }
+
+ protected:
+  bool begin(const char* collection_name, bool read_only) override {
+    ++begins_;
+    return ForwardingStore::begin(collection_name, read_only);
+  }
+
+ private:
+  int begins_;
+};
+
+TEST(LazyWritePrefTest, SharesCoordinatorOfCollectionAndScheduler) {
+  system_time_set_auto_sync(false);
+  MemoryStore mem;
+  BeginCountingStore store(mem);
+  Collection col("lazy_implicit", store);
+  roo_scheduler::Scheduler scheduler;
+  LazyUint32 a(col, scheduler, "a", 0, 1, 1);
+  LazyUint32 b(col, scheduler, "b", 0, 1, 1);
+  EXPECT_TRUE(a.set(1));
+  EXPECT_TRUE(b.set(2));
+  int begins = store.begins();
+  roo_time::Delay(roo_time::Millis(1100));
+  scheduler.executeEligibleTasks();
+  // Both flushed by a single task, within one transaction.
+  EXPECT_EQ(begins + 1, store.begins());
+  Transaction t(col);
+  uint32_t val;
+  ASSERT_EQ(ReadResult::kOk, t.store().readU32("a", val));
+  EXPECT_EQ(1u, val);
+  ASSERT_EQ(ReadResult::kOk, t.store().readU32("b", val));
+  EXPECT_EQ(2u, val);
+}
+
+TEST(LazyWritePrefTest, FlushAll) {
+  system_time_set_auto_sync(false);
+  Collection col("lazy_flush_all");
+  roo_scheduler::Scheduler scheduler;
+  LazyWriteCoordinator coordinator(col, scheduler);
+  LazyInt16 a(coordinator, "a");
+  LazyString b(coordinator, "b");
+
+  EXPECT_TRUE(a.set(-5));
+  EXPECT_TRUE(b.set("pending"));
+  EXPECT_TRUE(coordinator.flushAll());
+  EXPECT_FALSE(coordinator.hasPendingWrites());
+  {
+    Transaction t(col);
+    int16_t val;
+    ASSERT_EQ(ReadResult::kOk, t.store().readI16("a", val));
+    EXPECT_EQ(-5, val);
+    std::string str;
+    ASSERT_EQ(ReadResult::kOk, t.store().readString("b", str));
+    EXPECT_EQ("pending", str);
+  }
+}
+
 }  // namespace roo_prefs
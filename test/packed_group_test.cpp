@@ -0,0 +1,144 @@
+#include "roo_prefs/packed_group.h"
+
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+
+namespace roo_prefs {
+
+TEST(PackedGroupTest, GetSetClear) {
+  MemoryStore store;
+  Collection col("packed", store);
+  PackedGroup group(col, "group");
+  PackedBool flag(group, true);
+  PackedUint8 u8(group, 7);
+  PackedInt16 i16(group);
+  // 2 + 9 + 17 bits.
+  EXPECT_EQ(4u, group.byteSize());
+
+  EXPECT_FALSE(flag.isSet());
+  EXPECT_TRUE(flag.get());
+  EXPECT_EQ(7, u8.get());
+  EXPECT_TRUE(flag.set(false));
+  EXPECT_TRUE(u8.set(200));
+  EXPECT_TRUE(i16.set(-1234));
+  EXPECT_TRUE(flag.isSet());
+  EXPECT_FALSE(flag.get());
+  EXPECT_EQ(200, u8.get());
+  EXPECT_EQ(-1234, i16.get());
+
+  EXPECT_TRUE(u8.clear());
+  EXPECT_FALSE(u8.isSet());
+  EXPECT_EQ(7, u8.get());
+  EXPECT_EQ(-1234, i16.get());
+}
+
+TEST(PackedGroupTest, PersistsInOneBlob) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("packed", store);
+  {
+    PackedGroup group(col, "toggles");
+    std::vector<std::unique_ptr<PackedBool>> toggles;
+    for (int i = 0; i < 80; ++i) {
+      toggles.emplace_back(new PackedBool(group));
+    }
+    EXPECT_EQ(20u, group.byteSize());
+    EXPECT_TRUE(toggles[42]->set(true));
+    EXPECT_TRUE(toggles[79]->set(false));
+    // Unchanged.
+    EXPECT_TRUE(toggles[42]->set(true));
+  }
+  // Besides the group, only the journal of atomic batches has been accessed,
+  // when checked on open.
+  ASSERT_EQ(2u, store.all_stats().size());
+  EXPECT_EQ(0u, store.stats(internal::kJournalKey)->writes);
+  EXPECT_EQ(2u, store.stats("toggles")->writes);
+  EXPECT_EQ(1u, store.stats("toggles")->suppressed_writes);
+  EXPECT_EQ(40u, store.totals().bytes_written);
+
+  PackedGroup group(col, "toggles");
+  std::vector<std::unique_ptr<PackedBool>> toggles;
+  // Preferences appended to the group start unset.
+  for (int i = 0; i < 81; ++i) {
+    toggles.emplace_back(new PackedBool(group));
+  }
+  EXPECT_TRUE(toggles[42]->isSet());
+  EXPECT_TRUE(toggles[42]->get());
+  EXPECT_TRUE(toggles[79]->isSet());
+  EXPECT_FALSE(toggles[79]->get());
+  EXPECT_FALSE(toggles[0]->isSet());
+  EXPECT_FALSE(toggles[80]->isSet());
+}
+
+TEST(PackedGroupTest, BatchedWritesOnce) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("packed", store);
+  PackedGroup group(col, "group");
+  PackedBool a(group);
+  PackedBool b(group);
+  PackedUint32 c(group);
+  {
+    Transaction t(col, Transaction::Mode::kBatched);
+    EXPECT_TRUE(a.set(true));
+    EXPECT_TRUE(b.set(true));
+    EXPECT_TRUE(c.set(0xDEADBEEF));
+    // Not applied yet.
+    EXPECT_FALSE(a.isSet());
+  }
+  EXPECT_EQ(1u, store.totals().writes);
+  EXPECT_TRUE(a.get());
+  EXPECT_TRUE(b.get());
+  EXPECT_EQ(0xDEADBEEF, c.get());
+}
+
+// Fails reads of blobs with a storage error, until `setFailing(false)`.
+class ReadFailingStore : public ForwardingStore {
+ public:
+  explicit ReadFailingStore(Store& delegate)
+      : ForwardingStore(delegate), failing_(true), reads_(0) {}
+
+  void setFailing(bool failing) { failing_ = failing; }
+
+  int reads() const { return reads_; }
+
+  ReadResult readBytesLength(const char* key, size_t* out_len) override {
+    ++reads_;
+    if (failing_) return ReadResult::kError;
+    return ForwardingStore::readBytesLength(key, out_len);
+  }
+
+ private:
+  bool failing_;
+  int reads_;
+};
+
+TEST(PackedGroupTest, ErrorPolicyBacksOff) {
+  MemoryStore mem;
+  ReadFailingStore store(mem);
+  Collection col("packed", store);
+  col.setErrorPolicy(ErrorPolicy{1, 4, true});
+  PackedGroup group(col, "group");
+  PackedUint8 u8(group, 7);
+  // Reads at accesses 1 and 3; the rest are suppressed.
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(7, u8.get());
+  }
+  EXPECT_EQ(2, store.reads());
+  EXPECT_EQ(2u, col.suppressedRetries());
+
+  // Writes need the other values, so they retry the read, but do not count
+  // as suppressed retries.
+  EXPECT_FALSE(u8.set(8));
+  EXPECT_EQ(3, store.reads());
+  store.setFailing(false);
+  EXPECT_TRUE(u8.set(8));
+  EXPECT_EQ(8, u8.get());
+  EXPECT_EQ(4, store.reads());
+  EXPECT_EQ(2u, col.suppressedRetries());
+}
+
+}  // namespace roo_prefs
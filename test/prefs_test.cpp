@@ -200,6 +200,155 @@ TEST(PrefsTest, EmptyStringRoundTrip) {
   EXPECT_EQ("", pref_reader.get());
 }
 
+TEST(PrefsTest, StringIntoBuffer) {
+  Collection col("foo");
+  std::string long_str(100, 'x');
+  {
+    // Strings written by older versions, or by other code, use PT_STR.
+    Preferences prefs;
+    ASSERT_TRUE(prefs.begin("foo", false));
+    prefs.putString("legacy_str", long_str.c_str());
+    prefs.end();
+  }
+  Transaction t(col);
+  ASSERT_EQ(WriteResult::kOk, t.store().writeString("blob_str", "Hello"));
+  char buf[8];
+  size_t len = 0;
+  EXPECT_EQ(ReadResult::kOk,
+            t.store().readStringInto("blob_str", buf, sizeof(buf), &len));
+  EXPECT_EQ(5u, len);
+  EXPECT_STREQ("Hello", buf);
+  EXPECT_EQ(ReadResult::kError,
+            t.store().readStringInto("blob_str", buf, 5, &len));
+  EXPECT_EQ(ReadResult::kError,
+            t.store().readStringInto("legacy_str", buf, sizeof(buf), &len));
+  EXPECT_EQ(ReadResult::kNotFound,
+            t.store().readStringInto("missing", buf, sizeof(buf), &len));
+
+  std::string val;
+  EXPECT_EQ(ReadResult::kOk, t.store().readString("legacy_str", val));
+  EXPECT_EQ(long_str, val);
+  EXPECT_EQ(ReadResult::kOk, t.store().readString("blob_str", val));
+  EXPECT_EQ("Hello", val);
+}
+
+TEST(PrefsTest, StringReadsReuseStorage) {
+  Collection col("foo");
+  Transaction t(col);
+  ASSERT_EQ(WriteResult::kOk, t.store().writeString("empty_str", ""));
+  std::string val = "previous";
+  ASSERT_EQ(ReadResult::kOk, t.store().readString("empty_str", val));
+  EXPECT_EQ("", val);
+  size_t capacity = val.capacity();
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_EQ(ReadResult::kOk, t.store().readString("empty_str", val));
+    EXPECT_EQ("", val);
+    EXPECT_EQ(capacity, val.capacity());
+  }
+}
+
+TEST(PrefsTest, LegacyFloatingPoint) {
+  {
+    // Older versions stored floats and doubles as blobs.
+    Preferences prefs;
+    ASSERT_TRUE(prefs.begin("fp", false));
+    prefs.putFloat("float", 1.5f);
+    prefs.putDouble("double", -2.25);
+    prefs.end();
+  }
+  for (bool indexed : {false, true}) {
+    Collection col("fp");
+    col.setKeyIndexEnabled(indexed);
+    Float pref_float(col, "float");
+    Double pref_double(col, "double");
+    EXPECT_EQ(1.5f, pref_float.get());
+    EXPECT_EQ(-2.25, pref_double.get());
+  }
+  {
+    Collection col("fp");
+    Float pref_float(col, "float");
+    EXPECT_TRUE(pref_float.set(3.0f));
+  }
+  Preferences prefs;
+  ASSERT_TRUE(prefs.begin("fp", true));
+  EXPECT_EQ(PT_U32, prefs.getType("float"));
+  EXPECT_EQ(PT_BLOB, prefs.getType("double"));
+  prefs.end();
+  Collection col("fp");
+  Float pref_float(col, "float");
+  EXPECT_EQ(3.0f, pref_float.get());
+}
+
+TEST(PrefsTest, FixedString) {
+  Collection col("foo");
+  FixedStringPref<8> pref_str(col, "fixed_str", "default");
+
+  EXPECT_FALSE(pref_str.isSet());
+  EXPECT_STREQ("default", pref_str.get().c_str());
+  EXPECT_TRUE(pref_str.set("Hello"));
+  EXPECT_TRUE(pref_str.isSet());
+  EXPECT_EQ(5u, pref_str.get().size());
+  EXPECT_STREQ("Hello", pref_str.get().c_str());
+
+  // Longer values are truncated.
+  EXPECT_TRUE(pref_str.set(std::string("Hello, world")));
+  EXPECT_STREQ("Hello, w", pref_str.get().c_str());
+  FixedStringPref<8> reader(col, "fixed_str");
+  EXPECT_EQ(FixedString<8>("Hello, w"), reader.get());
+
+  // Fixed strings are interchangeable with other strings in storage.
+  String std_reader(col, "fixed_str");
+  EXPECT_EQ("Hello, w", std_reader.get());
+  EXPECT_TRUE(std_reader.set("Too long to fit"));
+  FixedStringPref<8> short_reader(col, "fixed_str", "default");
+  EXPECT_STREQ("default", short_reader.get().c_str());
+  EXPECT_FALSE(short_reader.isSet());
+
+  EXPECT_TRUE(pref_str.clear());
+  EXPECT_STREQ("default", pref_str.get().c_str());
+}
+
+namespace {
+
+struct Config {
+  int32_t a;
+  int32_t b;
+  int32_t c;
+  bool operator==(const Config& other) const {
+    return a == other.a && b == other.b && c == other.c;
+  }
+};
+
+const Config kDefaultConfig = {1, 2, 3};
+
+Config MakeDefaultConfig() { return Config{4, 5, 6}; }
+
+}  // namespace
+
+TEST(PrefsTest, DefaultsWithoutCopies) {
+  Collection col("foo");
+  Pref<Config> static_default(col, "cfg", StaticDefault(kDefaultConfig));
+  Pref<Config> generated_default(col, "cfg2",
+                                 GeneratedDefault(&MakeDefaultConfig));
+  Pref<Config> value_default(col, "cfg3", Config{7, 8, 9});
+  String literal_default(col, "str", StaticDefault("literal"));
+
+  EXPECT_EQ(kDefaultConfig, static_default.get());
+  EXPECT_EQ(6, generated_default.get().c);
+  EXPECT_EQ(9, value_default.get().c);
+  EXPECT_EQ("literal", literal_default.get());
+
+  EXPECT_TRUE(static_default.set(Config{0, 0, 0}));
+  EXPECT_TRUE(generated_default.set(Config{0, 0, 0}));
+  EXPECT_TRUE(literal_default.set("changed"));
+  EXPECT_TRUE(static_default.clear());
+  EXPECT_TRUE(generated_default.clear());
+  EXPECT_TRUE(literal_default.clear());
+  EXPECT_EQ(kDefaultConfig, static_default.get());
+  EXPECT_EQ(6, generated_default.get().c);
+  EXPECT_EQ("literal", literal_default.get());
+}
+
 TEST(PrefsTest, Struct) {
   struct MyStruct {
     MyStruct(int32_t a = 0, float b = 0.0f) : a(a), b(b) {}
@@ -232,6 +381,47 @@ TEST(PrefsTest, Struct) {
   EXPECT_FLOAT_EQ(0.0f, s3.b);
 }
 
+TEST(PrefsTest, MoveAndEdit) {
+  struct Config {
+    int32_t brightness;
+    int32_t volume;
+    bool operator==(const Config& other) const {
+      return brightness == other.brightness && volume == other.volume;
+    }
+  };
+
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("edit", store);
+  StdString name(col, "name");
+  std::string value(100, 'x');
+  EXPECT_TRUE(name.set(std::move(value)));
+  EXPECT_EQ(std::string(100, 'x'), name.get());
+
+  Pref<Config> config(col, "config");
+  {
+    auto editor = config.edit();
+    editor->brightness = 80;
+    editor->volume = 5;
+  }
+  EXPECT_EQ(80, config.get().brightness);
+  EXPECT_EQ(5, config.get().volume);
+  EXPECT_EQ(1u, store.stats("config")->writes);
+
+  // Unchanged values are not written.
+  EXPECT_TRUE(config.edit([](Config& c) { c.volume = 5; }));
+  EXPECT_EQ(1u, store.stats("config")->writes);
+  EXPECT_EQ(1u, store.stats("config")->suppressed_writes);
+
+  {
+    auto editor = config.edit();
+    editor->volume = 7;
+    editor.cancel();
+  }
+  EXPECT_EQ(5, config.get().volume);
+  EXPECT_EQ(1u, store.stats("config")->writes);
+}
+
 TEST(PrefsTest, DefaultValues) {
   Collection col("foo");
   roo_prefs::Int32 pref_int(col, "pref_int", 99);
@@ -254,6 +444,19 @@ TEST(PrefsTest, DefaultValues) {
   pref_str.clear();
   EXPECT_FALSE(pref_str.isSet());
   EXPECT_EQ("default", pref_str.get());
+
+  // Character string defaults are copied.
+  char buf[16];
+  strcpy(buf, "transient");
+  roo_prefs::String pref_buf(col, "pref_buf", buf);
+  strcpy(buf, "overwritten");
+  EXPECT_TRUE(pref_buf.set("changed"));
+  EXPECT_TRUE(pref_buf.clear());
+  EXPECT_EQ("transient", pref_buf.get());
+
+  Pref<Config> pref_config(col, "pref_config", {7, 8, 9});
+  EXPECT_EQ((Config{7, 8, 9}), pref_config.get());
+  EXPECT_EQ((Config{7, 8, 9}), pref_config.load());
 }
 
 TEST(PrefsTest, DirectAccess) {
@@ -325,4 +528,416 @@ TEST(PrefsTest, NestedTransactions) {
   EXPECT_FALSE(col.inTransaction());
 }
 
+TEST(PrefsTest, ValuesMatchingReadSentinelsRoundTrip) {
+  Collection col("foo");
+  {
+    Transaction t(col);
+    ASSERT_EQ(WriteResult::kOk, t.store().writeU8("s_u8", 0xDF));
+    ASSERT_EQ(WriteResult::kOk, t.store().writeI16("s_i16", (int16_t)0xDFB1));
+    ASSERT_EQ(WriteResult::kOk, t.store().writeU32("s_u32", 0xDFB1BEEF));
+    ASSERT_EQ(WriteResult::kOk,
+              t.store().writeI64("s_i64", 0x3E3E1254DFB1BEEFLL));
+  }
+  Transaction t(col, Transaction::Mode::kReadOnly);
+  uint8_t u8 = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readU8("s_u8", u8));
+  EXPECT_EQ(0xDF, u8);
+  int16_t i16 = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readI16("s_i16", i16));
+  EXPECT_EQ((int16_t)0xDFB1, i16);
+  uint32_t u32 = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readU32("s_u32", u32));
+  EXPECT_EQ(0xDFB1BEEF, u32);
+  int64_t i64 = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readI64("s_i64", i64));
+  EXPECT_EQ(0x3E3E1254DFB1BEEFLL, i64);
+  bool b = false;
+  EXPECT_EQ(ReadResult::kOk, t.store().readBool("s_u8", b));
+
+  // Type mismatches and missing keys are still told apart.
+  int8_t i8 = 0;
+  EXPECT_EQ(ReadResult::kWrongType, t.store().readI8("s_u8", i8));
+  uint16_t u16 = 0;
+  EXPECT_EQ(ReadResult::kWrongType, t.store().readU16("s_u32", u16));
+  float f = 0;
+  EXPECT_EQ(ReadResult::kWrongType, t.store().readFloat("s_u8", f));
+  // Floats are stored as U32 entries, so this one reads, reinterpreted.
+  EXPECT_EQ(ReadResult::kOk, t.store().readFloat("s_u32", f));
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  EXPECT_EQ(0xDFB1BEEF, bits);
+  double d = 0;
+  EXPECT_EQ(ReadResult::kNotFound, t.store().readDouble("s_none", d));
+  EXPECT_EQ(ReadResult::kNotFound, t.store().readU8("s_none", u8));
+}
+
+TEST(PrefsTest, KeyIndex) {
+  Collection col("idx");
+  col.setKeyIndexEnabled(true);
+  Uint16 pref_u16(col, "u16", 7);
+  Double pref_double(col, "double");
+  String pref_str(col, "str", "default");
+  Pref<std::array<uint8_t, 3>> pref_blob(col, "blob");
+
+  EXPECT_FALSE(pref_u16.isSet());
+  EXPECT_EQ(7, pref_u16.get());
+  EXPECT_TRUE(pref_u16.set(12345));
+  EXPECT_TRUE(pref_double.set(2.5));
+  EXPECT_TRUE(pref_str.set("Hello"));
+  EXPECT_TRUE(pref_blob.set({{1, 2, 3}}));
+
+  Uint16 read_u16(col, "u16");
+  Double read_double(col, "double");
+  String read_str(col, "str");
+  Pref<std::array<uint8_t, 3>> read_blob(col, "blob");
+  EXPECT_EQ(12345, read_u16.get());
+  EXPECT_EQ(2.5, read_double.get());
+  EXPECT_EQ("Hello", read_str.get());
+  EXPECT_EQ(3, read_blob.get()[2]);
+
+  EXPECT_TRUE(read_str.set(""));
+  String empty_str(col, "str", "default");
+  EXPECT_TRUE(empty_str.isSet());
+  EXPECT_EQ("", empty_str.get());
+
+  {
+    Transaction t(col);
+    uint32_t u32;
+    EXPECT_EQ(ReadResult::kWrongType, t.store().readU32("u16", u32));
+    size_t len = 0;
+    EXPECT_EQ(ReadResult::kOk, t.store().readBytesLength("blob", &len));
+    EXPECT_EQ(3u, len);
+    EXPECT_EQ(ReadResult::kWrongType, t.store().readBytesLength("u16", &len));
+    EXPECT_EQ(ClearResult::kOk, t.store().clear("u16"));
+    EXPECT_FALSE(t.store().isKey("u16"));
+    uint16_t u16;
+    EXPECT_EQ(ReadResult::kNotFound, t.store().readU16("u16", u16));
+    EXPECT_EQ(WriteResult::kOk, t.store().writeI8("u16", -5));
+    int8_t i8;
+    EXPECT_EQ(ReadResult::kOk, t.store().readI8("u16", i8));
+    EXPECT_EQ(-5, i8);
+  }
+}
+
+TEST(PrefsTest, BatchedTransaction) {
+  Collection col("batch");
+  Uint32 pref_a(col, "a");
+  Uint32 pref_b(col, "b", 5);
+  String pref_c(col, "c");
+  ASSERT_TRUE(pref_b.set(6));
+  {
+    Transaction t(col, Transaction::Mode::kBatched);
+    ASSERT_TRUE(t.active());
+    EXPECT_TRUE(pref_a.set(1));
+    EXPECT_TRUE(pref_a.set(2));
+    EXPECT_TRUE(pref_b.clear());
+    EXPECT_TRUE(pref_c.set("first"));
+    EXPECT_TRUE(pref_c.set("second"));
+
+    // Cached values are not updated until the batch is applied.
+    EXPECT_FALSE(pref_a.isSet());
+    EXPECT_EQ(6u, pref_b.get());
+    uint32_t val;
+    EXPECT_EQ(ReadResult::kNotFound, t.store().readU32("a", val));
+  }
+  EXPECT_EQ(2u, pref_a.get());
+  EXPECT_FALSE(pref_b.isSet());
+  EXPECT_EQ(5u, pref_b.get());
+  EXPECT_EQ("second", pref_c.get());
+
+  Uint32 read_a(col, "a");
+  Uint32 read_b(col, "b", 5);
+  String read_c(col, "c");
+  EXPECT_EQ(2u, read_a.get());
+  EXPECT_FALSE(read_b.isSet());
+  EXPECT_EQ("second", read_c.get());
+}
+
+TEST(PrefsTest, BatchedTransactionCommit) {
+  Collection col("batch");
+  Int32 pref(col, "commit", 10);
+  Transaction t(col, Transaction::Mode::kBatched);
+  EXPECT_TRUE(pref.set(11));
+  {
+    // Nested transactions join the batch.
+    Transaction inner(col);
+    EXPECT_TRUE(pref.set(12));
+  }
+  EXPECT_EQ(10, pref.get());
+  EXPECT_TRUE(t.commit());
+  EXPECT_EQ(12, pref.get());
+
+  // Setting back the cached value cancels the pending write.
+  EXPECT_TRUE(pref.set(13));
+  EXPECT_TRUE(pref.set(12));
+  EXPECT_TRUE(t.commit());
+  int32_t val;
+  EXPECT_EQ(ReadResult::kOk, t.store().readI32("commit", val));
+  EXPECT_EQ(12, val);
+}
+
+TEST(PrefsTest, PrefDestroyedInBatchedTransaction) {
+  MemoryStore store;
+  Collection col("batch", store);
+  Int32 kept(col, "kept");
+  Transaction t(col, Transaction::Mode::kBatched);
+  EXPECT_TRUE(kept.set(1));
+  {
+    Int32 written(col, "written");
+    String cleared(col, "cleared");
+    EXPECT_TRUE(written.set(2));
+    EXPECT_TRUE(cleared.clear());
+  }
+  // The writes of the destroyed preferences are dropped.
+  EXPECT_TRUE(t.commit());
+  EXPECT_EQ(1, kept.get());
+  EXPECT_TRUE(t.store().isKey("kept"));
+  EXPECT_FALSE(t.store().isKey("written"));
+}
+
+TEST(PrefsTest, CounterCompactsIncrements) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  {
+    Collection col("counter", store);
+    Counter64 counter(col, "cycles", 100, 5);
+    EXPECT_FALSE(counter.isSet());
+    EXPECT_EQ(5u, counter.get());
+    for (int i = 0; i < 1050; ++i) {
+      EXPECT_TRUE(counter.add());
+    }
+    EXPECT_EQ(1055u, counter.get());
+    EXPECT_EQ(50u, counter.pendingEvents());
+    EXPECT_EQ(10u, store.stats("cycles")->writes);
+    EXPECT_TRUE(counter.add(1000));
+    EXPECT_TRUE(counter.flush());
+    EXPECT_EQ(0u, counter.pendingEvents());
+    EXPECT_EQ(11u, store.stats("cycles")->writes);
+    // Nothing to write.
+    EXPECT_TRUE(counter.flush());
+    EXPECT_EQ(11u, store.stats("cycles")->writes);
+  }
+  Collection col("counter", store);
+  Counter64 counter(col, "cycles", 100, 5);
+  EXPECT_EQ(2055u, counter.get());
+  EXPECT_TRUE(counter.add());
+  EXPECT_TRUE(counter.clear());
+  EXPECT_EQ(5u, counter.get());
+  EXPECT_EQ(0u, counter.pendingEvents());
+}
+
+// Fails writes of the specified Int32 key, until `setFailing(false)`.
+class FailingStore : public ForwardingStore {
+ public:
+  FailingStore(Store& delegate, const char* failing_key)
+      : ForwardingStore(delegate), failing_key_(failing_key), failing_(true) {}
+
+  void setFailing(bool failing) { failing_ = failing; }
+
+  WriteResult writeI32(const char* key, int32_t val) override {
+    if (failing_ && strcmp(key, failing_key_) == 0) return WriteResult::kError;
+    return ForwardingStore::writeI32(key, val);
+  }
+
+ private:
+  const char* failing_key_;
+  bool failing_;
+};
+
+TEST(PrefsTest, AtomicTransactionOfOneKeyIsPlainWrite) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("atomic", store);
+  Int32 pref(col, "a");
+  {
+    Transaction t(col, Transaction::Mode::kAtomic);
+    EXPECT_TRUE(pref.set(1));
+    EXPECT_TRUE(pref.set(2));
+  }
+  EXPECT_EQ(2, pref.get());
+  EXPECT_EQ(1u, store.totals().writes);
+  EXPECT_EQ(0u, store.totals().clears);
+}
+
+TEST(PrefsTest, AtomicTransactionRecovers) {
+  MemoryStore mem;
+  {
+    FailingStore store(mem, "b");
+    Collection col("atomic", store);
+    Int32 a(col, "a");
+    Int32 b(col, "b");
+    String c(col, "c");
+    EXPECT_TRUE(c.set("old"));
+    {
+      Transaction t(col, Transaction::Mode::kAtomic);
+      EXPECT_TRUE(a.set(1));
+      EXPECT_TRUE(b.set(2));
+      EXPECT_TRUE(c.clear());
+      EXPECT_FALSE(t.commit());
+    }
+    EXPECT_EQ(1, a.get());
+    EXPECT_FALSE(c.isSet());
+    // The write of `b` has failed, and is left in the journal. (Accessing
+    // `b` would replay the journal, with the write failing again.)
+  }
+  // As if after a reset.
+  Collection col("atomic", mem);
+  Int32 a(col, "a");
+  Int32 b(col, "b");
+  String c(col, "c");
+  EXPECT_EQ(1, a.get());
+  EXPECT_EQ(2, b.get());
+  EXPECT_FALSE(c.isSet());
+  Transaction t(col);
+  EXPECT_FALSE(t.store().isKey(internal::kJournalKey));
+}
+
+TEST(PrefsTest, AtomicTransactionRecoversOnNextAccess) {
+  MemoryStore mem;
+  FailingStore store(mem, "b");
+  Collection col("atomic", store);
+  Int32 a(col, "a");
+  Int32 b(col, "b");
+  {
+    Transaction t(col, Transaction::Mode::kAtomic);
+    EXPECT_TRUE(a.set(1));
+    EXPECT_TRUE(b.set(2));
+  }
+  store.setFailing(false);
+  EXPECT_EQ(2, b.get());
+  EXPECT_TRUE(b.set(3));
+  Collection reopened("atomic", mem);
+  Int32 read_b(reopened, "b");
+  // The journal has been replayed before, not after, the write of 3.
+  EXPECT_EQ(3, read_b.get());
+}
+
+TEST(PrefsTest, AtomicTransactionReplaysJournalOnce) {
+  MemoryStore mem;
+  FailingStore store(mem, "b");
+  Collection col("atomic", store);
+  Int32 a(col, "a");
+  Int32 b(col, "b");
+  {
+    Transaction t(col, Transaction::Mode::kAtomic);
+    EXPECT_TRUE(a.set(1));
+    EXPECT_TRUE(b.set(2));
+  }
+  // The replay fails again, and drops the journal, rather than replaying it
+  // over the newer value.
+  EXPECT_TRUE(a.set(42));
+  EXPECT_EQ(42, a.get());
+  Collection reopened("atomic", mem);
+  Int32 read_a(reopened, "a");
+  EXPECT_EQ(42, read_a.get());
+  Transaction t(reopened);
+  EXPECT_FALSE(t.store().isKey(internal::kJournalKey));
+}
+
+TEST(PrefsTest, AtomicTransactionFailsOnLongKey) {
+  MemoryStore mem;
+  Collection col("atomic", mem);
+  Int32 a(col, "a");
+  Int32 b(col, "much_too_long_key");
+  {
+    Transaction t(col, Transaction::Mode::kAtomic);
+    EXPECT_TRUE(a.set(1));
+    EXPECT_TRUE(b.set(2));
+    EXPECT_FALSE(t.commit());
+  }
+  // Nothing has been written.
+  EXPECT_FALSE(a.isSet());
+  Transaction t(col);
+  EXPECT_FALSE(t.store().isKey("a"));
+  EXPECT_FALSE(t.store().isKey(internal::kJournalKey));
+}
+
+TEST(PrefsTest, ErrorPolicyBacksOff) {
+  Collection col("err");
+  col.setErrorPolicy(ErrorPolicy{1, 4, true});
+  {
+    Transaction t(col);
+    ASSERT_EQ(WriteResult::kOk, t.store().writeU8("mistyped", 3));
+  }
+  Uint32 pref(col, "mistyped", 77);
+  // Reads at accesses 1, 3, 6 and 11; the rest are suppressed.
+  for (int i = 0; i < 11; ++i) {
+    EXPECT_EQ(77u, pref.get());
+  }
+  EXPECT_EQ(7u, col.suppressedRetries());
+  EXPECT_FALSE(pref.isSet());
+  EXPECT_EQ(8u, col.suppressedRetries());
+
+  // Writes skip the read, without counting it as a suppressed retry, and
+  // recover the preference.
+  EXPECT_TRUE(pref.set(5));
+  EXPECT_EQ(5u, pref.get());
+  EXPECT_TRUE(pref.isSet());
+  EXPECT_EQ(8u, col.suppressedRetries());
+}
+
+TEST(PrefsTest, ErrorPolicyRetryAlways) {
+  Collection col("err");
+  {
+    Transaction t(col);
+    ASSERT_EQ(WriteResult::kOk, t.store().writeU8("mistyped", 3));
+  }
+  Uint32 pref(col, "mistyped", 77);
+  pref.get();
+  pref.get();
+  EXPECT_EQ(0u, col.suppressedRetries());
+  {
+    Transaction t(col);
+    ASSERT_EQ(ClearResult::kOk, t.store().clear("mistyped"));
+    ASSERT_EQ(WriteResult::kOk, t.store().writeU32("mistyped", 8));
+  }
+  EXPECT_EQ(8u, pref.get());
+}
+
+class BeginCountingStore : public ForwardingStore {
+ public:
+  explicit BeginCountingStore(Store& delegate)
+      : ForwardingStore(delegate), begins_(0) {}
+
+  int begins() const { return begins_; }
+
+ protected:
+  bool begin(const char* collection_name, bool read_only) override {
+    ++begins_;
+    return ForwardingStore::begin(collection_name, read_only);
+  }
+
+ private:
+  int begins_;
+};
+
+TEST(PrefsTest, PreloadAll) {
+  MemoryStore mem;
+  BeginCountingStore store(mem);
+  Collection col("preload", store);
+  {
+    Transaction t(col);
+    ASSERT_EQ(WriteResult::kOk, t.store().writeI32("b", 2));
+    ASSERT_EQ(WriteResult::kOk, t.store().writeString("c", "three"));
+    ASSERT_EQ(WriteResult::kOk, t.store().writeU8("mistyped", 1));
+  }
+  Int32 b(col, "b");
+  StdString c(col, "c");
+  Int32 a(col, "a", 7);
+  Uint64 mistyped(col, "mistyped");
+  {
+    Int32 temporary(col, "temporary");
+  }
+  PreloadResult result = col.preloadAll();
+  EXPECT_EQ(4u, result.count);
+  EXPECT_EQ(1u, result.failed);
+  EXPECT_EQ(2, store.begins());
+
+  EXPECT_EQ(7, a.get());
+  EXPECT_FALSE(a.isSet());
+  EXPECT_EQ(2, b.get());
+  EXPECT_EQ("three", c.get());
+  EXPECT_EQ(2, store.begins());
+}
+
 }  // namespace roo_prefs
@@ -0,0 +1,162 @@
+#include "roo_prefs/record.h"
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+
+namespace roo_prefs {
+
+namespace {
+
+struct Settings {
+  uint8_t brightness = 128;
+  bool show_clock = true;
+  int16_t utc_offset_min = 0;
+};
+
+constexpr FieldInfo kSettingsSchema[] = {
+    ROO_PREFS_FIELD(Settings, brightness),
+    ROO_PREFS_FIELD(Settings, show_clock),
+    ROO_PREFS_FIELD(Settings, utc_offset_min),
+};
+
+// The same struct, with a field renamed.
+constexpr FieldInfo kRenamedSchema[] = {
+    ROO_PREFS_FIELD(Settings, brightness),
+    ROO_PREFS_FIELD(Settings, show_clock),
+    {"utc_offset", offsetof(Settings, utc_offset_min), sizeof(int16_t), 'i'},
+};
+
+struct Padded {
+  uint8_t mode;
+  uint32_t interval_ms;
+};
+
+constexpr FieldInfo kPaddedSchema[] = {
+    ROO_PREFS_FIELD(Padded, mode),
+    ROO_PREFS_FIELD(Padded, interval_ms),
+};
+
+// Padded, with `interval_ms` missing.
+constexpr FieldInfo kIncompleteSchema[] = {
+    ROO_PREFS_FIELD(Padded, mode),
+};
+
+static_assert(SchemaCoversRecord(kSettingsSchema, sizeof(Settings),
+                                 alignof(Settings)),
+              "Complete schema must cover the record");
+
+static_assert(SchemaCoversRecord(kPaddedSchema, sizeof(Padded),
+                                 alignof(Padded)),
+              "Padding must not count as a missing field");
+
+static_assert(SchemaHash(kSettingsSchema, sizeof(Settings)) !=
+                  SchemaHash(kRenamedSchema, sizeof(Settings)),
+              "Schema hash must depend on field names");
+
+}  // namespace
+
+TEST(RecordTest, DefaultsAndFieldUpdates) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("rec", store);
+  Record<Settings> settings(col, "settings", kSettingsSchema);
+  EXPECT_FALSE(settings.isSet());
+  EXPECT_EQ(128, settings.get().brightness);
+  EXPECT_TRUE(settings.get().show_clock);
+
+  EXPECT_TRUE(settings.set(&Settings::brightness, 50));
+  EXPECT_TRUE(settings.set(&Settings::utc_offset_min, -60));
+  EXPECT_TRUE(settings.isSet());
+  EXPECT_EQ(50, settings.get().brightness);
+  EXPECT_EQ(-60, settings.get().utc_offset_min);
+  // One blob, with the hash and the record.
+  EXPECT_EQ(2u, store.totals().writes);
+  EXPECT_EQ(2 * (4 + sizeof(Settings)), store.totals().bytes_written);
+
+  Record<Settings> reader(col, "settings", kSettingsSchema);
+  EXPECT_TRUE(reader.isSet());
+  EXPECT_EQ(50, reader.get().brightness);
+  EXPECT_EQ(-60, reader.get().utc_offset_min);
+
+  EXPECT_TRUE(reader.clear());
+  EXPECT_FALSE(reader.isSet());
+  EXPECT_EQ(128, reader.get().brightness);
+}
+
+TEST(RecordTest, IgnoresRecordWithDifferentLayout) {
+  MemoryStore store;
+  Collection col("rec", store);
+  {
+    Record<Settings> settings(col, "settings", kSettingsSchema);
+    ASSERT_TRUE(settings.set(&Settings::brightness, 10));
+  }
+  Record<Settings> renamed(col, "settings", kRenamedSchema);
+  EXPECT_FALSE(renamed.isSet());
+  EXPECT_EQ(128, renamed.get().brightness);
+  EXPECT_TRUE(renamed.set(&Settings::brightness, 20));
+
+  Record<Settings> reader(col, "settings", kRenamedSchema);
+  EXPECT_EQ(20, reader.get().brightness);
+}
+
+TEST(RecordTest, ClearRemovesRecordWithDifferentLayout) {
+  MemoryStore store;
+  Collection col("rec", store);
+  {
+    Record<Settings> settings(col, "settings", kSettingsSchema);
+    ASSERT_TRUE(settings.set(&Settings::brightness, 10));
+  }
+  Record<Settings> renamed(col, "settings", kRenamedSchema);
+  EXPECT_FALSE(renamed.isSet());
+  EXPECT_TRUE(renamed.clear());
+  Transaction t(col, Transaction::Mode::kReadOnly);
+  EXPECT_FALSE(t.store().isKey("settings"));
+}
+
+TEST(RecordTest, IgnoresPadding) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("rec", store);
+  Record<Padded> padded(col, "padded", kPaddedSchema);
+  Padded a;
+  memset(&a, 0xAA, sizeof(a));
+  a.mode = 1;
+  a.interval_ms = 500;
+  Padded b;
+  memset(&b, 0x55, sizeof(b));
+  b.mode = 1;
+  b.interval_ms = 500;
+  EXPECT_TRUE(padded.set(a));
+  EXPECT_TRUE(padded.set(b));
+  EXPECT_EQ(1u, store.totals().writes);
+  EXPECT_TRUE(padded.set(&Padded::interval_ms, 1000u));
+  EXPECT_EQ(2u, store.totals().writes);
+  EXPECT_EQ(1000u, padded.get().interval_ms);
+}
+
+TEST(RecordTest, DetectsMissingFields) {
+  EXPECT_FALSE(
+      SchemaCoversRecord(kIncompleteSchema, sizeof(Padded), alignof(Padded)));
+  // A missing leading field.
+  constexpr FieldInfo kMissingFirst[] = {
+      ROO_PREFS_FIELD(Padded, interval_ms),
+  };
+  EXPECT_FALSE(
+      SchemaCoversRecord(kMissingFirst, sizeof(Padded), alignof(Padded)));
+  // Fields may be listed in any order.
+  constexpr FieldInfo kReordered[] = {
+      ROO_PREFS_FIELD(Padded, interval_ms),
+      ROO_PREFS_FIELD(Padded, mode),
+  };
+  EXPECT_TRUE(SchemaCoversRecord(kReordered, sizeof(Padded), alignof(Padded)));
+
+  // Logs an error; the missing field is not stored.
+  MemoryStore store;
+  Collection col("rec", store);
+  Record<Padded> incomplete(col, "padded", kIncompleteSchema);
+  Padded value = {1, 500};
+  EXPECT_TRUE(incomplete.set(value));
+  EXPECT_EQ(0u, incomplete.get().interval_ms);
+}
+
+}  // namespace roo_prefs
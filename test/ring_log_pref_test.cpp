@@ -0,0 +1,85 @@
+#include "roo_prefs/ring_log_pref.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+
+namespace roo_prefs {
+
+struct Fault {
+  uint32_t time;
+  uint16_t code;
+};
+
+std::vector<uint16_t> Codes(const RingLogPref<Fault, 4>& log) {
+  std::vector<uint16_t> codes;
+  log.forEach([&codes](const Fault& fault) { codes.push_back(fault.code); });
+  return codes;
+}
+
+TEST(RingLogPrefTest, AppendAndWrapAround) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("log", store);
+  {
+    RingLogPref<Fault, 4> log(col, "faults");
+    EXPECT_TRUE(log.empty());
+    EXPECT_EQ(0u, Codes(log).size());
+    for (uint16_t i = 1; i <= 6; ++i) {
+      EXPECT_TRUE(log.append(Fault{i * 10u, i}));
+    }
+    EXPECT_EQ(4u, log.size());
+    EXPECT_EQ((std::vector<uint16_t>{3, 4, 5, 6}), Codes(log));
+    Fault fault;
+    EXPECT_TRUE(log.read(0, fault));
+    EXPECT_EQ(30u, fault.time);
+    EXPECT_FALSE(log.read(4, fault));
+  }
+  // One write of a single slot per append.
+  EXPECT_EQ(6u, store.totals().writes);
+  EXPECT_EQ(6 * (sizeof(uint32_t) + sizeof(Fault)),
+            store.totals().bytes_written);
+
+  RingLogPref<Fault, 4> log(col, "faults");
+  EXPECT_EQ((std::vector<uint16_t>{3, 4, 5, 6}), Codes(log));
+  EXPECT_TRUE(log.append(Fault{70, 7}));
+  EXPECT_EQ((std::vector<uint16_t>{4, 5, 6, 7}), Codes(log));
+
+  EXPECT_TRUE(log.clear());
+  EXPECT_TRUE(log.empty());
+  RingLogPref<Fault, 4> reread(col, "faults");
+  EXPECT_TRUE(reread.empty());
+}
+
+TEST(RingLogPrefTest, SkipsStaleSlots) {
+  MemoryStore store;
+  Collection col("log", store);
+  RingLogPref<Fault, 4> log(col, "faults");
+  for (uint16_t i = 1; i <= 3; ++i) {
+    EXPECT_TRUE(log.append(Fault{0, i}));
+  }
+  {
+    // As if the write of the second record had been lost.
+    Transaction t(col);
+    ASSERT_EQ(ClearResult::kOk, t.store().clear("faults.1"));
+  }
+  EXPECT_EQ(3u, log.size());
+  EXPECT_EQ((std::vector<uint16_t>{1, 3}), Codes(log));
+}
+
+TEST(RingLogPrefTest, KeyLength) {
+  MemoryStore store;
+  Collection col("log", store);
+  // Slot keys "fault_history.0" to "fault_history.3" fit in 15 characters.
+  RingLogPref<Fault, 4> short_log(col, "fault_history");
+  EXPECT_TRUE(short_log.append(Fault{0, 1}));
+  EXPECT_EQ(1u, short_log.size());
+  // "fault_history.10" does not.
+  RingLogPref<Fault, 11> long_log(col, "fault_history");
+  EXPECT_FALSE(long_log.append(Fault{0, 1}));
+  EXPECT_TRUE(long_log.empty());
+  EXPECT_FALSE(long_log.clear());
+}
+
+}  // namespace roo_prefs
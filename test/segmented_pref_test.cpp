@@ -0,0 +1,176 @@
+#include "roo_prefs/segmented_pref.h"
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+
+namespace roo_prefs {
+
+struct Schedule {
+  uint8_t enabled;
+  uint8_t duration_min[7];
+  uint16_t start_min[7][5];
+};
+
+struct Calibration {
+  uint8_t channel;
+  float gain;
+  uint8_t flags;
+};
+
+constexpr FieldInfo kCalibrationSchema[] = {
+    ROO_PREFS_FIELD(Calibration, channel),
+    ROO_PREFS_FIELD(Calibration, gain),
+    ROO_PREFS_FIELD(Calibration, flags),
+};
+
+TEST(SegmentedPrefTest, WritesChangedSegmentsOnly) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("seg", store);
+  EXPECT_EQ(3u, (SegmentedPref<Schedule, 32>::segments()));
+  {
+    SegmentedPref<Schedule, 32> schedule(col, "zone");
+    EXPECT_FALSE(schedule.isSet());
+    EXPECT_TRUE(schedule.set(Schedule()));
+    EXPECT_TRUE(schedule.isSet());
+    EXPECT_EQ(3u, store.totals().writes);
+
+    EXPECT_TRUE(schedule.set(&Schedule::enabled, 1));
+    EXPECT_EQ(4u, store.totals().writes);
+    EXPECT_EQ(2u, store.stats("zone.0")->writes);
+    EXPECT_EQ(1u, store.stats("zone.1")->writes);
+
+    // Spans the last two segments.
+    EXPECT_TRUE(schedule.edit([](Schedule& s) {
+      s.start_min[3][0] = 360;
+      s.start_min[6][4] = 1200;
+    }));
+    EXPECT_EQ(2u, store.stats("zone.0")->writes);
+    EXPECT_EQ(2u, store.stats("zone.1")->writes);
+    EXPECT_EQ(2u, store.stats("zone.2")->writes);
+    EXPECT_EQ(0u, store.stats(internal::kJournalKey)->writes);
+
+    // Unchanged.
+    EXPECT_TRUE(schedule.set(&Schedule::enabled, 1));
+    EXPECT_EQ(2u, store.stats("zone.0")->writes);
+  }
+
+  // Reassembled from the segments.
+  SegmentedPref<Schedule, 32> schedule(col, "zone");
+  EXPECT_EQ(1, schedule.get().enabled);
+  EXPECT_EQ(360, schedule.get().start_min[3][0]);
+  EXPECT_EQ(1200, schedule.get().start_min[6][4]);
+
+  EXPECT_TRUE(schedule.clear());
+  EXPECT_FALSE(schedule.isSet());
+  EXPECT_EQ(0, schedule.get().enabled);
+  Transaction t(col, Transaction::Mode::kReadOnly);
+  EXPECT_FALSE(t.store().isKey("zone.1"));
+}
+
+TEST(SegmentedPrefTest, AtomicWritesUseJournal) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("seg", store);
+  SegmentedPref<Schedule, 32> schedule(col, "zone");
+  schedule.setAtomicWrites(true);
+  EXPECT_TRUE(schedule.set(Schedule()));
+  // All segments, and the journal.
+  EXPECT_EQ(4u, store.totals().writes);
+  EXPECT_EQ(1u, store.stats(internal::kJournalKey)->writes);
+  // A single segment is written directly.
+  EXPECT_TRUE(schedule.set(&Schedule::enabled, 1));
+  EXPECT_EQ(5u, store.totals().writes);
+  EXPECT_EQ(1u, store.stats(internal::kJournalKey)->writes);
+  EXPECT_TRUE(schedule.edit([](Schedule& s) {
+    s.start_min[3][0] = 360;
+    s.start_min[6][4] = 1200;
+  }));
+  EXPECT_EQ(2u, store.stats(internal::kJournalKey)->writes);
+  Transaction t(col, Transaction::Mode::kReadOnly);
+  EXPECT_FALSE(t.store().isKey(internal::kJournalKey));
+}
+
+TEST(SegmentedPrefTest, DoesNotDeferWritesOfEnclosingTransaction) {
+  MemoryStore store;
+  Collection col("seg", store);
+  SegmentedPref<Schedule, 32> schedule(col, "zone");
+  schedule.setAtomicWrites(true);
+  Int32 pref(col, "pref");
+  Transaction t(col);
+  EXPECT_TRUE(schedule.set(Schedule()));
+  EXPECT_TRUE(t.store().isKey("zone.2"));
+  EXPECT_TRUE(pref.set(5));
+  EXPECT_TRUE(t.store().isKey("pref"));
+  EXPECT_EQ(5, pref.get());
+}
+
+TEST(SegmentedPrefTest, DestroyedInBatchedTransaction) {
+  MemoryStore store;
+  Collection col("seg", store);
+  Int32 pref(col, "pref");
+  Transaction t(col, Transaction::Mode::kBatched);
+  {
+    SegmentedPref<Schedule, 32> schedule(col, "zone");
+    EXPECT_TRUE(schedule.set(Schedule()));
+  }
+  EXPECT_TRUE(pref.set(5));
+  EXPECT_TRUE(t.commit());
+  EXPECT_FALSE(t.store().isKey("zone.0"));
+  EXPECT_EQ(5, pref.get());
+}
+
+TEST(SegmentedPrefTest, IgnoresDifferentLayout) {
+  Collection col("seg_layout");
+  {
+    SegmentedPref<Schedule, 16> schedule(col, "zone");
+    EXPECT_TRUE(schedule.set(&Schedule::enabled, 1));
+  }
+  // Fewer, larger segments.
+  SegmentedPref<Schedule, 32> schedule(col, "zone");
+  EXPECT_FALSE(schedule.isSet());
+  EXPECT_EQ(0, schedule.get().enabled);
+}
+
+TEST(SegmentedPrefTest, KeyLength) {
+  MemoryStore store;
+  Collection col("seg", store);
+  // Segment keys "zone_schedule.0" to "zone_schedule.2" fit in 15 characters.
+  SegmentedPref<Schedule, 32> fits(col, "zone_schedule");
+  Schedule value = Schedule();
+  value.enabled = 1;
+  EXPECT_TRUE(fits.set(value));
+  EXPECT_TRUE(fits.isSet());
+  SegmentedPref<Schedule, 32> too_long(col, "zone_schedules");
+  EXPECT_FALSE(too_long.set(value));
+  EXPECT_FALSE(too_long.isSet());
+  EXPECT_EQ(0, too_long.get().enabled);
+  EXPECT_FALSE(too_long.clear());
+}
+
+TEST(SegmentedPrefTest, IgnoresPadding) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("seg", store);
+  SegmentedPref<Calibration, 4> calibration(col, "cal", kCalibrationSchema);
+  Calibration a;
+  memset(&a, 0xAA, sizeof(a));
+  a.channel = 1;
+  a.gain = 2.5f;
+  a.flags = 0;
+  Calibration b;
+  memset(&b, 0x55, sizeof(b));
+  b.channel = 1;
+  b.gain = 2.5f;
+  b.flags = 0;
+  EXPECT_TRUE(calibration.set(a));
+  EXPECT_EQ(3u, store.totals().writes);
+  EXPECT_TRUE(calibration.set(b));
+  EXPECT_EQ(3u, store.totals().writes);
+  EXPECT_TRUE(calibration.set(&Calibration::flags, 1));
+  EXPECT_EQ(4u, store.totals().writes);
+  EXPECT_EQ(1u, store.stats("cal.1")->writes);
+  EXPECT_EQ(2u, store.stats("cal.2")->writes);
+}
+
+}  // namespace roo_prefs
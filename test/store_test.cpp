@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+#include "roo_prefs/impl/journal.h"
+#include "roo_prefs/impl/lz.h"
+
+namespace roo_prefs {
+
+namespace {
+
+std::string TempPath(const char* name) {
+  const char* dir = getenv("TEST_TMPDIR");
+  std::string path = (dir != nullptr) ? dir : "/tmp";
+  path += "/";
+  path += name;
+  remove(path.c_str());
+  remove((path + ".tmp").c_str());
+  return path;
+}
+
+}  // namespace
+
+TEST(MemoryStoreTest, AllSimpleTypes) {
+  MemoryStore store;
+  Collection col("mem", store);
+
+  Bool pref_bool(col, "bool");
+  Uint8 pref_u8(col, "u8");
+  Int16 pref_i16(col, "i16");
+  Uint32 pref_u32(col, "u32");
+  Int64 pref_i64(col, "i64");
+  Float pref_float(col, "float");
+  Double pref_double(col, "double");
+  String pref_str(col, "str");
+
+  EXPECT_FALSE(pref_bool.isSet());
+  EXPECT_TRUE(pref_bool.set(true));
+  EXPECT_TRUE(pref_u8.set(123));
+  EXPECT_TRUE(pref_i16.set(-12345));
+  EXPECT_TRUE(pref_u32.set(1234567890u));
+  EXPECT_TRUE(pref_i64.set(-1234567890123456789LL));
+  EXPECT_TRUE(pref_float.set(3.14159f));
+  EXPECT_TRUE(pref_double.set(2.718281828459045));
+  EXPECT_TRUE(pref_str.set("Hello"));
+
+  Bool read_bool(col, "bool");
+  Uint8 read_u8(col, "u8");
+  Int16 read_i16(col, "i16");
+  Uint32 read_u32(col, "u32");
+  Int64 read_i64(col, "i64");
+  Float read_float(col, "float");
+  Double read_double(col, "double");
+  String read_str(col, "str");
+
+  EXPECT_TRUE(read_bool.get());
+  EXPECT_EQ(123, read_u8.get());
+  EXPECT_EQ(-12345, read_i16.get());
+  EXPECT_EQ(1234567890u, read_u32.get());
+  EXPECT_EQ(-1234567890123456789LL, read_i64.get());
+  EXPECT_FLOAT_EQ(3.14159f, read_float.get());
+  EXPECT_DOUBLE_EQ(2.718281828459045, read_double.get());
+  EXPECT_EQ("Hello", read_str.get());
+  EXPECT_EQ(8u, store.size());
+
+  EXPECT_TRUE(read_str.clear());
+  String cleared_str(col, "str", "default");
+  EXPECT_FALSE(cleared_str.isSet());
+  EXPECT_EQ("default", cleared_str.get());
+}
+
+TEST(MemoryStoreTest, DirectAccess) {
+  MemoryStore store;
+  Collection col("mem", store);
+  Transaction t(col);
+  int32_t val = 1234;
+  EXPECT_EQ(ReadResult::kNotFound, t.store().readI32("pref_int", val));
+  EXPECT_EQ(WriteResult::kOk, t.store().writeI32("pref_int", 999));
+  EXPECT_TRUE(t.store().isKey("pref_int"));
+  EXPECT_EQ(ReadResult::kOk, t.store().readI32("pref_int", val));
+  EXPECT_EQ(999, val);
+  uint32_t uval;
+  EXPECT_EQ(ReadResult::kWrongType, t.store().readU32("pref_int", uval));
+  EXPECT_EQ(ClearResult::kOk, t.store().clear("pref_int"));
+  EXPECT_EQ(ClearResult::kError, t.store().clear("pref_int"));
+  EXPECT_FALSE(t.store().isKey("pref_int"));
+
+  uint8_t byte = 0xAB;
+  EXPECT_EQ(WriteResult::kError, t.store().writeBytes("blob", &byte, 0));
+  EXPECT_EQ(WriteResult::kOk, t.store().writeBytes("blob", &byte, 1));
+  size_t len = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readBytesLength("blob", &len));
+  EXPECT_EQ(1u, len);
+
+  ASSERT_EQ(WriteResult::kOk, t.store().writeString("str", "abc"));
+  char buf[4];
+  EXPECT_EQ(ReadResult::kOk,
+            t.store().readStringInto("str", buf, sizeof(buf), &len));
+  EXPECT_EQ(3u, len);
+  EXPECT_STREQ("abc", buf);
+  EXPECT_EQ(ReadResult::kError, t.store().readStringInto("str", buf, 3, &len));
+  ASSERT_EQ(WriteResult::kOk, t.store().writeI32("pref_int", 5));
+  EXPECT_EQ(ReadResult::kWrongType,
+            t.store().readStringInto("pref_int", buf, sizeof(buf), &len));
+}
+
+TEST(MemoryStoreTest, FloatingPointIsStoredAsBits) {
+  MemoryStore store;
+  Collection col("mem", store);
+  Transaction t(col);
+  ASSERT_EQ(WriteResult::kOk, t.store().writeFloat("float", 1.5f));
+  ASSERT_EQ(WriteResult::kOk, t.store().writeDouble("double", -2.25));
+  ASSERT_EQ(WriteResult::kOk, t.store().writeU32("u32", 0x3FC00000));
+  ASSERT_EQ(WriteResult::kOk, t.store().writeI32("i32", 0x3FC00000));
+  uint32_t u32 = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readU32("float", u32));
+  EXPECT_EQ(0x3FC00000u, u32);
+  uint64_t u64 = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readU64("double", u64));
+  EXPECT_EQ(0xC002000000000000u, u64);
+  size_t len;
+  EXPECT_EQ(ReadResult::kWrongType, t.store().readBytesLength("float", &len));
+
+  // As in PreferencesStore, a float read of a U32 entry reinterprets its
+  // bits, and a float read of any other type is a type mismatch.
+  float f = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readFloat("u32", f));
+  EXPECT_EQ(1.5f, f);
+  EXPECT_EQ(ReadResult::kWrongType, t.store().readFloat("i32", f));
+  double d = 0;
+  EXPECT_EQ(ReadResult::kWrongType, t.store().readDouble("float", d));
+  EXPECT_EQ(ReadResult::kOk, t.store().readDouble("double", d));
+  EXPECT_EQ(-2.25, d);
+
+  // Blobs written by earlier versions still read.
+  ASSERT_EQ(WriteResult::kOk, t.store().writeBytes("legacy", &f, sizeof(f)));
+  f = 0;
+  EXPECT_EQ(ReadResult::kOk, t.store().readFloat("legacy", f));
+  EXPECT_EQ(1.5f, f);
+}
+
+TEST(MemoryStoreTest, ReadOnlyTransactionRejectsWrites) {
+  MemoryStore store;
+  Collection col("mem", store);
+  Transaction t(col, Transaction::Mode::kReadOnly);
+  ASSERT_TRUE(t.active());
+  EXPECT_EQ(WriteResult::kError, t.store().writeU8("u8", 1));
+  EXPECT_FALSE(t.store().isKey("u8"));
+}
+
+TEST(FileStoreTest, PersistsAcrossInstances) {
+  std::string path = TempPath("file_store_persist.log");
+  {
+    FileStore store(path.c_str());
+    Collection col("file", store);
+    Int32 pref_int(col, "int");
+    String pref_str(col, "str");
+    EXPECT_FALSE(pref_int.isSet());
+    EXPECT_TRUE(pref_int.set(42));
+    EXPECT_TRUE(pref_str.set("Hello"));
+    EXPECT_TRUE(pref_str.set("World"));
+    Uint8 pref_gone(col, "gone");
+    EXPECT_TRUE(pref_gone.set(5));
+    EXPECT_TRUE(pref_gone.clear());
+  }
+  {
+    FileStore store(path.c_str());
+    Collection col("file", store);
+    Int32 pref_int(col, "int");
+    String pref_str(col, "str");
+    Uint8 pref_gone(col, "gone");
+    EXPECT_EQ(42, pref_int.get());
+    EXPECT_EQ("World", pref_str.get());
+    EXPECT_FALSE(pref_gone.isSet());
+  }
+}
+
+TEST(FileStoreTest, FlushesWhenKeptOpen) {
+  std::string path = TempPath("file_store_keep_open.log");
+  FileStore store(path.c_str());
+  Collection col("file", store);
+  col.setKeepOpen(true);
+  Int32 pref_int(col, "int");
+  EXPECT_TRUE(pref_int.set(42));
+  EXPECT_TRUE(col.isOpen());
+
+  // Visible to another instance while the first one is still open.
+  FileStore other(path.c_str());
+  Collection other_col("file", other);
+  Int32 other_int(other_col, "int");
+  EXPECT_EQ(42, other_int.get());
+}
+
+TEST(FileStoreTest, IgnoresTornTrailingRecord) {
+  std::string path = TempPath("file_store_torn.log");
+  {
+    FileStore store(path.c_str());
+    Collection col("file", store);
+    Uint32 pref(col, "u32");
+    EXPECT_TRUE(pref.set(7));
+  }
+  {
+    FILE* f = fopen(path.c_str(), "ab");
+    ASSERT_NE(nullptr, f);
+    fputs("\x01\x04\x03garbage", f);
+    fclose(f);
+  }
+  {
+    FileStore store(path.c_str());
+    Collection col("file", store);
+    Uint32 pref(col, "u32");
+    EXPECT_EQ(7u, pref.get());
+    EXPECT_TRUE(pref.set(8));
+  }
+  {
+    FileStore store(path.c_str());
+    Collection col("file", store);
+    Uint32 pref(col, "u32");
+    EXPECT_EQ(8u, pref.get());
+  }
+}
+
+TEST(FileStoreTest, CompactsOverwrittenRecords) {
+  std::string path = TempPath("file_store_compact.log");
+  {
+    FileStore store(path.c_str());
+    Collection col("file", store);
+    Uint32 pref(col, "u32");
+    for (uint32_t i = 0; i < 1000; ++i) {
+      EXPECT_TRUE(pref.set(i));
+    }
+    // Without compaction, the log would hold 1000 records.
+    EXPECT_LT(store.log_size(), 5000u);
+  }
+  {
+    FileStore store(path.c_str());
+    Collection col("file", store);
+    Uint32 pref(col, "u32");
+    EXPECT_EQ(999u, pref.get());
+  }
+}
+
+TEST(AccountingStoreTest, CountsPerKey) {
+  MemoryStore mem;
+  AccountingStore store(mem);
+  Collection col("acct", store);
+  Uint8 small(col, "small");
+  StdString text(col, "text");
+  EXPECT_TRUE(small.set(1));
+  EXPECT_TRUE(small.set(1));
+  EXPECT_TRUE(small.set(2));
+  EXPECT_TRUE(text.set(std::string(40, 'x')));
+  EXPECT_TRUE(text.clear());
+
+  const AccountingStore::Stats* s = store.stats("small");
+  ASSERT_NE(nullptr, s);
+  EXPECT_EQ(2u, s->writes);
+  EXPECT_EQ(2u, s->bytes_written);
+  EXPECT_EQ(1u, s->suppressed_writes);
+  EXPECT_EQ(1u, s->reads);
+  EXPECT_EQ(2u, s->nvs_entries);
+
+  s = store.stats("text");
+  ASSERT_NE(nullptr, s);
+  EXPECT_EQ(1u, s->writes);
+  EXPECT_EQ(40u, s->bytes_written);
+  EXPECT_EQ(1u, s->clears);
+  // Stored as a blob: index and chunk header, plus 40 bytes of data.
+  EXPECT_EQ(4u, s->nvs_entries);
+
+  EXPECT_EQ(3u, store.totals().writes);
+  EXPECT_EQ(6u, store.totals().nvs_entries);
+
+  // Empty strings are stored as NVS strings: header, plus the terminator.
+  EXPECT_TRUE(text.set(""));
+  EXPECT_EQ(4u + 2u, store.stats("text")->nvs_entries);
+  EXPECT_STREQ("acct", store.collection_name());
+  store.dump();
+
+  store.reset();
+  EXPECT_EQ(nullptr, store.stats("small"));
+  EXPECT_EQ(0u, store.totals().writes);
+}
+
+TEST(CompressingStoreTest, RoundTrips) {
+  MemoryStore mem;
+  CompressingStore store(mem);
+  Collection col("lz", store);
+  std::string json;
+  for (int i = 0; i < 20; ++i) {
+    json += "{\"id\":" + std::to_string(i) + ",\"enabled\":true},";
+  }
+  struct Table {
+    uint16_t values[64];
+
+    bool operator==(const Table& other) const {
+      return memcmp(values, other.values, sizeof(values)) == 0;
+    }
+  } table = {};
+  for (int i = 0; i < 64; ++i) table.values[i] = i / 8;
+  {
+    StdString text(col, "text");
+    Pref<Table> lut(col, "lut");
+    EXPECT_TRUE(text.set(json));
+    EXPECT_TRUE(lut.set(table));
+  }
+  EXPECT_EQ(2u, store.stats().compressed_writes);
+  EXPECT_GT(store.stats().ratio(), 2.0f);
+
+  StdString text(col, "text");
+  Pref<Table> lut(col, "lut");
+  EXPECT_EQ(json, text.get());
+  EXPECT_TRUE(table == lut.get());
+
+  Transaction t(col, Transaction::Mode::kReadOnly);
+  // The values are stored compressed.
+  size_t len;
+  EXPECT_EQ(ReadResult::kOk, mem.readBytesLength("lut", &len));
+  EXPECT_LT(len, sizeof(Table));
+  char buf[1024];
+  ASSERT_EQ(ReadResult::kOk,
+            t.store().readStringInto("text", buf, sizeof(buf), &len));
+  EXPECT_EQ(json, std::string(buf, len));
+  EXPECT_EQ(ReadResult::kError,
+            t.store().readStringInto("text", buf, json.size(), &len));
+}
+
+TEST(CompressingStoreTest, ReadsUncompressedValues) {
+  MemoryStore mem;
+  std::string legacy(100, 'a');
+  {
+    Collection col("lz", mem);
+    Transaction t(col);
+    ASSERT_EQ(WriteResult::kOk, t.store().writeString("legacy", legacy));
+    // Begins with the magic bytes of the tag, a codec, and a length, but has
+    // no checksum.
+    const uint8_t blob[10] = {0xFF, 'Z', 0, 3, 0, 0, 0, 1, 2, 3};
+    ASSERT_EQ(WriteResult::kOk, t.store().writeBytes("blob", blob, 10));
+  }
+  // Blobs that look compressed, and small blobs, are stored as they are.
+  uint8_t tricky[10] = {0xFF, 'Z', 1, 200, 0, 0, 0, 1, 2, 3};
+
+  CompressingStore store(mem);
+  Collection col("lz", store);
+  Transaction t(col);
+  ASSERT_EQ(WriteResult::kOk, t.store().writeBytes("tricky", tricky, 10));
+  ASSERT_EQ(WriteResult::kOk, t.store().writeString("short", "short"));
+  EXPECT_EQ(0u, store.stats().compressed_writes);
+
+  std::string val;
+  EXPECT_EQ(ReadResult::kOk, t.store().readString("legacy", val));
+  EXPECT_EQ(legacy, val);
+  EXPECT_EQ(ReadResult::kOk, t.store().readString("short", val));
+  EXPECT_EQ("short", val);
+  uint8_t buf[10];
+  size_t len;
+  EXPECT_EQ(ReadResult::kOk, t.store().readBytesLength("tricky", &len));
+  EXPECT_EQ(10u, len);
+  EXPECT_EQ(ReadResult::kOk, t.store().readBytes("tricky", buf, 10, &len));
+  EXPECT_EQ(0, memcmp(tricky, buf, 10));
+  EXPECT_EQ(ReadResult::kOk, t.store().readBytes("blob", buf, 10, &len));
+  EXPECT_EQ(10u, len);
+  EXPECT_EQ(3, buf[3]);
+}
+
+TEST(CompressingStoreTest, EndsBlocksWithLiterals) {
+  // As required by the LZ4 block format: the last match starts at least 12
+  // bytes before the end, and the last 5 bytes are literals.
+  uint8_t in[100];
+  memset(in, 'a', sizeof(in));
+  uint8_t out[100];
+  size_t len = internal::LzCompress(in, sizeof(in), out, sizeof(out));
+  ASSERT_GT(len, 6u);
+  EXPECT_EQ(0x50, out[len - 6]);
+  EXPECT_EQ(0, memcmp(in, out + len - 5, 5));
+  uint8_t back[100];
+  EXPECT_TRUE(internal::LzDecompress(out, len, back, sizeof(back)));
+  EXPECT_EQ(0, memcmp(in, back, sizeof(in)));
+}
+
+TEST(CompressingStoreTest, ReplaysJournaledObjects) {
+  MemoryStore mem;
+  CompressingStore store(mem);
+  Collection col("lz", store);
+  // Looks compressed, so that written as a blob, it would get tagged.
+  struct Tricky {
+    uint8_t bytes[10];
+  } tricky = {{0xFF, 'Z', 1, 200, 0, 0, 0, 1, 2, 3}};
+  internal::JournalRecorder journal;
+  ASSERT_EQ(WriteResult::kOk, journal.writeObject("tricky", tricky));
+  {
+    Transaction t(col);
+    ASSERT_EQ(WriteResult::kOk,
+              journal.save(t.store(), internal::kJournalKey));
+  }
+  // As if after a reset.
+  Collection reopened("lz", store);
+  Transaction t(reopened);
+  EXPECT_FALSE(t.store().isKey(internal::kJournalKey));
+  Tricky read;
+  EXPECT_EQ(ReadResult::kOk, t.store().readObject("tricky", read));
+  EXPECT_EQ(0, memcmp(tricky.bytes, read.bytes, 10));
+}
+
+}  // namespace roo_prefs
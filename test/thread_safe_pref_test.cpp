@@ -0,0 +1,96 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "roo_prefs.h"
+
+static_assert(ROO_PREFS_THREAD_SAFE, "Must be built with thread safety on");
+
+namespace roo_prefs {
+
+struct Pair {
+  uint32_t value;
+  uint32_t complement;
+
+  bool operator==(const Pair& other) const {
+    return value == other.value && complement == other.complement;
+  }
+};
+
+TEST(ThreadSafePrefTest, LoadsSeeConsistentValues) {
+  MemoryStore store;
+  Collection col("foo", store);
+  Pref<Pair> pair(col, "pair", Pair{0, ~0u});
+  Uint64 counter(col, "counter");
+  std::atomic<bool> done(false);
+  std::atomic<int> torn(0);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      uint64_t last = 0;
+      while (!done.load()) {
+        Pair p = pair.load();
+        if (p.complement != ~p.value) ++torn;
+        uint64_t c = counter.load();
+        if (c < last || (c >> 32) != (c & 0xFFFFFFFF)) ++torn;
+        last = c;
+      }
+    });
+  }
+  for (uint32_t i = 1; i <= 2000; ++i) {
+    ASSERT_TRUE(pair.set(Pair{i, ~i}));
+    ASSERT_TRUE(counter.set(((uint64_t)i << 32) | i));
+  }
+  done = true;
+  for (auto& t : readers) t.join();
+  EXPECT_EQ(0, torn.load());
+  EXPECT_EQ(2000u, pair.load().value);
+}
+
+TEST(ThreadSafePrefTest, ConcurrentTransactions) {
+  MemoryStore store;
+  Collection col("foo", store);
+  static const char* kKeys[] = {"a", "b", "c", "d"};
+  std::vector<std::thread> writers;
+  for (const char* key : kKeys) {
+    writers.emplace_back([&col, key]() {
+      Int32 pref(col, key);
+      for (int i = 1; i <= 500; ++i) {
+        Transaction t(col, (i % 2 == 0) ? Transaction::Mode::kBatched
+                                        : Transaction::Mode::kReadWrite);
+        ASSERT_TRUE(t.active());
+        ASSERT_TRUE(pref.set(i));
+        ASSERT_TRUE(pref.set(i + 1000));
+      }
+    });
+  }
+  for (auto& t : writers) t.join();
+  EXPECT_FALSE(col.inTransaction());
+  for (const char* key : kKeys) {
+    Int32 pref(col, key);
+    EXPECT_EQ(1500, pref.get());
+  }
+}
+
+TEST(ThreadSafePrefTest, ConcurrentFirstReads) {
+  MemoryStore store;
+  Collection col("foo", store);
+  {
+    StdString writer(col, "str");
+    ASSERT_TRUE(writer.set("persisted"));
+  }
+  StdString pref(col, "str");
+  std::vector<std::thread> readers;
+  std::atomic<int> mismatches(0);
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([&]() {
+      if (pref.load() != "persisted") ++mismatches;
+      if (!pref.isSet()) ++mismatches;
+    });
+  }
+  for (auto& t : readers) t.join();
+  EXPECT_EQ(0, mismatches.load());
+}
+
+}  // namespace roo_prefs